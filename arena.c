@@ -0,0 +1,257 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <threads.h>
+
+#define LOG_MODULE "arena"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+#define INITIAL_CHUNK_SIZE 4096
+
+struct chunk {
+    struct chunk *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+struct frame_arena {
+    struct chunk *chunks;  /* Current chunk first */
+    struct frame_arena_stats stats;
+
+    struct frame_arena *next;  /* In 'arenas' */
+};
+
+static thread_local struct frame_arena *active;
+
+/*
+ * All live arenas, so that frame_free() can tell arena memory from
+ * heap memory regardless of which arena, if any, is active. Arenas
+ * are used from several threads; 'lock' protects the list, and each
+ * arena's list of chunks.
+ */
+static struct {
+    mtx_t lock;
+    struct frame_arena *head;
+} arenas;
+
+static once_flag arenas_once = ONCE_FLAG_INIT;
+
+static void
+arenas_init(void)
+{
+    mtx_init(&arenas.lock, mtx_plain);
+}
+
+static struct chunk *
+chunk_new(struct frame_arena *arena, size_t size)
+{
+    struct chunk *chunk = malloc(sizeof(*chunk) + size);
+    chunk->size = size;
+    chunk->used = 0;
+
+    mtx_lock(&arenas.lock);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    mtx_unlock(&arenas.lock);
+
+    arena->stats.chunks++;
+    arena->stats.size += size;
+    return chunk;
+}
+
+static void
+chunks_free(struct frame_arena *arena)
+{
+    mtx_lock(&arenas.lock);
+    struct chunk *chunks = arena->chunks;
+    arena->chunks = NULL;
+    mtx_unlock(&arenas.lock);
+
+    for (struct chunk *chunk = chunks, *next; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    arena->stats.size = 0;
+}
+
+struct frame_arena *
+frame_arena_new(void)
+{
+    call_once(&arenas_once, &arenas_init);
+
+    struct frame_arena *arena = calloc(1, sizeof(*arena));
+
+    mtx_lock(&arenas.lock);
+    arena->next = arenas.head;
+    arenas.head = arena;
+    mtx_unlock(&arenas.lock);
+
+    return arena;
+}
+
+void
+frame_arena_destroy(struct frame_arena *arena)
+{
+    if (arena == NULL)
+        return;
+
+    assert(active != arena);
+    chunks_free(arena);
+
+    mtx_lock(&arenas.lock);
+    for (struct frame_arena **prev = &arenas.head; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == arena) {
+            *prev = arena->next;
+            break;
+        }
+    }
+    mtx_unlock(&arenas.lock);
+
+    free(arena);
+}
+
+void
+frame_arena_reset(struct frame_arena *arena)
+{
+    arena->stats.resets++;
+
+    if (arena->chunks == NULL)
+        return;
+
+    if (arena->chunks->next == NULL) {
+        arena->chunks->used = 0;
+        return;
+    }
+
+    /*
+     * The last frame did not fit in a single chunk. Replace them all
+     * with one large enough, so that the following frames don't have
+     * to allocate.
+     */
+    const size_t size = arena->stats.size;
+    chunks_free(arena);
+    chunk_new(arena, size);
+
+    LOG_DBG("%p: coalesced into a single %zu byte chunk", (void *)arena, size);
+}
+
+struct frame_arena *
+frame_arena_activate(struct frame_arena *arena)
+{
+    struct frame_arena *prev = active;
+    active = arena;
+    return prev;
+}
+
+void
+frame_arena_stats(const struct frame_arena *arena, struct frame_arena_stats *stats)
+{
+    *stats = arena->stats;
+}
+
+static bool
+arena_owns(const struct frame_arena *arena, const void *ptr)
+{
+    const char *p = ptr;
+
+    for (const struct chunk *chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+        if (p >= chunk->data && p < chunk->data + chunk->size)
+            return true;
+    }
+
+    return false;
+}
+
+void *
+frame_alloc(size_t size)
+{
+    struct frame_arena *arena = active;
+    if (arena == NULL)
+        return malloc(size);
+
+    const size_t align = alignof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+
+    struct chunk *chunk = arena->chunks;
+
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = chunk != NULL ? chunk->size * 2 : INITIAL_CHUNK_SIZE;
+        while (chunk_size < size)
+            chunk_size *= 2;
+
+        chunk = chunk_new(arena, chunk_size);
+    }
+
+    void *ptr = &chunk->data[chunk->used];
+    chunk->used += size;
+    arena->stats.allocs++;
+    return ptr;
+}
+
+void *
+frame_calloc(size_t nmemb, size_t size)
+{
+    if (active == NULL)
+        return calloc(nmemb, size);
+
+    if (size != 0 && nmemb > SIZE_MAX / size)
+        return NULL;
+
+    void *ptr = frame_alloc(nmemb * size);
+    memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+char *
+frame_strdup(const char *s)
+{
+    if (active == NULL)
+        return strdup(s);
+
+    const size_t len = strlen(s);
+    char *copy = frame_alloc(len + 1);
+    memcpy(copy, s, len + 1);
+    return copy;
+}
+
+/* Whether 'ptr' belongs to any live arena */
+static bool
+any_arena_owns(const void *ptr)
+{
+    bool owned = false;
+
+    mtx_lock(&arenas.lock);
+    for (const struct frame_arena *arena = arenas.head;
+         arena != NULL && !owned;
+         arena = arena->next)
+    {
+        owned = arena_owns(arena, ptr);
+    }
+    mtx_unlock(&arenas.lock);
+
+    return owned;
+}
+
+void
+frame_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    /* Common case; only this thread modifies the active arena */
+    if (active != NULL && arena_owns(active, ptr))
+        return;
+
+    /* Allocated while another arena was active, or none at all */
+    if (any_arena_owns(ptr))
+        return;
+
+    free(ptr);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Frame arenas.
+ *
+ * Each module owns an arena. Everything allocated while its content
+ * is instantiated (tags, exposables, on-click commands, the
+ * particles' per-exposable state) comes from it, and is released in
+ * one go when the content is replaced (see module_begin_expose() and
+ * module_end_expose()).
+ *
+ * frame_alloc() and friends allocate from the arena that is active in
+ * the calling thread, and fall back to malloc() when no arena is
+ * active. frame_free() ignores memory owned by any arena (active or
+ * not), and free():s everything else. Code that may run both inside
+ * and outside a frame can thus use them unconditionally; it must
+ * however not keep frame allocations beyond the lifetime of its
+ * exposable.
+ */
+struct frame_arena;
+
+struct frame_arena_stats {
+    uint64_t resets;
+    uint64_t allocs;  /* Allocations served from the arena */
+    uint64_t chunks;  /* Chunks allocated from the heap */
+    size_t size;      /* Current capacity, in bytes */
+};
+
+struct frame_arena *frame_arena_new(void);
+void frame_arena_destroy(struct frame_arena *arena);
+
+/* Releases all allocations; the memory is kept for the next frame */
+void frame_arena_reset(struct frame_arena *arena);
+
+/* Makes 'arena' (may be NULL) the active one; returns the previous */
+struct frame_arena *frame_arena_activate(struct frame_arena *arena);
+
+void frame_arena_stats(const struct frame_arena *arena,
+                       struct frame_arena_stats *stats);
+
+void *frame_alloc(size_t size);
+void *frame_calloc(size_t nmemb, size_t size);
+char *frame_strdup(const char *s);
+void frame_free(void *ptr);
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <threads.h>
 #include <assert.h>
 #include <unistd.h>
@@ -16,6 +17,7 @@
 #define LOG_MODULE "bar"
 #define LOG_ENABLE_DBG 0
 #include "../log.h"
+#include "../proc-sampler.h"
 
 #if defined(ENABLE_X11)
  #include "xcb.h"
@@ -25,14 +27,16 @@
  #include "wayland.h"
 #endif
 
+#include "headless.h"
+
 #define max(x, y) ((x) > (y) ? (x) : (y))
 
 /*
  * Calculate total width of left/center/rigth groups.
  * Note: begin_expose() must have been called
  */
-static void
-calculate_widths(const struct private *b, int *left, int *center, int *right)
+void
+bar_calculate_widths(const struct private *b, int *left, int *center, int *right)
 {
     *left = 0;
     *center = 0;
@@ -69,12 +73,249 @@ calculate_widths(const struct private *b, int *left, int *center, int *right)
     assert(*right >= 0);
 }
 
+/*
+ * Re-creates the exposables of all dirty modules (or all modules, if
+ * 'all' is set). Clean modules keep the exposable from the previous
+ * frame.
+ */
+static void
+update_exposables(struct private *bar, struct module **mods,
+                  struct exposable **exps, struct module_slot *slots,
+                  size_t count, bool all)
+{
+    for (size_t i = 0; i < count; i++) {
+        struct module *m = mods[i];
+        struct exposable *e = exps[i];
+
+        const bool dirty = atomic_exchange(&m->dirty, false);
+
+        if (e != NULL && !dirty && !all) {
+            bar->stats.content_skipped++;
+            continue;
+        }
+
+        if (e != NULL)
+            module_end_expose(m, e);
+        exps[i] = module_begin_expose(m);
+        assert(exps[i]->width >= 0);
+        slots[i].rebuilt = true;
+        bar->stats.content_calls++;
+    }
+}
+
+/*
+ * Lays out a group, starting at 'x'. Exposables that were re-created,
+ * moved or resized add both their old and their new location to the
+ * damage region.
+ */
+static void
+damage_group(struct private *bar, struct exposable **exps,
+             struct module_slot *slots, size_t count, int x)
+{
+    const int y = bar->border.top_width;
+
+    for (size_t i = 0; i < count; i++) {
+        const struct exposable *e = exps[i];
+        struct module_slot *slot = &slots[i];
+        const int new_x = x + bar->left_spacing;
+
+        if (slot->rebuilt || slot->x != new_x || slot->width != e->width) {
+            if (slot->width > 0) {
+                pixman_region32_union_rect(
+                    &bar->damage, &bar->damage,
+                    slot->x, y, slot->width, bar->height);
+            }
+            if (e->width > 0) {
+                pixman_region32_union_rect(
+                    &bar->damage, &bar->damage,
+                    new_x, y, e->width, bar->height);
+            }
+        }
+
+        slot->x = new_x;
+        slot->width = e->width;
+        slot->rebuilt = false;
+
+        if (e->width > 0)
+            x += bar->left_spacing + e->width + bar->right_spacing;
+    }
+}
+
+static void
+hit_index_add(struct private *bar, struct exposable **exps,
+              const struct module_slot *slots, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (exps[i]->width == 0)
+            continue;
+
+        bar->hit.ranges[bar->hit.count++] = (struct hit_range){
+            .x0 = slots[i].x,
+            .x1 = slots[i].x + exps[i]->width,
+            .exposable = exps[i],
+        };
+    }
+}
+
+static int
+hit_range_cmp(const void *_a, const void *_b)
+{
+    const struct hit_range *a = _a;
+    const struct hit_range *b = _b;
+    return a->x0 < b->x0 ? -1 : a->x0 > b->x0;
+}
+
+/* Re-builds the hit-test index from the current layout */
+static void
+hit_index_update(struct private *bar)
+{
+    bar->hit.count = 0;
+    hit_index_add(bar, bar->left.exps, bar->left.slots, bar->left.count);
+    hit_index_add(bar, bar->center.exps, bar->center.slots, bar->center.count);
+    hit_index_add(bar, bar->right.exps, bar->right.slots, bar->right.count);
+
+    /* Groups may overlap, on a too narrow bar */
+    qsort(bar->hit.ranges, bar->hit.count, sizeof(bar->hit.ranges[0]),
+          &hit_range_cmp);
+
+    /* Exposables may have been re-created */
+    bar->hit.hovered = NULL;
+    bar->hit.hovered_valid = false;
+}
+
+/* Returns the range covering 'x', or NULL */
+static const struct hit_range *
+hit_index_lookup(const struct private *bar, int x)
+{
+    /* Find the last range starting at, or before, x */
+    size_t lo = 0;
+    size_t hi = bar->hit.count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (bar->hit.ranges[mid].x0 <= x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return NULL;
+
+    const struct hit_range *r = &bar->hit.ranges[lo - 1];
+    return x < r->x1 ? r : NULL;
+}
+
+static void
+expose_group(struct private *bar, struct exposable **exps,
+             const struct module_slot *slots, size_t count)
+{
+    const int y = bar->border.top_width;
+
+    for (size_t i = 0; i < count; i++) {
+        const struct exposable *e = exps[i];
+        const struct module_slot *slot = &slots[i];
+
+        if (e->width == 0)
+            continue;
+
+        pixman_box32_t box = {
+            slot->x, y, slot->x + e->width, y + bar->height};
+
+        if (pixman_region32_contains_rectangle(&bar->damage, &box) ==
+            PIXMAN_REGION_OUT)
+        {
+            continue;
+        }
+
+        e->expose(e, bar->pix, slot->x, y, bar->height);
+    }
+}
+
+int
+bar_frame_delay(const struct private *bar)
+{
+    if (bar->max_fps <= 0)
+        return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    const int64_t interval = 1000000000ll / bar->max_fps;
+    const int64_t elapsed =
+        (int64_t)(now.tv_sec - bar->last_frame.tv_sec) * 1000000000ll +
+        (now.tv_nsec - bar->last_frame.tv_nsec);
+
+    if (elapsed >= interval)
+        return 0;
+
+    /* Round up, to not wake up before the interval has passed */
+    return (interval - elapsed + 999999) / 1000000;
+}
+
 static void
 expose(const struct bar *_bar)
 {
-    const struct private *bar = _bar->private;
+    struct private *bar = _bar->private;
     pixman_image_t *pix = bar->pix;
 
+    clock_gettime(CLOCK_MONOTONIC, &bar->last_frame);
+
+    const bool all = atomic_exchange(&bar->refresh_all, false);
+
+    update_exposables(
+        bar, bar->left.mods, bar->left.exps, bar->left.slots,
+        bar->left.count, all);
+    update_exposables(
+        bar, bar->center.mods, bar->center.exps, bar->center.slots,
+        bar->center.count, all);
+    update_exposables(
+        bar, bar->right.mods, bar->right.exps, bar->right.slots,
+        bar->right.count, all);
+
+    LOG_DBG("content() calls: %"PRIu64", skipped: %"PRIu64,
+            bar->stats.content_calls, bar->stats.content_skipped);
+
+    int left_width, center_width, right_width;
+    bar_calculate_widths(bar, &left_width, &center_width, &right_width);
+
+    pixman_region32_clear(&bar->damage);
+
+    if (all ||
+        bar->width != bar->last_width ||
+        bar->height_with_border != bar->last_height)
+    {
+        pixman_region32_union_rect(
+            &bar->damage, &bar->damage,
+            0, 0, bar->width, bar->height_with_border);
+        bar->last_width = bar->width;
+        bar->last_height = bar->height_with_border;
+    }
+
+    damage_group(
+        bar, bar->left.exps, bar->left.slots, bar->left.count,
+        bar->border.left_width + bar->left_margin - bar->left_spacing);
+    damage_group(
+        bar, bar->center.exps, bar->center.slots, bar->center.count,
+        bar->width / 2 - center_width / 2 - bar->left_spacing);
+    damage_group(
+        bar, bar->right.exps, bar->right.slots, bar->right.count,
+        bar->width - (
+            right_width +
+            bar->left_spacing +
+            bar->right_margin +
+            bar->border.right_width));
+
+    hit_index_update(bar);
+
+    if (!pixman_region32_not_empty(&bar->damage)) {
+        LOG_DBG("nothing to redraw");
+        return;
+    }
+
+    /* Background and border are only re-drawn where we're damaged */
+    pixman_image_set_clip_region32(pix, &bar->damage);
+
     pixman_image_fill_rectangles(
         PIXMAN_OP_SRC, pix, &bar->background, 1,
         &(pixman_rectangle16_t){0, 0, bar->width, bar->height_with_border});
@@ -102,38 +343,6 @@ expose(const struct bar *_bar)
              bar->border.bottom_width},
         });
 
-    for (size_t i = 0; i < bar->left.count; i++) {
-        struct module *m = bar->left.mods[i];
-        struct exposable *e = bar->left.exps[i];
-        if (e != NULL)
-            e->destroy(e);
-        bar->left.exps[i] = module_begin_expose(m);
-        assert(bar->left.exps[i]->width >= 0);
-    }
-
-    for (size_t i = 0; i < bar->center.count; i++) {
-        struct module *m = bar->center.mods[i];
-        struct exposable *e = bar->center.exps[i];
-        if (e != NULL)
-            e->destroy(e);
-        bar->center.exps[i] = module_begin_expose(m);
-        assert(bar->center.exps[i]->width >= 0);
-    }
-
-    for (size_t i = 0; i < bar->right.count; i++) {
-        struct module *m = bar->right.mods[i];
-        struct exposable *e = bar->right.exps[i];
-        if (e != NULL)
-            e->destroy(e);
-        bar->right.exps[i] = module_begin_expose(m);
-        assert(bar->right.exps[i]->width >= 0);
-    }
-
-    int left_width, center_width, right_width;
-    calculate_widths(bar, &left_width, &center_width, &right_width);
-
-    int y = bar->border.top_width;
-    int x = bar->border.left_width + bar->left_margin - bar->left_spacing;
     pixman_region32_t clip;
     pixman_region32_init_rect(
         &clip,
@@ -143,43 +352,30 @@ expose(const struct bar *_bar)
          bar->left_margin - bar->right_margin -
          bar->border.left_width - bar->border.right_width),
         bar->height);
+    pixman_region32_intersect(&clip, &clip, &bar->damage);
     pixman_image_set_clip_region32(pix, &clip);
     pixman_region32_fini(&clip);
 
-    for (size_t i = 0; i < bar->left.count; i++) {
-        const struct exposable *e = bar->left.exps[i];
-        e->expose(e, pix, x + bar->left_spacing, y, bar->height);
-        if (e->width > 0)
-            x += bar->left_spacing + e->width + bar->right_spacing;
-    }
-
-    x = bar->width / 2 - center_width / 2 - bar->left_spacing;
-    for (size_t i = 0; i < bar->center.count; i++) {
-        const struct exposable *e = bar->center.exps[i];
-        e->expose(e, pix, x + bar->left_spacing, y, bar->height);
-        if (e->width > 0)
-            x += bar->left_spacing + e->width + bar->right_spacing;
-    }
-
-    x = bar->width - (
-        right_width +
-        bar->left_spacing +
-        bar->right_margin +
-        bar->border.right_width);
-
-    for (size_t i = 0; i < bar->right.count; i++) {
-        const struct exposable *e = bar->right.exps[i];
-        e->expose(e, pix, x + bar->left_spacing, y, bar->height);
-        if (e->width > 0)
-            x += bar->left_spacing + e->width + bar->right_spacing;
-    }
+    expose_group(bar, bar->left.exps, bar->left.slots, bar->left.count);
+    expose_group(bar, bar->center.exps, bar->center.slots, bar->center.count);
+    expose_group(bar, bar->right.exps, bar->right.slots, bar->right.count);
 
+    pixman_image_set_clip_region32(pix, NULL);
     bar->backend.iface->commit(_bar);
+    bar->stats.frames++;
 }
 
 
 static void
 refresh(const struct bar *bar)
+{
+    struct private *b = bar->private;
+    atomic_store(&b->refresh_all, true);
+    b->backend.iface->refresh(bar);
+}
+
+static void
+redraw(const struct bar *bar)
 {
     const struct private *b = bar->private;
     b->backend.iface->refresh(bar);
@@ -204,74 +400,40 @@ on_mouse(struct bar *_bar, enum mouse_event event, enum mouse_button btn,
          int x, int y)
 {
     struct private *bar = _bar->private;
+    const struct hit_range *hit = NULL;
 
-    if ((y < bar->border.top_width ||
-         y >= (bar->height_with_border - bar->border.bottom_width)) ||
-        (x < bar->border.left_width || x >= (bar->width - bar->border.right_width)))
+    if (!((y < bar->border.top_width ||
+           y >= (bar->height_with_border - bar->border.bottom_width)) ||
+          (x < bar->border.left_width || x >= (bar->width - bar->border.right_width))))
     {
-        set_cursor(_bar, "left_ptr");
-        return;
-    }
-
-    int left_width, center_width, right_width;
-    calculate_widths(bar, &left_width, &center_width, &right_width);
-
-    int mx = bar->border.left_width + bar->left_margin - bar->left_spacing;
-    for (size_t i = 0; i < bar->left.count; i++) {
-        struct exposable *e = bar->left.exps[i];
-
-        if (e->width == 0)
-            continue;
-
-        mx += bar->left_spacing;
-        if (x >= mx && x < mx + e->width) {
-            if (e->on_mouse != NULL)
-                e->on_mouse(e, _bar, event, btn, x - mx, y);
-            return;
-        }
-
-        mx += e->width + bar->right_spacing;
+        hit = hit_index_lookup(bar, x);
     }
 
-    mx = bar->width / 2 - center_width / 2 - bar->left_spacing;
-    for (size_t i = 0; i < bar->center.count; i++) {
-        struct exposable *e = bar->center.exps[i];
-
-        if (e->width == 0)
-            continue;
-
-        mx += bar->left_spacing;
-        if (x >= mx && x < mx + e->width) {
-            if (e->on_mouse != NULL)
-                e->on_mouse(e, _bar, event, btn, x - mx, y);
-            return;
-        }
-
-        mx += e->width + bar->right_spacing;
-    }
+    struct exposable *e = hit != NULL ? hit->exposable : NULL;
 
-    mx = bar->width - (right_width +
-                       bar->left_spacing +
-                       bar->right_margin +
-                       bar->border.right_width);
+    /*
+     * Motion within the same exposable doesn't change anything, unless
+     * the exposable dispatches to sub-particles (e.g. a list).
+     */
+    const bool same_as_before =
+        event == ON_MOUSE_MOTION &&
+        bar->hit.hovered_valid &&
+        bar->hit.hovered == e &&
+        (e == NULL || e->on_mouse == &exposable_default_on_mouse);
 
-    for (size_t i = 0; i < bar->right.count; i++) {
-        struct exposable *e = bar->right.exps[i];
+    bar->hit.hovered = e;
+    bar->hit.hovered_valid = true;
 
-        if (e->width == 0)
-            continue;
-
-        mx += bar->left_spacing;
-        if (x >= mx && x < mx + e->width) {
-            if (e->on_mouse != NULL)
-                e->on_mouse(e, _bar, event, btn, x - mx, y);
-            return;
-        }
+    if (same_as_before)
+        return;
 
-        mx += e->width + bar->right_spacing;
+    if (e == NULL) {
+        set_cursor(_bar, "left_ptr");
+        return;
     }
 
-    set_cursor(_bar, "left_ptr");
+    if (e->on_mouse != NULL)
+        e->on_mouse(e, _bar, event, btn, x - hit->x0, y);
 }
 
 static void
@@ -289,6 +451,51 @@ set_module_thread_name(thrd_t id, struct module *mod)
         LOG_ERRNO("failed to set thread title");
 }
 
+static void
+start_module(struct module *mod, struct module_loop *loop, thrd_t *thrd)
+{
+    if (mod->setup != NULL) {
+        module_loop_add_module(loop, mod);
+        return;
+    }
+
+    thrd_create(thrd, (int (*)(void *))mod->run, mod);
+    set_module_thread_name(*thrd, mod);
+}
+
+static void
+arena_stats_add(struct frame_arena_stats *total, struct module **mods,
+                size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        struct frame_arena_stats stats;
+        frame_arena_stats(mods[i]->arena, &stats);
+
+        total->resets += stats.resets;
+        total->allocs += stats.allocs;
+        total->chunks += stats.chunks;
+        total->size += stats.size;
+    }
+}
+
+static void
+log_arena_stats(const struct private *bar)
+{
+    struct frame_arena_stats total = {0};
+    arena_stats_add(&total, bar->left.mods, bar->left.count);
+    arena_stats_add(&total, bar->center.mods, bar->center.count);
+    arena_stats_add(&total, bar->right.mods, bar->right.count);
+
+    if (bar->stats.content_calls == 0)
+        return;
+
+    /* Without the arenas, each allocation would have been a malloc() */
+    LOG_INFO("allocations per content() call: %.1f served from frame arenas "
+             "(%zu bytes), %.2f arena chunks allocated from the heap",
+             (double)total.allocs / bar->stats.content_calls, total.size,
+             (double)total.chunks / bar->stats.content_calls);
+}
+
 static int
 run(struct bar *_bar)
 {
@@ -307,7 +514,20 @@ run(struct bar *_bar)
     set_cursor(_bar, "left_ptr");
     expose(_bar);
 
-    /* Start modules */
+    /*
+     * Start modules. Those implementing setup() share a single event
+     * loop thread; the others get a thread each.
+     */
+    struct module_loop *loop = module_loop_new(_bar->abort_fd);
+    if (loop == NULL) {
+        bar->backend.iface->cleanup(_bar);
+        if (write(_bar->abort_fd, &(uint64_t){1}, sizeof(uint64_t)) != sizeof(uint64_t))
+            LOG_ERRNO("failed to signal abort");
+        return 1;
+    }
+
+    thrd_t thrd_loop;
+
     thrd_t thrd_left[max(bar->left.count, 1)];
     thrd_t thrd_center[max(bar->center.count, 1)];
     thrd_t thrd_right[max(bar->right.count, 1)];
@@ -316,24 +536,28 @@ run(struct bar *_bar)
         struct module *mod = bar->left.mods[i];
 
         mod->abort_fd = _bar->abort_fd;
-        thrd_create(&thrd_left[i], (int (*)(void *))bar->left.mods[i]->run, mod);
-        set_module_thread_name(thrd_left[i], mod);
+        start_module(mod, loop, &thrd_left[i]);
     }
     for (size_t i = 0; i < bar->center.count; i++) {
         struct module *mod = bar->center.mods[i];
 
         mod->abort_fd = _bar->abort_fd;
-        thrd_create(&thrd_center[i], (int (*)(void *))bar->center.mods[i]->run, mod);
-        set_module_thread_name(thrd_center[i], mod);
+        start_module(mod, loop, &thrd_center[i]);
     }
     for (size_t i = 0; i < bar->right.count; i++) {
         struct module *mod = bar->right.mods[i];
 
         mod->abort_fd = _bar->abort_fd;
-        thrd_create(&thrd_right[i], (int (*)(void *))bar->right.mods[i]->run, mod);
-        set_module_thread_name(thrd_right[i], mod);
+        start_module(mod, loop, &thrd_right[i]);
     }
 
+    const bool loop_started =
+        module_loop_module_count(loop) > 0 &&
+        thrd_create(&thrd_loop, (int (*)(void *))&module_loop_run, loop) == thrd_success;
+
+    if (loop_started)
+        pthread_setname_np(thrd_loop, "mod:event-loop");
+
     LOG_DBG("all modules started");
 
     bar->backend.iface->loop(_bar, &expose, &on_mouse);
@@ -344,6 +568,9 @@ run(struct bar *_bar)
     int ret = 0;
     int mod_ret;
     for (size_t i = 0; i < bar->left.count; i++) {
+        if (bar->left.mods[i]->loop != NULL)
+            continue;
+
         thrd_join(thrd_left[i], &mod_ret);
         if (mod_ret != 0) {
             const struct module *m = bar->left.mods[i];
@@ -353,6 +580,9 @@ run(struct bar *_bar)
         ret = ret == 0 && mod_ret != 0 ? mod_ret : ret;
     }
     for (size_t i = 0; i < bar->center.count; i++) {
+        if (bar->center.mods[i]->loop != NULL)
+            continue;
+
         thrd_join(thrd_center[i], &mod_ret);
         if (mod_ret != 0) {
             const struct module *m = bar->center.mods[i];
@@ -362,6 +592,9 @@ run(struct bar *_bar)
         ret = ret == 0 && mod_ret != 0 ? mod_ret : ret;
     }
     for (size_t i = 0; i < bar->right.count; i++) {
+        if (bar->right.mods[i]->loop != NULL)
+            continue;
+
         thrd_join(thrd_right[i], &mod_ret);
         if (mod_ret != 0) {
             const struct module *m = bar->right.mods[i];
@@ -371,8 +604,24 @@ run(struct bar *_bar)
         ret = ret == 0 && mod_ret != 0 ? mod_ret : ret;
     }
 
+    if (loop_started) {
+        thrd_join(thrd_loop, &mod_ret);
+        if (mod_ret != 0)
+            LOG_ERR("module event loop: one or more modules failed");
+        ret = ret == 0 && mod_ret != 0 ? mod_ret : ret;
+    }
+
+    module_loop_destroy(loop);
+    proc_sampler_destroy();
+
     LOG_DBG("modules joined");
 
+    LOG_INFO("module content() calls: %"PRIu64", skipped (clean): %"PRIu64,
+             bar->stats.content_calls, bar->stats.content_skipped);
+    log_arena_stats(bar);
+    LOG_INFO("refresh requests: %"PRIu64", frames rendered: %"PRIu64,
+             bar->stats.refreshes, bar->stats.frames);
+
     bar->backend.iface->cleanup(_bar);
 
     LOG_DBG("bar exiting");
@@ -388,21 +637,21 @@ destroy(struct bar *bar)
         struct module *m = b->left.mods[i];
         struct exposable *e = b->left.exps[i];
         if (e != NULL)
-            e->destroy(e);
+            module_end_expose(m, e);
         m->destroy(m);
     }
     for (size_t i = 0; i < b->center.count; i++) {
         struct module *m = b->center.mods[i];
         struct exposable *e = b->center.exps[i];
         if (e != NULL)
-            e->destroy(e);
+            module_end_expose(m, e);
         m->destroy(m);
     }
     for (size_t i = 0; i < b->right.count; i++) {
         struct module *m = b->right.mods[i];
         struct exposable *e = b->right.exps[i];
         if (e != NULL)
-            e->destroy(e);
+            module_end_expose(m, e);
         m->destroy(m);
     }
 
@@ -412,6 +661,11 @@ destroy(struct bar *bar)
     free(b->center.exps);
     free(b->right.mods);
     free(b->right.exps);
+    free(b->left.slots);
+    free(b->center.slots);
+    free(b->right.slots);
+    free(b->hit.ranges);
+    pixman_region32_fini(&b->damage);
     free(b->monitor);
     free(b->backend.data);
 
@@ -463,6 +717,11 @@ bar_new(const struct bar_config *config)
         return NULL;
 #endif
         break;
+
+    case BAR_BACKEND_HEADLESS:
+        backend_data = bar_backend_headless_new();
+        backend_iface = &headless_backend_iface;
+        break;
     }
 
     if (backend_data == NULL)
@@ -479,6 +738,7 @@ bar_new(const struct bar_config *config)
     priv->left_margin = config->left_margin;
     priv->right_margin = config->right_margin;
     priv->trackpad_sensitivity = config->trackpad_sensitivity;
+    priv->max_fps = config->max_fps;
     priv->border.left_width = config->border.left_width;
     priv->border.right_width = config->border.right_width;
     priv->border.top_width = config->border.top_width;
@@ -494,11 +754,20 @@ bar_new(const struct bar_config *config)
     priv->center.exps = calloc(config->center.count, sizeof(priv->center.exps[0]));
     priv->right.mods = malloc(config->right.count * sizeof(priv->right.mods[0]));
     priv->right.exps = calloc(config->right.count, sizeof(priv->right.exps[0]));
+    priv->left.slots = calloc(config->left.count, sizeof(priv->left.slots[0]));
+    priv->center.slots = calloc(config->center.count, sizeof(priv->center.slots[0]));
+    priv->right.slots = calloc(config->right.count, sizeof(priv->right.slots[0]));
+    priv->hit.ranges = calloc(
+        config->left.count + config->center.count + config->right.count,
+        sizeof(priv->hit.ranges[0]));
     priv->left.count = config->left.count;
     priv->center.count = config->center.count;
     priv->right.count = config->right.count;
     priv->backend.data = backend_data;
     priv->backend.iface = backend_iface;
+    priv->last_width = -1;
+    priv->last_height = -1;
+    pixman_region32_init(&priv->damage);
 
     for (size_t i = 0; i < priv->left.count; i++)
         priv->left.mods[i] = config->left.mods[i];
@@ -512,6 +781,7 @@ bar_new(const struct bar_config *config)
     bar->run = &run;
     bar->destroy = &destroy;
     bar->refresh = &refresh;
+    bar->redraw = &redraw;
     bar->set_cursor = &set_cursor;
     bar->output_name = &output_name;
 
@@ -11,7 +11,11 @@ struct bar {
     int (*run)(struct bar *bar);
     void (*destroy)(struct bar *bar);
 
+    /* Re-exposes *all* modules. Modules should use module_signal_refresh() */
     void (*refresh)(const struct bar *bar);
+
+    /* Schedules a redraw; only modules marked as dirty are re-exposed */
+    void (*redraw)(const struct bar *bar);
     void (*set_cursor)(struct bar *bar, const char *cursor);
 
     const char *(*output_name)(const struct bar *bar);
@@ -19,7 +23,12 @@ struct bar {
 
 enum bar_location { BAR_TOP, BAR_BOTTOM };
 enum bar_layer { BAR_LAYER_TOP, BAR_LAYER_BOTTOM };
-enum bar_backend { BAR_BACKEND_AUTO, BAR_BACKEND_XCB, BAR_BACKEND_WAYLAND };
+enum bar_backend {
+    BAR_BACKEND_AUTO,
+    BAR_BACKEND_XCB,
+    BAR_BACKEND_WAYLAND,
+    BAR_BACKEND_HEADLESS,
+};
 
 struct bar_config {
     enum bar_backend backend;
@@ -32,6 +41,7 @@ struct bar_config {
     int left_spacing, right_spacing;
     int left_margin, right_margin;
     int trackpad_sensitivity;
+    int max_fps;
 
     pixman_color_t background;
 
@@ -0,0 +1,318 @@
+#include "headless.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/eventfd.h>
+
+#include <pixman.h>
+
+#include "private.h"
+
+#define LOG_MODULE "bar:headless"
+#define LOG_ENABLE_DBG 0
+#include "../log.h"
+#include "../module.h"
+#include "../stride.h"
+
+/*
+ * Renders into an in-memory image, without any display server. Meant
+ * for benchmarking, and for testing the rendering output.
+ *
+ * Configured through environment variables:
+ *
+ *   YAMBAR_HEADLESS_WIDTH:  width of the bar, in pixels (default: 1920)
+ *   YAMBAR_HEADLESS_DUMP:   directory to write each frame to, as PPM
+ *   YAMBAR_HEADLESS_FRAMES: exit after this many frames (default: never)
+ *   YAMBAR_HEADLESS_TIME:   pin the time presented by modules (the clock
+ *                           module, realtime tags) to this many seconds
+ *                           since the epoch (default: the real time)
+ *
+ * Frames are identified by a sequence number, not by wall-clock time.
+ * With a pinned time, the same configuration always produces the same
+ * sequence of dumped frames.
+ */
+struct headless_backend {
+    int refresh_fd;
+
+    void *pixels;
+    pixman_image_t *pix;
+
+    char *dump_dir;
+    unsigned max_frames;  /* 0 means unlimited */
+    unsigned frame;       /* Number of frames committed */
+
+    /* Time spent in expose(), in nanoseconds */
+    struct {
+        uint64_t count;
+        uint64_t total;
+        uint64_t max;
+    } render_time;
+};
+
+void *
+bar_backend_headless_new(void)
+{
+    struct headless_backend *backend = calloc(1, sizeof(*backend));
+    backend->refresh_fd = -1;
+    return backend;
+}
+
+static long
+env_as_long(const char *name, long default_value)
+{
+    const char *value = getenv(name);
+    if (value == NULL)
+        return default_value;
+
+    char *end;
+    errno = 0;
+    long ret = strtol(value, &end, 10);
+
+    if (errno != 0 || *end != '\0' || ret < 0) {
+        LOG_WARN("%s: invalid value '%s', using %ld", name, value, default_value);
+        return default_value;
+    }
+
+    return ret;
+}
+
+static bool
+setup(struct bar *_bar)
+{
+    struct private *bar = _bar->private;
+    struct headless_backend *backend = bar->backend.data;
+
+    bar->width = env_as_long("YAMBAR_HEADLESS_WIDTH", 1920);
+    backend->max_frames = env_as_long("YAMBAR_HEADLESS_FRAMES", 0);
+
+    const long fixed_time = env_as_long("YAMBAR_HEADLESS_TIME", -1);
+    if (fixed_time >= 0) {
+        LOG_INFO("time pinned to %lds since the epoch", fixed_time);
+        module_set_fixed_time(fixed_time);
+    }
+
+    const char *dump_dir = getenv("YAMBAR_HEADLESS_DUMP");
+    if (dump_dir != NULL)
+        backend->dump_dir = strdup(dump_dir);
+
+    if (bar->width <= 0) {
+        LOG_ERR("invalid width: %d", bar->width);
+        return false;
+    }
+
+    const uint32_t stride = stride_for_format_and_width(
+        PIXMAN_a8r8g8b8, bar->width);
+
+    backend->pixels = calloc(bar->height_with_border, stride);
+    backend->pix = pixman_image_create_bits_no_clear(
+        PIXMAN_a8r8g8b8, bar->width, bar->height_with_border,
+        backend->pixels, stride);
+
+    if (backend->pix == NULL) {
+        LOG_ERR("failed to create pixman image");
+        return false;
+    }
+
+    bar->pix = backend->pix;
+
+    backend->refresh_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (backend->refresh_fd < 0) {
+        LOG_ERRNO("failed to create refresh eventfd");
+        return false;
+    }
+
+    LOG_INFO("rendering offscreen: %dx%d", bar->width, bar->height_with_border);
+    return true;
+}
+
+static void
+cleanup(struct bar *_bar)
+{
+    struct private *bar = _bar->private;
+    struct headless_backend *backend = bar->backend.data;
+
+    if (backend->render_time.count > 0) {
+        LOG_INFO("frame render time: avg=%"PRIu64"µs, max=%"PRIu64"µs "
+                 "(%"PRIu64" frames)",
+                 backend->render_time.total / backend->render_time.count / 1000,
+                 backend->render_time.max / 1000,
+                 backend->render_time.count);
+    }
+
+    if (backend->refresh_fd >= 0)
+        close(backend->refresh_fd);
+    if (backend->pix != NULL)
+        pixman_image_unref(backend->pix);
+    free(backend->pixels);
+    free(backend->dump_dir);
+
+    backend->refresh_fd = -1;
+    backend->pix = NULL;
+    backend->pixels = NULL;
+    backend->dump_dir = NULL;
+
+    bar->pix = NULL;
+}
+
+static void
+loop(struct bar *_bar,
+     void (*expose)(const struct bar *bar),
+     void (*on_mouse)(struct bar *bar, enum mouse_event event,
+                      enum mouse_button btn, int x, int y))
+{
+    struct private *bar = _bar->private;
+    struct headless_backend *backend = bar->backend.data;
+
+    pthread_setname_np(pthread_self(), "bar(headless)");
+
+    /* A refresh has been requested, but is held back by 'max-fps' */
+    bool expose_pending = false;
+
+    while (backend->max_frames == 0 || backend->frame < backend->max_frames) {
+        struct pollfd fds[] = {
+            {.fd = _bar->abort_fd, .events = POLLIN},
+            {.fd = backend->refresh_fd, .events = POLLIN},
+        };
+
+        poll(fds, sizeof(fds) / sizeof(fds[0]),
+             expose_pending ? bar_frame_delay(bar) : -1);
+
+        if (fds[0].revents & POLLIN)
+            return;
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(backend->refresh_fd, &count, sizeof(count))
+                != sizeof(count))
+            {
+                LOG_ERRNO("failed to read from refresh eventfd");
+                break;
+            }
+
+            bar->stats.refreshes += count;
+            expose_pending = true;
+        }
+
+        if (expose_pending && bar_frame_delay(bar) == 0) {
+            expose_pending = false;
+
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            expose(_bar);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            const uint64_t elapsed =
+                (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ull +
+                end.tv_nsec - start.tv_nsec;
+
+            backend->render_time.count++;
+            backend->render_time.total += elapsed;
+            if (elapsed > backend->render_time.max)
+                backend->render_time.max = elapsed;
+        }
+    }
+
+    LOG_DBG("done after %u frames", backend->frame);
+
+    if (write(_bar->abort_fd, &(uint64_t){1}, sizeof(uint64_t))
+        != sizeof(uint64_t))
+    {
+        LOG_ERRNO("failed to signal abort to modules");
+    }
+}
+
+/* Writes the current frame as a binary PPM; alpha is dropped */
+static void
+dump_frame(const struct headless_backend *backend)
+{
+    char path[strlen(backend->dump_dir) + 32];
+    snprintf(path, sizeof(path), "%s/frame-%06u.ppm",
+             backend->dump_dir, backend->frame);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        LOG_ERRNO("%s: failed to open", path);
+        return;
+    }
+
+    const int width = pixman_image_get_width(backend->pix);
+    const int height = pixman_image_get_height(backend->pix);
+    const int stride = pixman_image_get_stride(backend->pix);
+    const uint8_t *data = (const uint8_t *)pixman_image_get_data(backend->pix);
+
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+
+    uint8_t *row = malloc(width * 3);
+    for (int y = 0; y < height; y++) {
+        const uint32_t *src = (const uint32_t *)(data + y * stride);
+
+        for (int x = 0; x < width; x++) {
+            row[x * 3 + 0] = (src[x] >> 16) & 0xff;
+            row[x * 3 + 1] = (src[x] >> 8) & 0xff;
+            row[x * 3 + 2] = src[x] & 0xff;
+        }
+
+        fwrite(row, 3, width, f);
+    }
+
+    free(row);
+
+    if (ferror(f))
+        LOG_ERR("%s: failed to write frame", path);
+    fclose(f);
+}
+
+static void
+commit(const struct bar *_bar)
+{
+    const struct private *bar = _bar->private;
+    struct headless_backend *backend = bar->backend.data;
+
+    if (backend->dump_dir != NULL)
+        dump_frame(backend);
+
+    backend->frame++;
+}
+
+static void
+refresh(const struct bar *_bar)
+{
+    const struct private *bar = _bar->private;
+    const struct headless_backend *backend = bar->backend.data;
+
+    if (write(backend->refresh_fd, &(uint64_t){1}, sizeof(uint64_t))
+        != sizeof(uint64_t))
+    {
+        LOG_ERRNO("failed to signal 'refresh' to main thread");
+    }
+}
+
+static void
+set_cursor(struct bar *_bar, const char *cursor)
+{
+}
+
+static const char *
+output_name(const struct bar *_bar)
+{
+    return "HEADLESS";
+}
+
+const struct backend headless_backend_iface = {
+    .setup = &setup,
+    .cleanup = &cleanup,
+    .loop = &loop,
+    .commit = &commit,
+    .refresh = &refresh,
+    .set_cursor = &set_cursor,
+    .output_name = &output_name,
+};
@@ -1,8 +1,25 @@
 #pragma once
 
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
 #include "../bar/bar.h"
 #include "backend.h"
 
+/* Where a module's exposable was drawn in the previous frame */
+struct module_slot {
+    int x;
+    int width;
+    bool rebuilt;  /* Exposable was re-created in this frame */
+};
+
+/* Hit-test index entry, see on_mouse() */
+struct hit_range {
+    int x0, x1;  /* [x0, x1) */
+    struct exposable *exposable;
+};
+
 struct private {
     /* From bar_config */
     char *monitor;
@@ -12,6 +29,7 @@ struct private {
     int left_spacing, right_spacing;
     int left_margin, right_margin;
     int trackpad_sensitivity;
+    int max_fps;  /* 0 means unlimited */
 
     pixman_color_t background;
 
@@ -26,16 +44,19 @@ struct private {
     struct {
         struct module **mods;
         struct exposable **exps;
+        struct module_slot *slots;
         size_t count;
     } left;
     struct {
         struct module **mods;
         struct exposable **exps;
+        struct module_slot *slots;
         size_t count;
     } center;
     struct {
         struct module **mods;
         struct exposable **exps;
+        struct module_slot *slots;
         size_t count;
     } right;
 
@@ -45,8 +66,54 @@ struct private {
 
     pixman_image_t *pix;
 
+    /*
+     * Parts of 'pix' that were re-drawn in the last expose(). Backends
+     * only need to push these areas to the server/compositor.
+     */
+    pixman_region32_t damage;
+    int last_width, last_height;
+
+    /*
+     * Sorted, non-empty, exposable ranges. Re-built in each
+     * expose(), and binary searched in on_mouse().
+     */
+    struct {
+        struct hit_range *ranges;
+        size_t count;
+
+        /* Exposable under the pointer at the last motion event */
+        const struct exposable *hovered;
+        bool hovered_valid;
+    } hit;
+
+    /* Set by refresh(); re-expose all modules, not only dirty ones */
+    atomic_bool refresh_all;
+
+    /* When expose() last ran (CLOCK_MONOTONIC) */
+    struct timespec last_frame;
+
+    struct {
+        uint64_t content_calls;    /* module content() invocations */
+        uint64_t content_skipped;  /* clean modules, exposable re-used */
+        uint64_t refreshes;        /* refresh requests seen by the backend */
+        uint64_t frames;           /* frames rendered */
+    } stats;
+
     struct {
         void *data;
         const struct backend *iface;
     } backend;
 };
+
+/*
+ * Milliseconds until the next frame may be rendered, with respect to
+ * 'max-fps'. Returns 0 if a frame can be rendered right away.
+ */
+int bar_frame_delay(const struct private *bar);
+
+/*
+ * Calculate total width of left/center/right groups.
+ * Note: begin_expose() must have been called
+ */
+void bar_calculate_widths(
+    const struct private *bar, int *left, int *center, int *right);
@@ -38,6 +38,9 @@ struct buffer {
     struct wl_buffer *wl_buf;
 
     pixman_image_t *pix;
+
+    /* Areas re-drawn in other buffers since this one was last rendered to */
+    pixman_region32_t stale;
 };
 
 struct monitor {
@@ -112,14 +115,22 @@ struct wayland_backend {
     /* We're already waiting for a frame done callback */
     bool render_scheduled;
 
+    /* A refresh has been requested, but not yet rendered */
+    bool expose_pending;
+
     tll(struct buffer) buffers;     /* List of SHM buffers */
     struct buffer *next_buffer;     /* Bar is rendering to this one */
     struct buffer *pending_buffer;  /* Finished, but not yet rendered */
+    struct buffer *last_buffer;     /* Most recently finished buffer */
     struct wl_callback *frame_callback;
 
+    /* Damage accumulated since the last buffer attach */
+    pixman_region32_t surface_damage;
+
     double aggregated_scroll;
     bool have_discrete;
 
+    void (*bar_expose)(const struct bar *bar);
     void (*bar_on_mouse)(struct bar *bar, enum mouse_event event,
                          enum mouse_button btn, int x, int y);
 };
@@ -147,6 +158,7 @@ bar_backend_wayland_new(void)
 {
     struct wayland_backend *backend = calloc(1, sizeof(struct wayland_backend));
     backend->pipe_fds[0] = backend->pipe_fds[1] = -1;
+    pixman_region32_init(&backend->surface_damage);
     return backend;
 }
 
@@ -477,7 +489,6 @@ output_done(void *data, struct wl_output *wl_output)
 }
 
 static bool update_size(struct wayland_backend *backend);
-static void refresh(const struct bar *_bar);
 
 static void
 output_scale(void *data, struct wl_output *wl_output, int32_t factor)
@@ -493,7 +504,7 @@ output_scale(void *data, struct wl_output *wl_output, int32_t factor)
         update_size(mon->backend);
 
         if (mon->backend->scale != old_scale)
-            refresh(mon->backend->bar);
+            mon->backend->bar->refresh(mon->backend->bar);
     }
 }
 
@@ -593,7 +604,7 @@ xdg_output_handle_done(void *data, struct zxdg_output_v1 *xdg_output)
 
         if (create_surface(backend) && update_size(backend)) {
             if (backend->pipe_fds[1] >= 0)
-                refresh(backend->bar);
+                backend->bar->refresh(backend->bar);
         }
     }
 }
@@ -976,6 +987,8 @@ get_buffer(struct wayland_backend *backend)
         );
 
     struct buffer *ret = &tll_back(backend->buffers);
+    pixman_region32_init_rect(
+        &ret->stale, 0, 0, backend->width, backend->height);
     wl_buffer_add_listener(ret->wl_buf, &buffer_listener, ret);
     return ret;
 
@@ -1071,6 +1084,11 @@ update_size(struct wayland_backend *backend)
 
     bar->width = backend->width;
 
+    /* New surface, or new size; the next attach must damage everything */
+    pixman_region32_fini(&backend->surface_damage);
+    pixman_region32_init_rect(
+        &backend->surface_damage, 0, 0, backend->width, backend->height);
+
     /* Reload buffers */
     if (backend->next_buffer != NULL)
         backend->next_buffer->busy = false;
@@ -1183,6 +1201,7 @@ cleanup(struct bar *_bar)
             wl_buffer_destroy(it->item.wl_buf);
         if (it->item.pix != NULL)
             pixman_image_unref(it->item.pix);
+        pixman_region32_fini(&it->item.stale);
 
         munmap(it->item.mmapped, it->item.size);
         tll_remove(backend->buffers, it);
@@ -1203,7 +1222,31 @@ cleanup(struct bar *_bar)
 
     /* Destroyed when freeing buffer list */
     bar->pix = NULL;
+    backend->last_buffer = NULL;
+
+    pixman_region32_fini(&backend->surface_damage);
+
+}
+
+/*
+ * Renders a new frame, if one has been requested. Held back while the
+ * compositor has not yet asked for a new frame (i.e. while we're
+ * waiting for a frame callback), and by 'max-fps'.
+ */
+static void
+maybe_expose(struct wayland_backend *backend)
+{
+    const struct private *bar = backend->bar->private;
 
+    if (!backend->expose_pending ||
+        backend->render_scheduled ||
+        bar_frame_delay(bar) > 0)
+    {
+        return;
+    }
+
+    backend->expose_pending = false;
+    backend->bar_expose(backend->bar);
 }
 
 static void
@@ -1218,6 +1261,7 @@ loop(struct bar *_bar,
 
     pthread_setname_np(pthread_self(), "bar(wayland)");
 
+    backend->bar_expose = expose;
     backend->bar_on_mouse = on_mouse;
 
     while (wl_display_prepare_read(backend->display) != 0) {
@@ -1236,7 +1280,13 @@ loop(struct bar *_bar,
             {.fd = backend->pipe_fds[0], .events = POLLIN},
         };
 
-        poll(fds, sizeof(fds) / sizeof(fds[0]), -1);
+        /* Wake up when 'max-fps' allows us to render a pending frame */
+        const int timeout =
+            backend->expose_pending && !backend->render_scheduled
+            ? bar_frame_delay(bar)
+            : -1;
+
+        poll(fds, sizeof(fds) / sizeof(fds[0]), timeout);
         if (fds[0].revents & POLLIN) {
             /* Already done by the bar */
             send_abort_to_modules = false;
@@ -1249,8 +1299,6 @@ loop(struct bar *_bar,
         }
 
         if (fds[2].revents & POLLIN) {
-            bool do_expose = false;
-
             /* Coalesce “refresh” commands */
             size_t count = 0;
             while (true) {
@@ -1267,15 +1315,16 @@ loop(struct bar *_bar,
                 assert(command == 1);
                 if (command == 1) {
                     count++;
-                    do_expose = true;
+                    backend->expose_pending = true;
                 }
             }
 
             LOG_DBG("coalesced %zu expose commands", count);
-            if (do_expose)
-                expose(_bar);
+            bar->stats.refreshes += count;
         }
 
+        maybe_expose(backend);
+
         if (fds[1].revents & POLLIN) {
             if (wl_display_read_events(backend->display) < 0) {
                 LOG_ERRNO("failed to read events from the Wayland socket");
@@ -1325,7 +1374,7 @@ surface_enter(void *data, struct wl_surface *wl_surface,
             update_size(backend);
 
             if (backend->scale != old_scale)
-                refresh(backend->bar);
+                backend->bar->refresh(backend->bar);
         }
         break;
     }
@@ -1352,6 +1401,58 @@ static const struct wl_surface_listener surface_listener = {
     .leave = &surface_leave,
 };
 
+/* Submits, and resets, the damage accumulated since the last attach */
+static void
+damage_surface(struct wayland_backend *backend)
+{
+    int count;
+    const pixman_box32_t *boxes = pixman_region32_rectangles(
+        &backend->surface_damage, &count);
+
+    for (int i = 0; i < count; i++) {
+        wl_surface_damage_buffer(
+            backend->surface,
+            boxes[i].x1, boxes[i].y1,
+            boxes[i].x2 - boxes[i].x1, boxes[i].y2 - boxes[i].y1);
+    }
+
+    pixman_region32_clear(&backend->surface_damage);
+}
+
+/*
+ * The bar only re-draws the damaged parts of a buffer. Copy
+ * everything else that has changed since the buffer was last used
+ * from the most recently rendered buffer.
+ */
+static void
+update_stale_areas(struct wayland_backend *backend, struct buffer *buffer,
+                   pixman_region32_t *damage)
+{
+    const struct buffer *last = backend->last_buffer;
+
+    pixman_region32_subtract(&buffer->stale, &buffer->stale, damage);
+
+    if (last != NULL && last != buffer &&
+        last->width == buffer->width && last->height == buffer->height &&
+        pixman_region32_not_empty(&buffer->stale))
+    {
+        pixman_image_set_clip_region32(buffer->pix, &buffer->stale);
+        pixman_image_composite32(
+            PIXMAN_OP_SRC, last->pix, NULL, buffer->pix,
+            0, 0, 0, 0, 0, 0, buffer->width, buffer->height);
+        pixman_image_set_clip_region32(buffer->pix, NULL);
+    }
+
+    pixman_region32_clear(&buffer->stale);
+
+    tll_foreach(backend->buffers, it) {
+        if (&it->item != buffer)
+            pixman_region32_union(&it->item.stale, &it->item.stale, damage);
+    }
+
+    backend->last_buffer = buffer;
+}
+
 static void frame_callback(
     void *data, struct wl_callback *wl_callback, uint32_t callback_data);
 
@@ -1378,7 +1479,7 @@ frame_callback(void *data, struct wl_callback *wl_callback, uint32_t callback_da
 
         wl_surface_set_buffer_scale(backend->surface, backend->scale);
         wl_surface_attach(backend->surface, buffer->wl_buf, 0, 0);
-        wl_surface_damage(backend->surface, 0, 0, backend->width, backend->height);
+        damage_surface(backend);
 
         struct wl_callback *cb = wl_surface_frame(backend->surface);
         wl_callback_add_listener(cb, &frame_listener, bar);
@@ -1388,8 +1489,10 @@ frame_callback(void *data, struct wl_callback *wl_callback, uint32_t callback_da
         backend->frame_callback = cb;
         backend->pending_buffer = NULL;
         backend->render_scheduled = true;
-    } else
-        ;//printf("nothing more to do\n");
+    } else {
+        /* Render updates that arrived while the frame was in flight */
+        maybe_expose(backend);
+    }
 }
 
 static void
@@ -1406,6 +1509,10 @@ commit(const struct bar *_bar)
     assert(backend->next_buffer != NULL);
     assert(backend->next_buffer->busy);
 
+    update_stale_areas(backend, backend->next_buffer, &bar->damage);
+    pixman_region32_union(
+        &backend->surface_damage, &backend->surface_damage, &bar->damage);
+
     if (backend->render_scheduled) {
         //printf("already scheduled\n");
 
@@ -1422,7 +1529,7 @@ commit(const struct bar *_bar)
 
         wl_surface_set_buffer_scale(backend->surface, backend->scale);
         wl_surface_attach(backend->surface, buffer->wl_buf, 0, 0);
-        wl_surface_damage(backend->surface, 0, 0, backend->width, backend->height);
+        damage_surface(backend);
 
         struct wl_callback *cb = wl_surface_frame(backend->surface);
         wl_callback_add_listener(cb, &frame_listener, bar);
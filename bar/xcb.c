@@ -1,12 +1,20 @@
 #include "xcb.h"
 
 #include <string.h>
+#include <inttypes.h>
 #include <assert.h>
 
 #include <unistd.h>
 #include <poll.h>
 #include <pthread.h>
 
+#include <sys/eventfd.h>
+
+#if defined(HAVE_XCB_SHM)
+ #include <sys/ipc.h>
+ #include <sys/shm.h>
+#endif
+
 #include <pixman.h>
 #include <xcb/xcb.h>
 #include <xcb/randr.h>
@@ -16,6 +24,10 @@
 #include <xcb/xcb_event.h>
 #include <xcb/xcb_ewmh.h>
 
+#if defined(HAVE_XCB_SHM)
+ #include <xcb/shm.h>
+#endif
+
 #include "private.h"
 
 #define LOG_MODULE "bar:xcb"
@@ -35,18 +47,108 @@ struct xcb_backend {
     xcb_cursor_t cursor;
     const char *xcursor;
 
+    /* Signalled by refresh(), from any thread */
+    int refresh_fd;
+
     uint8_t depth;
     void *client_pixmap;
     size_t client_pixmap_size;
+    uint32_t client_pixmap_stride;
     pixman_image_t *pix;
 
+#if defined(HAVE_XCB_SHM)
+    /* When non-zero, 'client_pixmap' is a SysV SHM segment attached
+     * to the X server */
+    xcb_shm_seg_t shm_seg;
+
+    /*
+     * The server reads the segment asynchronously; each push requests
+     * a completion event, and the bar isn't re-drawn until all pushes
+     * have completed.
+     */
+    uint8_t shm_completion_event;
+    uint8_t shm_major_opcode;
+    unsigned shm_pending;
+#endif
 };
 
 void *
 bar_backend_xcb_new(void)
 {
     xcb_init();
-    return calloc(1, sizeof(struct xcb_backend));
+    struct xcb_backend *backend = calloc(1, sizeof(*backend));
+    backend->refresh_fd = -1;
+    return backend;
+}
+
+/*
+ * Tries to allocate the client pixmap in a SysV SHM segment shared
+ * with the X server. Returns false if the MIT-SHM extension is
+ * unavailable, or if anything goes wrong; the caller then falls back
+ * to a regular malloc:ed pixmap, pushed with xcb_put_image().
+ */
+static bool
+shm_setup(struct xcb_backend *backend)
+{
+#if defined(HAVE_XCB_SHM)
+    const xcb_query_extension_reply_t *ext =
+        xcb_get_extension_data(backend->conn, &xcb_shm_id);
+
+    if (ext == NULL || !ext->present) {
+        LOG_INFO("MIT-SHM not available, using xcb_put_image()");
+        return false;
+    }
+
+    xcb_generic_error_t *e;
+    xcb_shm_query_version_reply_t *version = xcb_shm_query_version_reply(
+        backend->conn, xcb_shm_query_version(backend->conn), &e);
+
+    if (e != NULL) {
+        LOG_WARN("failed to query MIT-SHM version: %s", xcb_error(e));
+        free(e);
+        return false;
+    }
+    free(version);
+
+    int shm_id = shmget(
+        IPC_PRIVATE, backend->client_pixmap_size, IPC_CREAT | 0600);
+    if (shm_id < 0) {
+        LOG_ERRNO("failed to create SHM segment");
+        return false;
+    }
+
+    void *addr = shmat(shm_id, NULL, 0);
+    if (addr == (void *)-1) {
+        LOG_ERRNO("failed to attach SHM segment");
+        shmctl(shm_id, IPC_RMID, NULL);
+        return false;
+    }
+
+    xcb_shm_seg_t seg = xcb_generate_id(backend->conn);
+    e = xcb_request_check(
+        backend->conn,
+        xcb_shm_attach_checked(backend->conn, seg, shm_id, true));
+
+    /* Segment is destroyed once both we, and the server, detaches */
+    shmctl(shm_id, IPC_RMID, NULL);
+
+    if (e != NULL) {
+        LOG_WARN("X server failed to attach SHM segment "
+                 "(remote display?): %s", xcb_error(e));
+        free(e);
+        shmdt(addr);
+        return false;
+    }
+
+    LOG_DBG("using MIT-SHM");
+    backend->shm_seg = seg;
+    backend->shm_completion_event = ext->first_event + XCB_SHM_COMPLETION;
+    backend->shm_major_opcode = ext->major_opcode;
+    backend->client_pixmap = addr;
+    return true;
+#else
+    return false;
+#endif
 }
 
 static bool
@@ -264,12 +366,22 @@ setup(struct bar *_bar)
         PIXMAN_a8r8g8b8, bar->width);
 
     backend->client_pixmap_size = stride * bar->height_with_border;
-    backend->client_pixmap = malloc(backend->client_pixmap_size);
+    backend->client_pixmap_stride = stride;
+
+    if (!shm_setup(backend))
+        backend->client_pixmap = malloc(backend->client_pixmap_size);
+
     backend->pix = pixman_image_create_bits_no_clear(
         PIXMAN_a8r8g8b8, bar->width, bar->height_with_border,
         (uint32_t *)backend->client_pixmap, stride);
     bar->pix = backend->pix;
 
+    backend->refresh_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (backend->refresh_fd < 0) {
+        LOG_ERRNO("failed to create refresh eventfd");
+        return false;
+    }
+
     xcb_map_window(backend->conn, backend->win);
 
     if (xcb_cursor_context_new(backend->conn, screen, &backend->cursor_ctx) < 0)
@@ -285,6 +397,11 @@ cleanup(struct bar *_bar)
     struct private *bar = _bar->private;
     struct xcb_backend *backend = bar->backend.data;
 
+    if (backend->refresh_fd >= 0) {
+        close(backend->refresh_fd);
+        backend->refresh_fd = -1;
+    }
+
     if (backend->conn == NULL)
         return;
 
@@ -295,7 +412,14 @@ cleanup(struct bar *_bar)
 
     if (backend->pix != NULL)
         pixman_image_unref(backend->pix);
-    free(backend->client_pixmap);
+
+#if defined(HAVE_XCB_SHM)
+    if (backend->shm_seg != 0) {
+        xcb_shm_detach(backend->conn, backend->shm_seg);
+        shmdt(backend->client_pixmap);
+    } else
+#endif
+        free(backend->client_pixmap);
 
     if (backend->gc != 0)
         xcb_free_gc(backend->conn, backend->gc);
@@ -309,6 +433,69 @@ cleanup(struct bar *_bar)
     backend->conn = NULL;
 }
 
+/* Pushes 'region' of the client pixmap to the window */
+static void
+put_region(const struct private *bar, struct xcb_backend *backend,
+           pixman_region32_t *region)
+{
+    if (!pixman_region32_not_empty(region))
+        return;
+
+#if defined(HAVE_XCB_SHM)
+    if (backend->shm_seg != 0) {
+        int count;
+        const pixman_box32_t *boxes = pixman_region32_rectangles(
+            region, &count);
+
+        for (int i = 0; i < count; i++) {
+            const pixman_box32_t *b = &boxes[i];
+            xcb_shm_put_image(
+                backend->conn, backend->win, backend->gc,
+                bar->width, bar->height_with_border,
+                b->x1, b->y1, b->x2 - b->x1, b->y2 - b->y1,
+                b->x1, b->y1,
+                backend->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                i == count - 1, backend->shm_seg, 0);
+        }
+
+        /*
+         * Requests are processed in order; the last one completing
+         * means the server is done reading the segment. See loop().
+         */
+        backend->shm_pending++;
+        xcb_flush(backend->conn);
+        return;
+    }
+#endif
+
+    /*
+     * xcb_put_image() needs contiguous pixel data; push the full-width
+     * rows spanning the damaged area.
+     */
+    const pixman_box32_t *extents = pixman_region32_extents(region);
+    const int y = extents->y1;
+    const int height = extents->y2 - extents->y1;
+    const size_t stride = backend->client_pixmap_stride;
+
+    xcb_put_image(
+        backend->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, backend->win, backend->gc,
+        bar->width, height, 0, y, 0,
+        backend->depth, stride * height,
+        (const uint8_t *)backend->client_pixmap + stride * y);
+    xcb_flush(backend->conn);
+}
+
+/* True while the X server may still be reading the SHM segment */
+static bool
+shm_busy(const struct xcb_backend *backend)
+{
+#if defined(HAVE_XCB_SHM)
+    return backend->shm_pending > 0;
+#else
+    return false;
+#endif
+}
+
 static void
 loop(struct bar *_bar,
      void (*expose)(const struct bar *bar),
@@ -322,13 +509,25 @@ loop(struct bar *_bar,
 
     const int fd = xcb_get_file_descriptor(backend->conn);
 
+    /* Areas exposed by the X server, re-pushed from the client pixmap */
+    pixman_region32_t exposed;
+    pixman_region32_init(&exposed);
+
+    /*
+     * A refresh has been requested, but is held back by 'max-fps', or
+     * by the X server not yet being done with the SHM segment
+     */
+    bool expose_pending = false;
+
     while (true) {
         struct pollfd fds[] = {
             {.fd = _bar->abort_fd, .events = POLLIN},
-            {.fd = fd, .events = POLLIN}
+            {.fd = fd, .events = POLLIN},
+            {.fd = backend->refresh_fd, .events = POLLIN},
         };
 
-        poll(fds, sizeof(fds) / sizeof(fds[0]), -1);
+        poll(fds, sizeof(fds) / sizeof(fds[0]),
+             expose_pending && !shm_busy(backend) ? bar_frame_delay(bar) : -1);
 
         if (fds[0].revents && POLLIN)
             break;
@@ -343,18 +542,72 @@ loop(struct bar *_bar,
             break;
         }
 
-        for (xcb_generic_event_t *e = xcb_wait_for_event(backend->conn);
+        if (fds[2].revents & POLLIN) {
+            /* Coalesce “refresh” commands */
+            uint64_t count;
+            if (read(backend->refresh_fd, &count, sizeof(count))
+                != sizeof(count))
+            {
+                LOG_ERRNO("failed to read from refresh eventfd");
+            } else {
+                LOG_DBG("coalesced %"PRIu64" refresh commands", count);
+                bar->stats.refreshes += count;
+                expose_pending = true;
+            }
+        }
+
+        if (expose_pending && !shm_busy(backend) && bar_frame_delay(bar) == 0) {
+            expose_pending = false;
+            expose(_bar);
+        }
+
+        /*
+         * Not only when the socket is readable; expose() may have
+         * done a round-trip, queueing events in XCB's buffer.
+         */
+        for (xcb_generic_event_t *e = xcb_poll_for_event(backend->conn);
              e != NULL;
              e = xcb_poll_for_event(backend->conn))
         {
+#if defined(HAVE_XCB_SHM)
+            if (backend->shm_seg != 0 &&
+                XCB_EVENT_RESPONSE_TYPE(e) == backend->shm_completion_event)
+            {
+                if (backend->shm_pending > 0)
+                    backend->shm_pending--;
+                free(e);
+                continue;
+            }
+#endif
+
             switch (XCB_EVENT_RESPONSE_TYPE(e)) {
-            case 0:
-                LOG_ERR("XCB: %s", xcb_error((const xcb_generic_error_t *)e));
+            case 0: {
+                const xcb_generic_error_t *err = (const xcb_generic_error_t *)e;
+                LOG_ERR("XCB: %s", xcb_error(err));
+
+#if defined(HAVE_XCB_SHM)
+                /* A failed push won't send a completion event */
+                if (backend->shm_seg != 0 &&
+                    err->major_code == backend->shm_major_opcode)
+                {
+                    backend->shm_pending = 0;
+                }
+#endif
                 break;
+            }
 
-            case XCB_EXPOSE:
-                expose(_bar);
+            case XCB_EXPOSE: {
+                /* Our client pixmap is always up-to-date; no need to re-draw */
+                const xcb_expose_event_t *evt = (void *)e;
+                pixman_region32_union_rect(
+                    &exposed, &exposed, evt->x, evt->y, evt->width, evt->height);
+
+                if (evt->count == 0) {
+                    put_region(bar, backend, &exposed);
+                    pixman_region32_clear(&exposed);
+                }
                 break;
+            }
 
             case XCB_MOTION_NOTIFY: {
                 const xcb_motion_notify_event_t *evt = (void *)e;
@@ -397,19 +650,16 @@ loop(struct bar *_bar,
             xcb_flush(backend->conn);
         }
     }
+
+    pixman_region32_fini(&exposed);
 }
 
 static void
 commit(const struct bar *_bar)
 {
-    const struct private *bar = _bar->private;
-    const struct xcb_backend *backend = bar->backend.data;
-
-    xcb_put_image(
-        backend->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, backend->win, backend->gc,
-        bar->width, bar->height_with_border, 0, 0, 0,
-        backend->depth, backend->client_pixmap_size, backend->client_pixmap);
-    xcb_flush(backend->conn);
+    struct private *bar = _bar->private;
+    struct xcb_backend *backend = bar->backend.data;
+    put_region(bar, backend, &bar->damage);
 }
 
 static void
@@ -418,28 +668,12 @@ refresh(const struct bar *_bar)
     const struct private *bar = _bar->private;
     const struct xcb_backend *backend = bar->backend.data;
 
-    /* Send an event to handle refresh from main thread */
-
-    /* Note: docs say that all X11 events are 32 bytes, reglardless of
-     * the size of the event structure */
-    xcb_expose_event_t *evt = calloc(32, 1);
-
-    *evt = (xcb_expose_event_t){
-        .response_type = XCB_EXPOSE,
-        .window = backend->win,
-        .x = 0,
-        .y = 0,
-        .width = bar->width,
-        .height = bar->height,
-        .count = 1
-    };
-
-    xcb_send_event(
-        backend->conn, false, backend->win, XCB_EVENT_MASK_EXPOSURE,
-        (char *)evt);
-
-    xcb_flush(backend->conn);
-    free(evt);
+    /* Handled by the main thread, in loop() */
+    if (write(backend->refresh_fd, &(uint64_t){1}, sizeof(uint64_t))
+        != sizeof(uint64_t))
+    {
+        LOG_ERRNO("failed to signal 'refresh' to main thread");
+    }
 }
 
 static void
@@ -0,0 +1,542 @@
+/*
+ * Template expansion micro-benchmark.
+ *
+ * Expands a set of representative templates against a fixed tag set,
+ * in two ways:
+ *
+ *  - baseline_expand_template(): the template string is parsed on
+ *    every expansion, and the result is heap allocated. This is the
+ *    tags_expand_template() implementation every particle used before
+ *    templates were compiled, copied verbatim (tag lookup included),
+ *    since tags_expand_template() now compiles the template on each
+ *    call,
+ *  - tag_template_expand(): the template is compiled once, and each
+ *    expansion only walks the token list, writing into the template's
+ *    own, reused, buffer.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include <getopt.h>
+
+#include "../tag.h"
+
+#define LOG_MODULE "bench"
+#include "../log.h"
+
+static const char *const templates[] = {
+    "{cpu}%",
+    "{name}: {capacity:3}% {estimate}",
+    "{state}",
+    "{rx:mib} MiB/s ↓ {tx:kib} KiB/s ↑",
+    "{title:20}…",
+    "{volume:%} | {muted} | {sink_name} ({percent:02}%)",
+    "{used:.2} / {total:.2} GiB ({free:hex} free)",
+    "a long, literal only, template without any tags at all",
+    "{missing} {name:unknown-formatter}",
+    "{missing:{cpu}} {state:{cpu}} {missing:{missing:{{cpu}}} {missing:{}",
+};
+
+/*
+ * Baseline: template expansion as it was before compiled templates;
+ * do not modify, or the comparison is meaningless.
+ */
+static const struct tag *
+baseline_tag_for_name(const struct tag_set *set, const char *name)
+{
+    if (set == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < set->count; i++) {
+        const struct tag *tag = set->tags[i];
+        if (strcmp(tag->name(tag), name) == 0)
+            return tag;
+    }
+
+    return NULL;
+}
+
+struct sbuf {
+    char *s;
+    size_t size;
+    size_t len;
+};
+
+static void
+sbuf_append_at_most(struct sbuf *s1, const char *s2, size_t n)
+{
+    if (s1->len + n >= s1->size) {
+        size_t required_size = s1->len + n + 1;
+        s1->size = 2 * required_size;
+
+        s1->s = realloc(s1->s, s1->size);
+        //s1->s[s1->len] = '\0';
+    }
+
+    memcpy(&s1->s[s1->len], s2, n);
+    s1->len += n;
+    s1->s[s1->len] = '\0';
+}
+
+static void
+sbuf_append(struct sbuf *s1, const char *s2)
+{
+    sbuf_append_at_most(s1, s2, strlen(s2));
+}
+
+// stores the number in "*value" on success
+static bool
+is_number(const char *str, int *value)
+{
+    errno = 0;
+
+    char *end;
+    int v = strtol(str, &end, 10);
+    if (errno != 0 || *end != '\0')
+        return false;
+
+    *value = v;
+    return true;
+}
+
+static char *
+baseline_expand_template(const char *template, const struct tag_set *tags)
+{
+    if (template == NULL)
+        return NULL;
+
+    struct sbuf formatted = {0};
+    while (true) {
+        /* Find next tag opening '{' */
+        const char *begin = strchr(template, '{');
+
+        if (begin == NULL) {
+            /* No more tags, copy remaining characters */
+            sbuf_append(&formatted, template);
+            break;
+        }
+
+        /* Find closing '}' */
+        const char *end = strchr(begin, '}');
+        if (end == NULL) {
+            /* Wasn't actually a tag, copy as-is instead */
+            sbuf_append_at_most(&formatted, template, begin - template + 1);
+            template = begin + 1;
+            continue;
+        }
+
+        /* Extract tag name + argument*/
+        char tag_name_and_arg[end - begin];
+        strncpy(tag_name_and_arg, begin + 1, end - begin - 1);
+        tag_name_and_arg[end - begin - 1] = '\0';
+
+        static const size_t MAX_TAG_ARGS = 4;
+        const char *tag_name = NULL;
+        const char *tag_args[MAX_TAG_ARGS];
+        memset(tag_args, 0, sizeof(tag_args));
+
+        {
+            char *saveptr;
+            tag_name = strtok_r(tag_name_and_arg, ":", &saveptr);
+
+            for (size_t i = 0; i < MAX_TAG_ARGS; i++) {
+                const char *arg = strtok_r(NULL, ":", &saveptr);
+                if (arg == NULL)
+                    break;
+                tag_args[i] = arg;
+            }
+        }
+
+        /* Lookup tag */
+        const struct tag *tag = NULL;
+
+        if (tag_name == NULL || (tag = baseline_tag_for_name(tags, tag_name)) == NULL) {
+            /* No such tag, copy as-is instead */
+            sbuf_append_at_most(&formatted, template, begin - template + 1);
+            template = begin + 1;
+            continue;
+        }
+
+        /* Copy characters preceding the tag (name) */
+        sbuf_append_at_most(&formatted, template, begin - template);
+
+        /* Parse arguments */
+        enum {
+            FMT_DEFAULT,
+            FMT_HEX,
+            FMT_OCT,
+            FMT_PERCENT,
+            FMT_KBYTE,
+            FMT_MBYTE,
+            FMT_GBYTE,
+            FMT_KIBYTE,
+            FMT_MIBYTE,
+            FMT_GIBYTE,
+        } format = FMT_DEFAULT;
+
+        enum {
+            VALUE_VALUE,
+            VALUE_MIN,
+            VALUE_MAX,
+            VALUE_UNIT,
+        } kind = VALUE_VALUE;
+
+        int digits = 0;
+        int decimals = 2;
+        bool zero_pad = false;
+        char *point = NULL;
+
+        for (size_t i = 0; i < MAX_TAG_ARGS; i++) {
+            if (tag_args[i] == NULL)
+                break;
+            else if (strcmp(tag_args[i], "hex") == 0)
+                format = FMT_HEX;
+            else if (strcmp(tag_args[i], "oct") == 0)
+                format = FMT_OCT;
+            else if (strcmp(tag_args[i], "%") == 0)
+                format = FMT_PERCENT;
+            else if (strcmp(tag_args[i], "kb") == 0)
+                format = FMT_KBYTE;
+            else if (strcmp(tag_args[i], "mb") == 0)
+                format = FMT_MBYTE;
+            else if (strcmp(tag_args[i], "gb") == 0)
+                format = FMT_GBYTE;
+            else if (strcmp(tag_args[i], "kib") == 0)
+                format = FMT_KIBYTE;
+            else if (strcmp(tag_args[i], "mib") == 0)
+                format = FMT_MIBYTE;
+            else if (strcmp(tag_args[i], "gib") == 0)
+                format = FMT_GIBYTE;
+            else if (strcmp(tag_args[i], "min") == 0)
+                kind = VALUE_MIN;
+            else if (strcmp(tag_args[i], "max") == 0)
+                kind = VALUE_MAX;
+            else if (strcmp(tag_args[i], "unit") == 0)
+                kind = VALUE_UNIT;
+            else if (is_number(tag_args[i], &digits)) // i.e.: "{tag:3}"
+                zero_pad = tag_args[i][0] == '0';
+            else if ((point = strchr(tag_args[i], '.')) != NULL) {
+                *point = '\0';
+
+                const char *digits_str = tag_args[i];
+                const char *decimals_str = point + 1;
+
+                if (digits_str[0] != '\0') { // guards against i.e. "{tag:.3}"
+                    if (!is_number(digits_str, &digits)) {
+                        LOG_WARN(
+                            "tag `%s`: invalid field width formatter. Ignoring...",
+                            tag_name);
+                    }
+                }
+
+                if (decimals_str[0] != '\0') { // guards against i.e. "{tag:3.}"
+                    if (!is_number(decimals_str, &decimals)) {
+                        LOG_WARN(
+                            "tag `%s`: invalid decimals formatter. Ignoring...",
+                            tag_name);
+                    }
+                }
+                zero_pad = digits_str[0] == '0';
+            }
+            else
+                LOG_WARN("invalid tag formatter: %s", tag_args[i]);
+        }
+
+        /* Copy tag value */
+        switch (kind) {
+        case VALUE_VALUE:
+            switch (format) {
+            case FMT_DEFAULT: {
+                switch (tag->type(tag)) {
+                case TAG_TYPE_FLOAT: {
+                    const char* fmt = zero_pad ? "%0*.*f" : "%*.*f";
+                    char str[24];
+                    snprintf(str, sizeof(str), fmt, digits, decimals, tag->as_float(tag));
+                    sbuf_append(&formatted, str);
+                    break;
+                }
+
+                case TAG_TYPE_INT: {
+                    const char* fmt = zero_pad ? "%0*ld" : "%*ld";
+                    char str[24];
+                    snprintf(str, sizeof(str), fmt, digits, tag->as_int(tag));
+                    sbuf_append(&formatted, str);
+                    break;
+                }
+
+                default:
+                    sbuf_append(&formatted, tag->as_string(tag));
+                    break;
+                }
+
+                break;
+            }
+
+            case FMT_HEX:
+            case FMT_OCT: {
+                const char* fmt = format == FMT_HEX ?
+                    zero_pad ? "%0*lx" : "%*lx" :
+                    zero_pad ? "%0*lo" : "%*lo";
+                char str[24];
+                snprintf(str, sizeof(str), fmt, digits, tag->as_int(tag));
+                sbuf_append(&formatted, str);
+                break;
+            }
+
+            case FMT_PERCENT: {
+                const long min = tag->min(tag);
+                const long max = tag->max(tag);
+                const long cur = tag->as_int(tag);
+
+                const char* fmt = zero_pad ? "%0*lu" : "%*lu";
+                char str[4];
+                snprintf(str, sizeof(str), fmt, digits, (cur - min) * 100 / (max - min));
+                sbuf_append(&formatted, str);
+                break;
+            }
+
+            case FMT_KBYTE:
+            case FMT_MBYTE:
+            case FMT_GBYTE:
+            case FMT_KIBYTE:
+            case FMT_MIBYTE:
+            case FMT_GIBYTE: {
+                const long divider =
+                    format == FMT_KBYTE ? 1000 :
+                    format == FMT_MBYTE ? 1000 * 1000 :
+                    format == FMT_GBYTE ? 1000 * 1000 * 1000 :
+                    format == FMT_KIBYTE ? 1024 :
+                    format == FMT_MIBYTE ? 1024 * 1024 :
+                    format == FMT_GIBYTE ? 1024 * 1024 * 1024 :
+                    1;
+
+                char str[24];
+                if (tag->type(tag) == TAG_TYPE_FLOAT) {
+                    const char* fmt = zero_pad ? "%0*.*f" : "%*.*f";
+                    snprintf(str, sizeof(str), fmt, digits, decimals, tag->as_float(tag) / (double)divider);
+                } else {
+                    const char* fmt = zero_pad ? "%0*lu" : "%*lu";
+                    snprintf(str, sizeof(str), fmt, digits, tag->as_int(tag) / divider);
+                }
+                sbuf_append(&formatted, str);
+                break;
+            }
+            }
+            break;
+
+        case VALUE_MIN:
+        case VALUE_MAX: {
+            const long min = tag->min(tag);
+            const long max = tag->max(tag);
+            long value = kind == VALUE_MIN ? min : max;
+
+            const char *fmt = NULL;
+            switch (format) {
+            case FMT_DEFAULT: fmt = zero_pad ? "%0*ld" : "%*ld"; break;
+            case FMT_HEX:     fmt = zero_pad ? "%0*lx" : "%*lx"; break;
+            case FMT_OCT:     fmt = zero_pad ? "%0*lo" : "%*lo"; break;
+            case FMT_PERCENT:
+                value = (value - min) * 100 / (max - min);
+                fmt = zero_pad ? "%0*lu" : "%*lu";
+                break;
+
+            case FMT_KBYTE:
+            case FMT_MBYTE:
+            case FMT_GBYTE:
+            case FMT_KIBYTE:
+            case FMT_MIBYTE:
+            case FMT_GIBYTE: {
+                const long divider =
+                    format == FMT_KBYTE ? 1024 :
+                    format == FMT_MBYTE ? 1024 * 1024 :
+                    format == FMT_GBYTE ? 1024 * 1024 * 1024 :
+                    format == FMT_KIBYTE ? 1000 :
+                    format == FMT_MIBYTE ? 1000 * 1000 :
+                    format == FMT_GIBYTE ? 1000 * 1000 * 1000 :
+                    1;
+                value /= divider;
+                fmt = zero_pad ? "%0*lu" : "%*lu";
+                break;
+            }
+            }
+
+            assert(fmt != NULL);
+
+            char str[24];
+            snprintf(str, sizeof(str), fmt, digits, value);
+            sbuf_append(&formatted, str);
+            break;
+        }
+
+        case VALUE_UNIT: {
+            const char *value = NULL;
+
+            switch (tag->realtime(tag)) {
+            case TAG_REALTIME_NONE:  value = ""; break;
+            case TAG_REALTIME_SECS:  value = "s"; break;
+            case TAG_REALTIME_MSECS: value = "ms"; break;
+            }
+
+            sbuf_append(&formatted, value);
+            break;
+        }
+        }
+
+        /* Skip past tag name + closing '}' */
+        template = end + 1;
+    }
+
+    return formatted.s;
+}
+
+/* Keeps the compiled expansion loop from being optimized away */
+static volatile size_t sink;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct tag_set
+make_tags(void)
+{
+    static struct tag *tags[16];
+    size_t count = 0;
+
+    tags[count++] = tag_new_int_range(NULL, "cpu", 42, 0, 100);
+    tags[count++] = tag_new_string(NULL, "name", "BAT0");
+    tags[count++] = tag_new_int_range(NULL, "capacity", 87, 0, 100);
+    tags[count++] = tag_new_string(NULL, "estimate", "2:13");
+    tags[count++] = tag_new_string(NULL, "state", "discharging");
+    tags[count++] = tag_new_int(NULL, "rx", 12345678);
+    tags[count++] = tag_new_int(NULL, "tx", 345678);
+    tags[count++] = tag_new_string(
+        NULL, "title", "yambar — a modular status panel for X11 and Wayland");
+    tags[count++] = tag_new_int_range(NULL, "volume", 35, 0, 65536);
+    tags[count++] = tag_new_bool(NULL, "muted", false);
+    tags[count++] = tag_new_string(NULL, "sink_name", "Built-in Audio");
+    tags[count++] = tag_new_int_range(NULL, "percent", 7, 0, 100);
+    tags[count++] = tag_new_float(NULL, "used", 7.25);
+    tags[count++] = tag_new_float(NULL, "total", 31.3);
+    tags[count++] = tag_new_int(NULL, "free", 0xdeadbeef);
+
+    return (struct tag_set){.tags = tags, .count = count};
+}
+
+static void
+print_usage(const char *prog_name)
+{
+    printf("Usage: %s [OPTIONS...]\n", prog_name);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -n,--iterations=COUNT       expansions per template (default: 100000)\n"
+           "  -h,--help                   show this help text\n");
+}
+
+int
+main(int argc, char *const *argv)
+{
+    static const struct option longopts[] = {
+        {"iterations", required_argument, 0, 'n'},
+        {"help",       no_argument,       0, 'h'},
+        {NULL,         no_argument,       0,   0},
+    };
+
+    unsigned long iterations = 100000;
+
+    while (true) {
+        int c = getopt_long(argc, argv, ":n:h", longopts, NULL);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'n': {
+            char *end;
+            iterations = strtoul(optarg, &end, 10);
+            if (*end != '\0' || iterations == 0) {
+                fprintf(stderr, "%s: invalid iteration count\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+
+        case 'h':
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+
+        case ':':
+            fprintf(stderr, "error: -%c: missing required argument\n", optopt);
+            return EXIT_FAILURE;
+
+        case '?':
+            fprintf(stderr, "error: -%c: invalid option\n", optopt);
+            return EXIT_FAILURE;
+        }
+    }
+
+    log_init(LOG_COLORIZE_AUTO, false, LOG_FACILITY_USER, LOG_CLASS_ERROR);
+
+    struct tag_set tags = make_tags();
+    const size_t count = sizeof(templates) / sizeof(templates[0]);
+
+    printf("%-56s %14s %14s %8s\n",
+           "", "parse (ns)", "compiled (ns)", "speedup");
+
+    uint64_t total_parse = 0, total_compiled = 0;
+    int ret = EXIT_SUCCESS;
+
+    for (size_t i = 0; i < count; i++) {
+        const char *fmt = templates[i];
+        struct tag_template *compiled = tag_template_compile(fmt);
+
+        /* Both paths must produce identical output */
+        char *expected = baseline_expand_template(fmt, &tags);
+        if (strcmp(expected, tag_template_expand(compiled, &tags)) != 0) {
+            fprintf(stderr, "%s: output mismatch: \"%s\" vs. \"%s\"\n",
+                    fmt, expected, tag_template_expand(compiled, &tags));
+            ret = EXIT_FAILURE;
+        }
+        free(expected);
+
+        uint64_t start = now_ns();
+        for (unsigned long j = 0; j < iterations; j++) {
+            char *s = baseline_expand_template(fmt, &tags);
+            free(s);
+        }
+        const uint64_t parse = now_ns() - start;
+
+        start = now_ns();
+        for (unsigned long j = 0; j < iterations; j++)
+            sink += strlen(tag_template_expand(compiled, &tags));
+        const uint64_t compiled_ns = now_ns() - start;
+
+        tag_template_destroy(compiled);
+
+        total_parse += parse;
+        total_compiled += compiled_ns;
+
+        printf("%-56.56s %14.1f %14.1f %7.1fx\n",
+               fmt,
+               (double)parse / iterations,
+               (double)compiled_ns / iterations,
+               compiled_ns > 0 ? (double)parse / compiled_ns : 0.);
+    }
+
+    printf("%-56s %14.1f %14.1f %7.1fx\n",
+           "(all templates)",
+           (double)total_parse / iterations / count,
+           (double)total_compiled / iterations / count,
+           total_compiled > 0 ? (double)total_parse / total_compiled : 0.);
+
+    tag_set_destroy(&tags);
+    log_deinit();
+    return ret;
+}
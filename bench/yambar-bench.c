@@ -0,0 +1,600 @@
+/*
+ * Rendering micro-benchmark.
+ *
+ * Loads a configuration, and repeatedly:
+ *
+ *  - instantiates each module's content (module_begin_expose()), with
+ *    the module's initial state,
+ *  - lays out the bar (bar_calculate_widths()),
+ *  - renders each exposable (expose()),
+ *  - instantiates and renders every particle in each module's
+ *    content, using a synthetic tag set derived from the particles'
+ *    templates and conditions.
+ *
+ * No display server is needed, and no module is started.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <time.h>
+#include <getopt.h>
+#include <locale.h>
+
+#include <tllist.h>
+
+#include "../bar/bar.h"
+#include "../bar/private.h"
+#include "../config.h"
+#include "../module.h"
+#include "../particle.h"
+#include "../tag.h"
+#include "../yml.h"
+
+#define LOG_MODULE "bench"
+#include "../log.h"
+
+struct samples {
+    char *name;
+    uint64_t *ns;
+    size_t count;
+    size_t size;
+};
+
+static tll(struct samples) all_samples;
+
+static struct samples *
+samples_get(const char *name)
+{
+    tll_foreach(all_samples, it) {
+        if (strcmp(it->item.name, name) == 0)
+            return &it->item;
+    }
+
+    tll_push_back(all_samples, ((struct samples){.name = strdup(name)}));
+    return &tll_back(all_samples);
+}
+
+static void
+samples_add(struct samples *s, uint64_t ns)
+{
+    if (s->count >= s->size) {
+        s->size = s->size == 0 ? 1024 : s->size * 2;
+        s->ns = realloc(s->ns, s->size * sizeof(s->ns[0]));
+    }
+
+    s->ns[s->count++] = ns;
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+u64_cmp(const void *_a, const void *_b)
+{
+    const uint64_t *a = _a;
+    const uint64_t *b = _b;
+    return *a < *b ? -1 : *a > *b;
+}
+
+static void
+report(void)
+{
+    printf("%-56s %8s %10s %10s\n", "", "samples", "p50 (µs)", "p99 (µs)");
+
+    tll_foreach(all_samples, it) {
+        struct samples *s = &it->item;
+        if (s->count == 0)
+            continue;
+
+        qsort(s->ns, s->count, sizeof(s->ns[0]), &u64_cmp);
+
+        const uint64_t p50 = s->ns[s->count / 2];
+        const uint64_t p99 = s->ns[s->count * 99 / 100];
+
+        printf("%-56s %8zu %10.2f %10.2f\n",
+               s->name, s->count, p50 / 1000., p99 / 1000.);
+    }
+}
+
+static void
+samples_free_all(void)
+{
+    tll_foreach(all_samples, it) {
+        free(it->item.name);
+        free(it->item.ns);
+        tll_remove(all_samples, it);
+    }
+}
+
+/*
+ * Synthetic tags
+ */
+
+static void
+add_tag(struct tag_set *tags, struct tag *tag)
+{
+    if (tag_for_name(tags, tag->name(tag)) != NULL) {
+        tag->destroy(tag);
+        return;
+    }
+
+    tags->tags = realloc(tags->tags, (tags->count + 1) * sizeof(tags->tags[0]));
+    tags->tags[tags->count++] = tag;
+}
+
+/* "{name}" and "{name:fmt}" references, in a template string */
+static void
+tags_from_template(struct tag_set *tags, const char *template)
+{
+    for (const char *start = strchr(template, '{');
+         start != NULL;
+         start = strchr(start + 1, '{'))
+    {
+        const char *end = start + 1;
+        while (*end != '\0' && *end != '}' && *end != ':')
+            end++;
+
+        if (*end == '\0' || end == start + 1)
+            continue;
+
+        char name[end - start];
+        memcpy(name, start + 1, end - start - 1);
+        name[end - start - 1] = '\0';
+
+        add_tag(tags, tag_new_string(NULL, name, "synthetic"));
+    }
+}
+
+/*
+ * Simple map conditions: "tag", "~tag" and "tag <op> value". The tag
+ * is given a value that satisfies the condition.
+ */
+static void
+tags_from_condition(struct tag_set *tags, const char *cond)
+{
+    while (*cond == '~' || *cond == '(' || isspace((unsigned char)*cond))
+        cond++;
+
+    const char *end = cond;
+    while (isalnum((unsigned char)*end) || *end == '_' || *end == '-')
+        end++;
+
+    if (end == cond)
+        return;
+
+    char name[end - cond + 1];
+    memcpy(name, cond, end - cond);
+    name[end - cond] = '\0';
+
+    const char *op = end;
+    while (isspace((unsigned char)*op))
+        op++;
+
+    if (*op == '\0' || *op == ')' || *op == '&' || *op == '|') {
+        add_tag(tags, tag_new_bool(NULL, name, true));
+        return;
+    }
+
+    const char *value = op;
+    while (*value != '\0' && strchr("=!<>", *value) != NULL)
+        value++;
+    while (isspace((unsigned char)*value) || *value == '"')
+        value++;
+
+    const char *value_end = value;
+    while (*value_end != '\0' && *value_end != '"' &&
+           *value_end != ')' && !isspace((unsigned char)*value_end))
+    {
+        value_end++;
+    }
+
+    char str[value_end - value + 1];
+    memcpy(str, value, value_end - value);
+    str[value_end - value] = '\0';
+
+    char *int_end;
+    long as_int = strtol(str, &int_end, 10);
+
+    if (str[0] != '\0' && *int_end == '\0')
+        add_tag(tags, tag_new_int(NULL, name, as_int));
+    else
+        add_tag(tags, tag_new_string(NULL, name, str));
+}
+
+static void
+tags_from_node(struct tag_set *tags, const struct yml_node *node)
+{
+    if (yml_is_scalar(node)) {
+        const char *value = yml_value_as_string(node);
+        if (value != NULL)
+            tags_from_template(tags, value);
+    }
+
+    else if (yml_is_list(node)) {
+        for (struct yml_list_iter it = yml_list_iter(node);
+             it.node != NULL;
+             yml_list_next(&it))
+        {
+            tags_from_node(tags, it.node);
+        }
+    }
+
+    else if (yml_is_dict(node)) {
+        for (struct yml_dict_iter it = yml_dict_iter(node);
+             it.key != NULL;
+             yml_dict_next(&it))
+        {
+            const char *key = yml_value_as_string(it.key);
+
+            if (strcmp(key, "tag") == 0 && yml_is_scalar(it.value)) {
+                /* ramp, progress-bar, and map's legacy syntax */
+                add_tag(tags, tag_new_int_range(
+                            NULL, yml_value_as_string(it.value), 50, 0, 100));
+            }
+
+            else if (strcmp(key, "conditions") == 0 && yml_is_dict(it.value)) {
+                for (struct yml_dict_iter c = yml_dict_iter(it.value);
+                     c.key != NULL;
+                     yml_dict_next(&c))
+                {
+                    tags_from_condition(tags, yml_value_as_string(c.key));
+                }
+            }
+
+            tags_from_node(tags, it.value);
+        }
+    }
+}
+
+/*
+ * Benchmarks
+ */
+
+struct context {
+    pixman_image_t *pix;
+    int y;
+    int height;
+    size_t iterations;
+};
+
+static const char *const particle_names[] = {
+    "empty", "list", "map", "progress-bar", "ramp", "string",
+};
+
+/* Particle name, for particles on the "{name: {...}}" form */
+static const char *
+particle_type(const struct yml_node *node)
+{
+    if (!yml_is_dict(node) || yml_dict_length(node) != 1)
+        return NULL;
+
+    const char *key = yml_value_as_string(yml_dict_iter(node).key);
+    for (size_t i = 0; i < sizeof(particle_names) / sizeof(particle_names[0]); i++) {
+        if (strcmp(key, particle_names[i]) == 0)
+            return particle_names[i];
+    }
+
+    return NULL;
+}
+
+static void
+bench_particle(const struct context *ctx, const struct particle *particle,
+               const struct tag_set *tags, const char *prefix)
+{
+    char name[128];
+    snprintf(name, sizeof(name), "%s: instantiate+begin_expose", prefix);
+    struct samples *begin = samples_get(name);
+    snprintf(name, sizeof(name), "%s: expose", prefix);
+    struct samples *expose = samples_get(name);
+
+    for (size_t i = 0; i < ctx->iterations; i++) {
+        uint64_t t0 = now_ns();
+        struct exposable *e = particle->instantiate(particle, tags);
+        e->begin_expose(e);
+        uint64_t t1 = now_ns();
+        e->expose(e, ctx->pix, 0, ctx->y, ctx->height);
+        uint64_t t2 = now_ns();
+        e->destroy(e);
+
+        samples_add(begin, t1 - t0);
+        samples_add(expose, t2 - t1);
+    }
+}
+
+static void bench_particle_tree(
+    const struct context *ctx, const struct yml_node *node,
+    struct conf_inherit inherit, const struct tag_set *tags);
+
+/* Finds, and benchmarks, particles nested in 'node' (e.g. list items) */
+static void
+bench_sub_particles(const struct context *ctx, const struct yml_node *node,
+                    struct conf_inherit inherit, const struct tag_set *tags)
+{
+    if (yml_is_list(node)) {
+        for (struct yml_list_iter it = yml_list_iter(node);
+             it.node != NULL;
+             yml_list_next(&it))
+        {
+            if (particle_type(it.node) != NULL)
+                bench_particle_tree(ctx, it.node, inherit, tags);
+            else
+                bench_sub_particles(ctx, it.node, inherit, tags);
+        }
+    }
+
+    else if (yml_is_dict(node)) {
+        for (struct yml_dict_iter it = yml_dict_iter(node);
+             it.key != NULL;
+             yml_dict_next(&it))
+        {
+            if (strcmp(yml_value_as_string(it.key), "deco") == 0)
+                continue;
+
+            if (particle_type(it.value) != NULL)
+                bench_particle_tree(ctx, it.value, inherit, tags);
+            else
+                bench_sub_particles(ctx, it.value, inherit, tags);
+        }
+    }
+}
+
+/* Benchmarks the particle in 'node', and all its sub-particles */
+static void
+bench_particle_tree(const struct context *ctx, const struct yml_node *node,
+                    struct conf_inherit inherit, const struct tag_set *tags)
+{
+    /* A plain list is short-hand for a list particle */
+    const char *type = yml_is_list(node) ? "list" : particle_type(node);
+    assert(type != NULL);
+
+    struct particle *particle = conf_to_particle(node, inherit);
+
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "particle %s", type);
+    bench_particle(ctx, particle, tags, prefix);
+    particle->destroy(particle);
+
+    if (yml_is_list(node))
+        bench_sub_particles(ctx, node, inherit, tags);
+    else
+        bench_sub_particles(ctx, yml_dict_iter(node).value, inherit, tags);
+}
+
+static void
+bench_module(const struct context *ctx, struct module *mod,
+             const struct yml_node *mod_node, struct conf_inherit inherit,
+             const char *location, size_t idx)
+{
+    char name[128];
+    const char *desc = mod->description != NULL ? mod->description(mod) : "?";
+
+    snprintf(name, sizeof(name), "%s#%zu %s: module_begin_expose", location, idx, desc);
+    struct samples *begin = samples_get(name);
+    snprintf(name, sizeof(name), "%s#%zu %s: expose", location, idx, desc);
+    struct samples *expose = samples_get(name);
+
+    for (size_t i = 0; i < ctx->iterations; i++) {
+        uint64_t t0 = now_ns();
+        struct exposable *e = module_begin_expose(mod);
+        uint64_t t1 = now_ns();
+        e->expose(e, ctx->pix, 0, ctx->y, ctx->height);
+        uint64_t t2 = now_ns();
+        module_end_expose(mod, e);
+
+        samples_add(begin, t1 - t0);
+        samples_add(expose, t2 - t1);
+    }
+
+    /* Same particles, with synthetic tags */
+    const struct yml_node *content = yml_get_value(mod_node, "content");
+    if (content == NULL)
+        return;
+
+    struct tag_set tags = {0};
+    tags_from_node(&tags, content);
+
+    struct particle *particle = conf_to_particle(content, inherit);
+    snprintf(name, sizeof(name), "%s#%zu %s (synthetic tags)", location, idx, desc);
+    bench_particle(ctx, particle, &tags, name);
+    particle->destroy(particle);
+
+    if (yml_is_list(content) || particle_type(content) != NULL)
+        bench_particle_tree(ctx, content, inherit, &tags);
+
+    for (size_t i = 0; i < tags.count; i++)
+        tags.tags[i]->destroy(tags.tags[i]);
+    free(tags.tags);
+}
+
+static void
+print_usage(const char *prog_name)
+{
+    printf("Usage: %s [OPTION]... CONFIG\n", prog_name);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -n,--iterations=COUNT   number of iterations (default: 1000)\n"
+           "  -w,--width=PIXELS       bar width (default: 1920)\n");
+}
+
+int
+main(int argc, char *const *argv)
+{
+    static const struct option longopts[] = {
+        {"iterations", required_argument, 0, 'n'},
+        {"width",      required_argument, 0, 'w'},
+        {"help",       no_argument,       0, 'h'},
+        {NULL,         no_argument,       0, 0},
+    };
+
+    size_t iterations = 1000;
+    int width = 1920;
+
+    while (true) {
+        int c = getopt_long(argc, argv, "n:w:h", longopts, NULL);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'w':
+            width = atoi(optarg);
+            break;
+
+        case 'h':
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || iterations == 0 || width <= 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    log_init(LOG_COLORIZE_AUTO, false, LOG_FACILITY_USER, LOG_CLASS_WARNING);
+    fcft_init(FCFT_LOG_COLORIZE_AUTO, false, FCFT_LOG_CLASS_WARNING);
+    setlocale(LC_ALL, "");
+
+    int ret = EXIT_FAILURE;
+    const char *config_path = argv[optind];
+
+    FILE *conf_file = fopen(config_path, "r");
+    if (conf_file == NULL) {
+        LOG_ERRNO("%s: failed to open", config_path);
+        goto out;
+    }
+
+    char *yml_error = NULL;
+    struct yml_node *conf = yml_load(conf_file, &yml_error);
+    fclose(conf_file);
+
+    if (conf == NULL) {
+        LOG_ERR("%s:%s", config_path, yml_error);
+        free(yml_error);
+        goto out;
+    }
+
+    const struct yml_node *bar_conf = yml_get_value(conf, "bar");
+    struct bar *bar = bar_conf != NULL
+        ? conf_to_bar(bar_conf, BAR_BACKEND_HEADLESS) : NULL;
+
+    if (bar == NULL) {
+        LOG_ERR("%s: failed to load configuration", config_path);
+        yml_destroy(conf);
+        goto out;
+    }
+
+    struct private *b = bar->private;
+    b->width = width;
+    b->height_with_border =
+        b->height + b->border.top_width + b->border.bottom_width;
+
+    pixman_image_t *pix = pixman_image_create_bits(
+        PIXMAN_a8r8g8b8, b->width, b->height_with_border, NULL, 0);
+
+    const struct context ctx = {
+        .pix = pix,
+        .y = b->border.top_width,
+        .height = b->height,
+        .iterations = iterations,
+    };
+
+    /* Same inheritance rules as conf_to_bar() */
+    const struct yml_node *font_node = yml_get_value(bar_conf, "font");
+    const struct yml_node *font_shaping_node = yml_get_value(bar_conf, "font-shaping");
+    const struct yml_node *foreground_node = yml_get_value(bar_conf, "foreground");
+
+    struct fcft_font *font = font_node != NULL
+        ? conf_to_font(font_node)
+        : fcft_from_name(1, &(const char *){"sans"}, NULL);
+
+    struct conf_inherit inherited = {
+        .font = font,
+        .font_shaping = font_shaping_node != NULL
+            ? conf_to_font_shaping(font_shaping_node) : FONT_SHAPE_FULL,
+        .foreground = foreground_node != NULL
+            ? conf_to_color(foreground_node)
+            : (pixman_color_t){0xffff, 0xffff, 0xffff, 0xffff},
+    };
+
+    static const char *const locations[] = {"left", "center", "right"};
+    struct module **mods[] = {b->left.mods, b->center.mods, b->right.mods};
+    struct exposable **exps[] = {b->left.exps, b->center.exps, b->right.exps};
+
+    for (size_t i = 0; i < 3; i++) {
+        const struct yml_node *list = yml_get_value(bar_conf, locations[i]);
+        if (list == NULL)
+            continue;
+
+        size_t idx = 0;
+        for (struct yml_list_iter it = yml_list_iter(list);
+             it.node != NULL;
+             yml_list_next(&it), idx++)
+        {
+            const struct yml_node *mod_node = yml_dict_iter(it.node).value;
+
+            const struct yml_node *mod_font = yml_get_value(mod_node, "font");
+            const struct yml_node *mod_font_shaping = yml_get_value(mod_node, "font-shaping");
+            const struct yml_node *mod_foreground = yml_get_value(mod_node, "foreground");
+
+            struct fcft_font *font = mod_font != NULL ? conf_to_font(mod_font) : NULL;
+
+            struct conf_inherit mod_inherit = {
+                .font = font != NULL ? font : inherited.font,
+                .font_shaping = mod_font_shaping != NULL
+                    ? conf_to_font_shaping(mod_font_shaping) : inherited.font_shaping,
+                .foreground = mod_foreground != NULL
+                    ? conf_to_color(mod_foreground) : inherited.foreground,
+            };
+
+            bench_module(&ctx, mods[i][idx], mod_node, mod_inherit,
+                         locations[i], idx);
+
+            /* Leave an exposable behind, for bar_calculate_widths() */
+            exps[i][idx] = module_begin_expose(mods[i][idx]);
+            fcft_destroy(font);
+        }
+    }
+
+    struct samples *widths = samples_get("bar: calculate_widths");
+    for (size_t i = 0; i < iterations; i++) {
+        int left, center, right;
+
+        uint64_t t0 = now_ns();
+        bar_calculate_widths(b, &left, &center, &right);
+        uint64_t t1 = now_ns();
+
+        samples_add(widths, t1 - t0);
+    }
+
+    report();
+    ret = EXIT_SUCCESS;
+
+    fcft_destroy(font);
+    pixman_image_unref(pix);
+    bar->destroy(bar);
+    yml_destroy(conf);
+
+out:
+    samples_free_all();
+    fcft_fini();
+    log_deinit();
+    return ret;
+}
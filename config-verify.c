@@ -493,6 +493,7 @@ conf_verify_bar(const struct yml_node *bar)
         {"right", false, &verify_module_list},
 
         {"trackpad-sensitivity", false, &conf_verify_unsigned},
+        {"max-fps", false, &conf_verify_unsigned},
 
         {NULL, false, NULL},
     };
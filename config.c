@@ -379,6 +379,10 @@ conf_to_bar(const struct yml_node *bar, enum bar_backend backend)
         ? yml_value_as_int(trackpad_sensitivity)
         : 30;
 
+    const struct yml_node *max_fps = yml_get_value(bar, "max-fps");
+    if (max_fps != NULL)
+        conf.max_fps = yml_value_as_int(max_fps);
+
     const struct yml_node *border = yml_get_value(bar, "border");
     if (border != NULL) {
         const struct yml_node *width = yml_get_value(border, "width");
@@ -127,7 +127,7 @@ print_usage(const char *prog_name)
     printf("Usage: %s [OPTION]...\n", prog_name);
     printf("\n");
     printf("Options:\n");
-    printf("  -b,--backend={xcb,wayland,auto}          backend to use (default: auto)\n"
+    printf("  -b,--backend={xcb,wayland,headless,auto} backend to use (default: auto)\n"
            "  -c,--config=FILE                         alternative configuration file\n"
            "  -C,--validate                            verify configuration then quit\n"
            "  -p,--print-pid=FILE|FD                   print PID to file or FD\n"
@@ -212,6 +212,8 @@ main(int argc, char *const *argv)
                 backend = BAR_BACKEND_XCB;
             else if (strcmp(optarg, "wayland") == 0)
                 backend = BAR_BACKEND_WAYLAND;
+            else if (strcmp(optarg, "headless") == 0)
+                backend = BAR_BACKEND_HEADLESS;
             else {
                 fprintf(stderr, "%s: invalid backend\n", optarg);
                 return EXIT_FAILURE;
@@ -1,13 +1,28 @@
 #include "module.h"
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <sys/epoll.h>
+
+#include <tllist.h>
+
+#define LOG_MODULE "module"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+#include "bar/bar.h"
+
 struct module *
 module_common_new(void)
 {
     struct module *mod = calloc(1, sizeof(*mod));
     mtx_init(&mod->lock, mtx_plain);
+    atomic_init(&mod->dirty, true);
+    mod->arena = frame_arena_new();
     mod->destroy = &module_default_destroy;
     return mod;
 }
@@ -16,13 +31,506 @@ void
 module_default_destroy(struct module *mod)
 {
     mtx_destroy(&mod->lock);
+    frame_arena_destroy(mod->arena);
     free(mod);
 }
 
+static bool fixed_time_set = false;
+static struct timespec fixed_time;
+
+void
+module_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+    if (fixed_time_set) {
+        *ts = fixed_time;
+        return;
+    }
+
+    clock_gettime(clock, ts);
+}
+
+void
+module_set_fixed_time(time_t secs)
+{
+    fixed_time = (struct timespec){.tv_sec = secs};
+    fixed_time_set = true;
+}
+
 struct exposable *
 module_begin_expose(struct module *mod)
 {
+    struct frame_arena *prev = frame_arena_activate(mod->arena);
     struct exposable *e = mod->content(mod);
     e->begin_expose(e);
+    frame_arena_activate(prev);
     return e;
 }
+
+void
+module_end_expose(struct module *mod, struct exposable *e)
+{
+    struct frame_arena *prev = frame_arena_activate(mod->arena);
+    e->destroy(e);
+    frame_arena_activate(prev);
+    frame_arena_reset(mod->arena);
+}
+
+/*
+ * Shared module event loop
+ */
+
+struct loop_fd {
+    struct module *mod;
+    int fd;
+    module_fd_handler_t handler;
+    bool deleted;
+};
+
+/*
+ * A timer may fire anywhere in its window, [deadline, deadline +
+ * slack]. The loop wakes up as late as the earliest closing window
+ * allows, inside the intersection of all windows open by then
+ * (preferring round numbers), and fires every timer whose window has
+ * opened. Timers with overlapping windows are thus handled by a
+ * single wakeup.
+ */
+struct loop_timer {
+    struct module *mod;
+    bool armed;
+    uint64_t deadline;  /* CLOCK_MONOTONIC, milliseconds */
+    long interval_ms;
+    long slack_ms;      /* Negative: use the default */
+    module_timer_handler_t handler;
+};
+
+struct module_loop {
+    int epoll_fd;
+    int abort_fd;
+    int ret;
+
+    /* Set when a module signals a refresh from within the loop */
+    const struct bar *redraw;
+
+    struct {
+        uint64_t wakeups;
+        uint64_t timers_fired;
+    } stats;
+
+    tll(struct module *) mods;
+    tll(struct loop_fd *) fds;
+    tll(struct loop_timer) timers;
+};
+
+void
+module_signal_refresh(struct module *mod)
+{
+    atomic_store(&mod->dirty, true);
+
+    /*
+     * Modules on the shared event loop only ever call this from the
+     * loop's thread; their redraws are merged, and issued once the
+     * current batch of events and timers has been handled.
+     */
+    if (mod->loop != NULL)
+        mod->loop->redraw = mod->bar;
+    else
+        mod->bar->redraw(mod->bar);
+}
+
+struct module_loop *
+module_loop_new(int abort_fd)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        LOG_ERRNO("failed to create epoll FD");
+        return NULL;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data = {.ptr = NULL}};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, abort_fd, &ev) < 0) {
+        LOG_ERRNO("failed to add abort FD to epoll");
+        close(epoll_fd);
+        return NULL;
+    }
+
+    struct module_loop *loop = calloc(1, sizeof(*loop));
+    loop->epoll_fd = epoll_fd;
+    loop->abort_fd = abort_fd;
+    return loop;
+}
+
+void
+module_loop_destroy(struct module_loop *loop)
+{
+    if (loop == NULL)
+        return;
+
+    tll_free(loop->mods);
+    tll_free_and_free(loop->fds, free);
+    tll_free(loop->timers);
+    close(loop->epoll_fd);
+    free(loop);
+}
+
+void
+module_loop_add_module(struct module_loop *loop, struct module *mod)
+{
+    assert(mod->setup != NULL);
+    mod->loop = loop;
+    tll_push_back(loop->mods, mod);
+}
+
+size_t
+module_loop_module_count(const struct module_loop *loop)
+{
+    return tll_length(loop->mods);
+}
+
+bool
+module_add_fd(struct module *mod, int fd, int events,
+              module_fd_handler_t handler)
+{
+    struct module_loop *loop = mod->loop;
+    assert(loop != NULL);
+
+    struct loop_fd *lfd = malloc(sizeof(*lfd));
+    *lfd = (struct loop_fd){.mod = mod, .fd = fd, .handler = handler};
+
+    struct epoll_event ev = {.events = events, .data = {.ptr = lfd}};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG_ERRNO("%s: failed to add FD=%d to epoll", mod->description(mod), fd);
+        free(lfd);
+        return false;
+    }
+
+    tll_push_back(loop->fds, lfd);
+    return true;
+}
+
+static void
+del_fd(struct module_loop *loop, struct loop_fd *lfd)
+{
+    if (lfd->deleted)
+        return;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, lfd->fd, NULL) < 0)
+        LOG_ERRNO("failed to remove FD=%d from epoll", lfd->fd);
+
+    /* Freed by the loop, once the current batch of events is done */
+    lfd->deleted = true;
+}
+
+void
+module_del_fd(struct module *mod, int fd)
+{
+    tll_foreach(mod->loop->fds, it) {
+        if (it->item->mod == mod && it->item->fd == fd && !it->item->deleted) {
+            del_fd(mod->loop, it->item);
+            return;
+        }
+    }
+}
+
+static struct loop_timer *
+timer_for_module(struct module_loop *loop, const struct module *mod)
+{
+    tll_foreach(loop->timers, it) {
+        if (it->item.mod == mod)
+            return &it->item;
+    }
+    return NULL;
+}
+
+static struct loop_timer *
+get_timer(struct module *mod)
+{
+    struct module_loop *loop = mod->loop;
+    assert(loop != NULL);
+
+    struct loop_timer *timer = timer_for_module(loop, mod);
+    if (timer == NULL) {
+        tll_push_back(
+            loop->timers, ((struct loop_timer){.mod = mod, .slack_ms = -1}));
+        timer = &tll_back(loop->timers);
+    }
+
+    return timer;
+}
+
+static bool
+now_ms(uint64_t *now)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        LOG_ERRNO("failed to get current time");
+        return false;
+    }
+
+    *now = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    return true;
+}
+
+static long
+timer_slack(const struct loop_timer *timer)
+{
+    if (timer->slack_ms >= 0)
+        return timer->slack_ms;
+
+    /* Periodic timers may be late by 10%, one-shot timers not at all */
+    return timer->interval_ms / 10;
+}
+
+bool
+module_set_timer(struct module *mod, long timeout_ms, long interval_ms,
+                 module_timer_handler_t handler)
+{
+    assert(timeout_ms >= 0 && interval_ms >= 0);
+
+    struct loop_timer *timer = get_timer(mod);
+
+    uint64_t now;
+    if (!now_ms(&now)) {
+        timer->armed = false;
+        return false;
+    }
+
+    uint64_t deadline = now + timeout_ms;
+
+    /*
+     * Put periodic timers in phase with each other, by aligning their
+     * first deadline to a multiple of the interval (or whole seconds,
+     * for longer intervals). Modules polling at the same, or at
+     * related, intervals then wake up together.
+     */
+    if (interval_ms > 0) {
+        const uint64_t align = interval_ms < 1000 ? interval_ms : 1000;
+        deadline = (deadline + align - 1) / align * align;
+    }
+
+    timer->deadline = deadline;
+    timer->interval_ms = interval_ms;
+    timer->handler = handler;
+    timer->armed = true;
+    return true;
+}
+
+void
+module_set_timer_slack(struct module *mod, long slack_ms)
+{
+    get_timer(mod)->slack_ms = slack_ms;
+}
+
+void
+module_cancel_timer(struct module *mod)
+{
+    struct loop_timer *timer = timer_for_module(mod->loop, mod);
+    if (timer != NULL)
+        timer->armed = false;
+}
+
+static void
+stop_module(struct module_loop *loop, struct module *mod)
+{
+    LOG_ERR("%s: stopped due to an error", mod->description(mod));
+
+    tll_foreach(loop->fds, it) {
+        if (it->item->mod == mod)
+            del_fd(loop, it->item);
+    }
+
+    module_cancel_timer(mod);
+    loop->ret = 1;
+}
+
+/*
+ * Latest time in [earliest, latest] that is a multiple of as coarse a
+ * unit as possible
+ */
+static uint64_t
+wakeup_between(uint64_t earliest, uint64_t latest)
+{
+    static const uint64_t units[] = {1000, 250, 100, 10};
+
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        const uint64_t t = latest / units[i] * units[i];
+        if (t >= earliest)
+            return t;
+    }
+
+    return latest;
+}
+
+/*
+ * Next wakeup: the earliest closing window bounds it from above, and
+ * the latest deadline before that from below. Returns false if no
+ * timer is armed.
+ */
+static bool
+next_wakeup(const struct module_loop *loop, uint64_t *wakeup)
+{
+    bool have_wakeup = false;
+    uint64_t latest = 0;
+
+    tll_foreach(loop->timers, it) {
+        const struct loop_timer *timer = &it->item;
+        if (!timer->armed)
+            continue;
+
+        const uint64_t end = timer->deadline + timer_slack(timer);
+        if (!have_wakeup || end < latest) {
+            latest = end;
+            have_wakeup = true;
+        }
+    }
+
+    if (!have_wakeup)
+        return false;
+
+    uint64_t earliest = 0;
+
+    tll_foreach(loop->timers, it) {
+        const struct loop_timer *timer = &it->item;
+        if (timer->armed && timer->deadline <= latest && timer->deadline > earliest)
+            earliest = timer->deadline;
+    }
+
+    *wakeup = wakeup_between(earliest, latest);
+    return true;
+}
+
+/* Milliseconds until the next wakeup, or -1 if no timer is armed */
+static int
+next_timeout(const struct module_loop *loop, uint64_t now)
+{
+    uint64_t wakeup;
+    if (!next_wakeup(loop, &wakeup))
+        return -1;
+
+    return wakeup > now ? wakeup - now : 0;
+}
+
+static void
+run_expired_timers(struct module_loop *loop, uint64_t now)
+{
+    bool fired = false;
+
+    tll_foreach(loop->timers, it) {
+        struct loop_timer *timer = &it->item;
+
+        /* Window not yet open. Open, or already closed (we're late): fire */
+        if (!timer->armed || timer->deadline > now)
+            continue;
+
+        if (timer->interval_ms > 0) {
+            timer->deadline += timer->interval_ms;
+
+            /* Don't try to catch up on missed expirations */
+            if (timer->deadline <= now) {
+                timer->deadline +=
+                    (now - timer->deadline) / timer->interval_ms * timer->interval_ms +
+                    timer->interval_ms;
+            }
+        } else
+            timer->armed = false;
+
+        fired = true;
+        loop->stats.timers_fired++;
+
+        /* Note: the handler may re-arm the timer */
+        if (!timer->handler(timer->mod))
+            stop_module(loop, timer->mod);
+    }
+
+    if (fired)
+        loop->stats.wakeups++;
+}
+
+static void
+purge_deleted_fds(struct module_loop *loop)
+{
+    tll_foreach(loop->fds, it) {
+        if (it->item->deleted) {
+            free(it->item);
+            tll_remove(loop->fds, it);
+        }
+    }
+}
+
+static void
+flush_redraw(struct module_loop *loop)
+{
+    if (loop->redraw == NULL)
+        return;
+
+    loop->redraw->redraw(loop->redraw);
+    loop->redraw = NULL;
+}
+
+int
+module_loop_run(struct module_loop *loop)
+{
+    tll_foreach(loop->mods, it) {
+        struct module *mod = it->item;
+        if (!mod->setup(mod))
+            stop_module(loop, mod);
+    }
+
+    flush_redraw(loop);
+
+    while (true) {
+        uint64_t now;
+        if (!now_ms(&now)) {
+            loop->ret = 1;
+            break;
+        }
+
+        struct epoll_event events[16];
+        int count = epoll_wait(
+            loop->epoll_fd, events, sizeof(events) / sizeof(events[0]),
+            next_timeout(loop, now));
+
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+
+            LOG_ERRNO("failed to wait for events");
+            loop->ret = 1;
+            break;
+        }
+
+        bool aborted = false;
+        for (int i = 0; i < count; i++) {
+            struct loop_fd *lfd = events[i].data.ptr;
+
+            if (lfd == NULL) {
+                aborted = true;
+                continue;
+            }
+
+            /* May have been removed by a previous handler */
+            if (lfd->deleted)
+                continue;
+
+            if (!lfd->handler(lfd->mod, lfd->fd, events[i].events))
+                stop_module(loop, lfd->mod);
+        }
+
+        if (aborted)
+            break;
+
+        if (!now_ms(&now)) {
+            loop->ret = 1;
+            break;
+        }
+
+        run_expired_timers(loop, now);
+        purge_deleted_fds(loop);
+
+        /* One redraw for everything that changed in this iteration */
+        flush_redraw(loop);
+    }
+
+    LOG_DBG("timer wakeups: %"PRIu64", timers fired: %"PRIu64,
+            loop->stats.wakeups, loop->stats.timers_fired);
+    return loop->ret;
+}
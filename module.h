@@ -1,10 +1,25 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <threads.h>
+#include <time.h>
 
+#include "arena.h"
 #include "particle.h"
 
 struct bar;
+struct module;
+struct module_loop;
+
+/*
+ * Handlers for file descriptors and timers registered with the shared
+ * module event loop. 'events' is a mask of EPOLLIN, EPOLLHUP etc.
+ *
+ * Returning false stops the module: all its file descriptors and
+ * timers are unregistered, and the bar logs an error.
+ */
+typedef bool (*module_fd_handler_t)(struct module *mod, int fd, int events);
+typedef bool (*module_timer_handler_t)(struct module *mod);
 
 struct module {
     const struct bar *bar;
@@ -12,9 +27,34 @@ struct module {
     int abort_fd;
     mtx_t lock;
 
+    /*
+     * Set by module_signal_refresh(), cleared by the bar when it
+     * re-creates the module's exposable. A module that has not been
+     * signalled keeps its previous exposable.
+     */
+    atomic_bool dirty;
+
+    /* Backs the current exposable, and the tags it was created from */
+    struct frame_arena *arena;
+
     void *private;
 
+    /*
+     * A module implements either run() or setup().
+     *
+     * run() is executed in a thread of its own, and should return
+     * when abort_fd becomes readable.
+     *
+     * setup() is called from the shared module event loop thread,
+     * and registers file descriptors and timers with it (see
+     * module_add_fd() and module_set_timer()). It should not block.
+     * All handlers are called from the same thread. Resources are
+     * released in destroy(), after the loop has terminated.
+     */
     int (*run)(struct module *mod);
+    bool (*setup)(struct module *mod);
+    struct module_loop *loop;
+
     void (*destroy)(struct module *module);
 
     /*
@@ -32,7 +72,68 @@ struct module {
 
 struct module *module_common_new(void);
 void module_default_destroy(struct module *mod);
+
+/*
+ * Instantiates the module's content, allocating from its frame
+ * arena. The exposable must be destroyed with module_end_expose(),
+ * which also releases the arena, before the next call.
+ */
 struct exposable *module_begin_expose(struct module *mod);
+void module_end_expose(struct module *mod, struct exposable *e);
+
+/*
+ * Marks the module's content as changed, and asks the bar to redraw.
+ * For modules on the shared event loop, the redraw is deferred until
+ * all pending events and timers have been handled.
+ */
+void module_signal_refresh(struct module *mod);
+
+/*
+ * Current time, as presented by modules (e.g. the clock module, and
+ * realtime tags). Same as clock_gettime(), unless pinned by
+ * module_set_fixed_time(). Not for scheduling; timers always run on
+ * the real clock.
+ */
+void module_clock_gettime(clockid_t clock, struct timespec *ts);
+
+/*
+ * Pins the time returned by module_clock_gettime(), for all clocks, to
+ * 'secs' seconds. Used by the headless backend, to make rendering
+ * deterministic. Must be called before any module is started.
+ */
+void module_set_fixed_time(time_t secs);
+
+/*
+ * Shared module event loop. May only be called from setup(), or from
+ * a handler.
+ */
+bool module_add_fd(struct module *mod, int fd, int events,
+                   module_fd_handler_t handler);
+void module_del_fd(struct module *mod, int fd);
+
+/*
+ * Arms the module's timer: it first fires after 'timeout_ms', and then
+ * every 'interval_ms'. An interval of 0 makes it a one-shot timer.
+ * Re-arming replaces the previous timeout.
+ */
+bool module_set_timer(struct module *mod, long timeout_ms, long interval_ms,
+                      module_timer_handler_t handler);
+
+/*
+ * How late the timer may fire, allowing the loop to batch it with
+ * other timers into a single wakeup. Periodic timers default to 10%
+ * of their interval, and their deadlines are aligned to a common
+ * phase. One-shot timers default to no slack.
+ */
+void module_set_timer_slack(struct module *mod, long slack_ms);
+void module_cancel_timer(struct module *mod);
+
+/* Used by the bar to drive the loop */
+struct module_loop *module_loop_new(int abort_fd);
+void module_loop_destroy(struct module_loop *loop);
+void module_loop_add_module(struct module_loop *loop, struct module *mod);
+size_t module_loop_module_count(const struct module_loop *loop);
+int module_loop_run(struct module_loop *loop);
 
 /* List of attributes *all* modules implement */
 #define MODULE_COMMON_ATTRS                        \
@@ -284,7 +284,7 @@ update_state(struct module *mod, snd_mixer_elem_t *elem)
     m->online = true;
 
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 
 enum run_state {
@@ -483,7 +483,7 @@ run_while_online(struct module *mod)
         m->muted_chan->muted ? " (muted)" : "",
         m->volume_chan->name, m->muted_chan->name);
 
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 
     while (true) {
         int fd_count = snd_mixer_poll_descriptors_count(handle);
@@ -515,7 +515,7 @@ run_while_online(struct module *mod)
                 mtx_lock(&mod->lock);
                 m->online = false;
                 mtx_unlock(&mod->lock);
-                mod->bar->refresh(mod->bar);
+                module_signal_refresh(mod);
 
                 ret = RUN_DISCONNECTED;
                 goto err;
@@ -5,8 +5,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <errno.h>
-#include <poll.h>
 
+#include <sys/epoll.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
@@ -25,12 +25,24 @@ struct private {
     char *device;
     long max_brightness;
     long current_brightness;
+
+    int current_fd;
+    struct udev *udev;
+    struct udev_monitor *mon;
 };
 
 static void
 destroy(struct module *mod)
 {
     struct private *m = mod->private;
+
+    if (m->mon != NULL)
+        udev_monitor_unref(m->mon);
+    if (m->udev != NULL)
+        udev_unref(m->udev);
+    if (m->current_fd >= 0)
+        close(m->current_fd);
+
     free(m->device);
 
     m->label->destroy(m->label);
@@ -151,75 +163,54 @@ initialize(struct private *m)
     return current_fd;
 }
 
-static int
-run(struct module *mod)
+static bool
+on_udev(struct module *mod, int fd, int events)
 {
-    const struct bar *bar = mod->bar;
     struct private *m = mod->private;
 
-    int current_fd = initialize(m);
-    if (current_fd == -1)
-        return 1;
+    if (!(events & EPOLLIN))
+        return false;
 
-    struct udev *udev = udev_new();
-    struct udev_monitor *mon = udev_monitor_new_from_netlink(udev, "udev");
+    struct udev_device *dev = udev_monitor_receive_device(m->mon);
+    if (dev == NULL)
+        return true;
 
-    if (udev == NULL || mon == NULL) {
-        LOG_ERR("failed to initialize udev monitor");
+    const char *sysname = udev_device_get_sysname(dev);
+    bool is_us = sysname != NULL && strcmp(sysname, m->device) == 0;
+    udev_device_unref(dev);
 
-        if (udev == NULL)
-            udev_unref(udev);
+    if (!is_us)
+        return true;
 
-        close(current_fd);
-        return 1;
-    }
+    mtx_lock(&mod->lock);
+    m->current_brightness = readint_from_fd(m->current_fd);
+    mtx_unlock(&mod->lock);
+    module_signal_refresh(mod);
+    return true;
+}
+
+static bool
+setup(struct module *mod)
+{
+    struct private *m = mod->private;
 
-    udev_monitor_filter_add_match_subsystem_devtype(mon, "backlight", NULL);
-    udev_monitor_enable_receiving(mon);
-
-    bar->refresh(bar);
-
-    int ret = 1;
-    while (true) {
-        struct pollfd fds[] = {
-            {.fd = mod->abort_fd, .events = POLLIN},
-            {.fd = udev_monitor_get_fd(mon), .events = POLLIN},
-        };
-        if (poll(fds, sizeof(fds) / sizeof(fds[0]), -1) < 0) {
-            if (errno == EINTR)
-                continue;
-
-            LOG_ERRNO("failed to poll");
-            break;
-        }
-
-        if (fds[0].revents & POLLIN) {
-            ret = 0;
-            break;
-        }
-
-        struct udev_device *dev = udev_monitor_receive_device(mon);
-        if (dev == NULL)
-            continue;
-
-        const char *sysname = udev_device_get_sysname(dev);
-        bool is_us = sysname != NULL && strcmp(sysname, m->device) == 0;
-        udev_device_unref(dev);
-
-        if (!is_us)
-            continue;
-
-        mtx_lock(&mod->lock);
-        m->current_brightness = readint_from_fd(current_fd);
-        mtx_unlock(&mod->lock);
-        bar->refresh(bar);
+    m->current_fd = initialize(m);
+    if (m->current_fd == -1)
+        return false;
+
+    m->udev = udev_new();
+    m->mon = udev_monitor_new_from_netlink(m->udev, "udev");
+
+    if (m->udev == NULL || m->mon == NULL) {
+        LOG_ERR("failed to initialize udev monitor");
+        return false;
     }
 
-    udev_monitor_unref(mon);
-    udev_unref(udev);
+    udev_monitor_filter_add_match_subsystem_devtype(m->mon, "backlight", NULL);
+    udev_monitor_enable_receiving(m->mon);
 
-    close(current_fd);
-    return ret;
+    module_signal_refresh(mod);
+    return module_add_fd(mod, udev_monitor_get_fd(m->mon), EPOLLIN, &on_udev);
 }
 
 static struct module *
@@ -228,10 +219,11 @@ backlight_new(const char *device, struct particle *label)
     struct private *m = calloc(1, sizeof(*m));
     m->label = label;
     m->device = strdup(device);
+    m->current_fd = -1;
 
     struct module *mod = module_common_new();
     mod->private = m;
-    mod->run = &run;
+    mod->setup = &setup;
     mod->destroy = &destroy;
     mod->content = &content;
     mod->description = &description;
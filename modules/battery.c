@@ -6,7 +6,7 @@
 #include <assert.h>
 #include <errno.h>
 
-#include <poll.h>
+#include <sys/epoll.h>
 
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -21,18 +21,37 @@
 #include "../config-verify.h"
 #include "../plugin.h"
 
-#define max(x, y) ((x) > (y) ? (x) : (y))
-
 static const long min_poll_interval = 250;
 static const long default_poll_interval = 60 * 1000;
 
 enum state { STATE_FULL, STATE_NOTCHARGING, STATE_CHARGING, STATE_DISCHARGING, STATE_UNKNOWN };
 
-struct private {
-    struct particle *label;
+/* Attributes re-read on every update */
+enum attr {
+    ATTR_STATUS,
+    ATTR_CAPACITY,
+    ATTR_ENERGY_NOW,
+    ATTR_POWER_NOW,
+    ATTR_CHARGE_NOW,
+    ATTR_CURRENT_NOW,
+    ATTR_TIME_TO_EMPTY_NOW,
+    ATTR_TIME_TO_FULL_NOW,
+    ATTR_COUNT,
+};
 
-    long poll_interval;
-    char *battery;
+static const char *const attr_names[ATTR_COUNT] = {
+    [ATTR_STATUS] = "status",
+    [ATTR_CAPACITY] = "capacity",
+    [ATTR_ENERGY_NOW] = "energy_now",
+    [ATTR_POWER_NOW] = "power_now",
+    [ATTR_CHARGE_NOW] = "charge_now",
+    [ATTR_CURRENT_NOW] = "current_now",
+    [ATTR_TIME_TO_EMPTY_NOW] = "time_to_empty_now",
+    [ATTR_TIME_TO_FULL_NOW] = "time_to_full_now",
+};
+
+struct battery {
+    char *name;
     char *manufacturer;
     char *model;
     long energy_full_design;
@@ -40,6 +59,15 @@ struct private {
     long charge_full_design;
     long charge_full;
 
+    /*
+     * The attributes are opened once, and re-read with pread(). They
+     * are closed when the battery is removed, and re-opened when it
+     * is added back (see on_udev()). -1 if the battery doesn't have
+     * the attribute.
+     */
+    bool present;
+    int fds[ATTR_COUNT];
+
     enum state state;
     long capacity;
     long energy;
@@ -50,29 +78,50 @@ struct private {
     long time_to_full;
 };
 
-static void
-timespec_sub(const struct timespec *a, const struct timespec *b,
-             struct timespec *res)
-{
-    const long one_sec_in_ns = 1000000000;
+struct private {
+    struct particle *label;
 
-    res->tv_sec = a->tv_sec - b->tv_sec;
-    res->tv_nsec = a->tv_nsec - b->tv_nsec;
+    long poll_interval;
+    struct battery *batteries;
+    size_t count;
+    char *names;  /* All batteries' names, joined by '+' */
+
+    struct udev *udev;
+    struct udev_monitor *mon;
+};
 
-    /* tv_nsec may be negative */
-    if (res->tv_nsec < 0) {
-        res->tv_sec--;
-        res->tv_nsec += one_sec_in_ns;
+static void
+battery_close(struct battery *bat)
+{
+    for (size_t i = 0; i < ATTR_COUNT; i++) {
+        if (bat->fds[i] >= 0)
+            close(bat->fds[i]);
+        bat->fds[i] = -1;
     }
+
+    bat->present = false;
 }
 
 static void
 destroy(struct module *mod)
 {
     struct private *m = mod->private;
-    free(m->battery);
-    free(m->manufacturer);
-    free(m->model);
+
+    if (m->mon != NULL)
+        udev_monitor_unref(m->mon);
+    if (m->udev != NULL)
+        udev_unref(m->udev);
+
+    for (size_t i = 0; i < m->count; i++) {
+        struct battery *bat = &m->batteries[i];
+        battery_close(bat);
+        free(bat->name);
+        free(bat->manufacturer);
+        free(bat->model);
+    }
+
+    free(m->batteries);
+    free(m->names);
 
     m->label->destroy(m->label);
 
@@ -85,17 +134,114 @@ description(const struct module *mod)
 {
     static char desc[32];
     const struct private *m = mod->private;
-    snprintf(desc, sizeof(desc), "bat(%s)", m->battery);
+    snprintf(desc, sizeof(desc), "bat(%s)", m->names);
     return desc;
 }
 
+/*
+ * Combines all present batteries into one. A single battery is used
+ * as-is. Otherwise, energies, charges and rates are summed, and the
+ * capacity derived from the sums; the kernel's time estimates are
+ * per battery, and are not used.
+ */
+static void
+aggregate(const struct private *m, struct battery *total)
+{
+    const struct battery *present[m->count > 0 ? m->count : 1];
+    size_t count = 0;
+
+    for (size_t i = 0; i < m->count; i++) {
+        if (m->batteries[i].present)
+            present[count++] = &m->batteries[i];
+    }
+
+    *total = (struct battery){
+        .name = m->names,
+        .state = STATE_UNKNOWN,
+        .energy_full = -1,
+        .charge_full = -1,
+        .energy = -1,
+        .power = -1,
+        .charge = -1,
+        .current = -1,
+        .time_to_empty = -1,
+        .time_to_full = -1,
+    };
+
+    if (count == 0)
+        return;
+
+    if (count == 1) {
+        *total = *present[0];
+        total->name = m->names;
+        return;
+    }
+
+    total->manufacturer = present[0]->manufacturer;
+    total->model = present[0]->model;
+
+    bool have_energy = true, have_charge = true;
+    bool any_charging = false, any_discharging = false;
+    bool all_full = true, all_idle = true;
+    long capacity_sum = 0;
+
+    total->energy_full = total->energy = total->power = 0;
+    total->charge_full = total->charge = total->current = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const struct battery *bat = present[i];
+
+        have_energy = have_energy &&
+            bat->energy_full > 0 && bat->energy >= 0 && bat->power >= 0;
+        have_charge = have_charge &&
+            bat->charge_full > 0 && bat->charge >= 0 && bat->current >= 0;
+
+        total->energy_full += bat->energy_full;
+        total->energy += bat->energy;
+        total->power += bat->power;
+        total->charge_full += bat->charge_full;
+        total->charge += bat->charge;
+        total->current += bat->current;
+        capacity_sum += bat->capacity;
+
+        any_charging = any_charging || bat->state == STATE_CHARGING;
+        any_discharging = any_discharging || bat->state == STATE_DISCHARGING;
+        all_full = all_full && bat->state == STATE_FULL;
+        all_idle = all_idle &&
+            (bat->state == STATE_FULL || bat->state == STATE_NOTCHARGING);
+    }
+
+    if (have_energy)
+        total->capacity = 100 * total->energy / total->energy_full;
+    else if (have_charge)
+        total->capacity = 100 * total->charge / total->charge_full;
+    else
+        total->capacity = capacity_sum / count;
+
+    if (!have_energy)
+        total->energy_full = total->energy = total->power = -1;
+    if (!have_charge)
+        total->charge_full = total->charge = total->current = -1;
+
+    total->state =
+        any_charging ? STATE_CHARGING :
+        any_discharging ? STATE_DISCHARGING :
+        all_full ? STATE_FULL :
+        all_idle ? STATE_NOTCHARGING :
+        STATE_UNKNOWN;
+}
+
 static struct exposable *
 content(struct module *mod)
 {
-    const struct private *m = mod->private;
+    const struct private *p = mod->private;
 
     mtx_lock(&mod->lock);
 
+    struct battery total;
+    aggregate(p, &total);
+    const struct battery *m = &total;
+
     assert(m->state == STATE_FULL ||
            m->state == STATE_NOTCHARGING ||
            m->state == STATE_CHARGING ||
@@ -151,7 +297,7 @@ content(struct module *mod)
 
     struct tag_set tags = {
         .tags = (struct tag *[]){
-            tag_new_string(mod, "name", m->battery),
+            tag_new_string(mod, "name", m->name),
             tag_new_string(mod, "manufacturer", m->manufacturer),
             tag_new_string(mod, "model", m->model),
             tag_new_string(mod, "state",
@@ -168,7 +314,7 @@ content(struct module *mod)
 
     mtx_unlock(&mod->lock);
 
-    struct exposable *exposable = m->label->instantiate(m->label, &tags);
+    struct exposable *exposable = p->label->instantiate(p->label, &tags);
 
     tag_set_destroy(&tags);
     return exposable;
@@ -177,8 +323,7 @@ content(struct module *mod)
 static const char *
 readline_from_fd(int fd, size_t sz, char buf[static sz])
 {
-    ssize_t bytes = read(fd, buf, sz - 1);
-    lseek(fd, 0, SEEK_SET);
+    ssize_t bytes = pread(fd, buf, sz - 1, 0);
 
     if (bytes < 0) {
         LOG_WARN("failed to read from FD=%d", fd);
@@ -210,106 +355,117 @@ readint_from_fd(int fd)
     return ret;
 }
 
-static bool
-initialize(struct private *m)
+static char *
+readstr_at(int base_dir_fd, const char *battery, const char *attr)
 {
+    int fd = openat(base_dir_fd, attr, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        LOG_WARN("/sys/class/power_supply/%s/%s: %s",
+                 battery, attr, strerror(errno));
+        return NULL;
+    }
+
     char line_buf[512];
+    const char *line = readline_from_fd(fd, sizeof(line_buf), line_buf);
+    close(fd);
+
+    return line != NULL ? strdup(line) : NULL;
+}
+
+static bool
+readint_at(int base_dir_fd, const char *battery, const char *attr, long *value)
+{
+    int fd = openat(base_dir_fd, attr, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        LOG_ERRNO("/sys/class/power_supply/%s/%s", battery, attr);
+        return false;
+    }
+
+    *value = readint_from_fd(fd);
+    close(fd);
+    return true;
+}
 
-    int pw_fd = open("/sys/class/power_supply", O_RDONLY);
+/*
+ * Reads the battery's static attributes, and opens the ones re-read
+ * on each update. Called at startup, and when the battery is added
+ * back after having been removed. Must be called with the module
+ * lock held.
+ */
+static bool
+battery_open(struct battery *bat)
+{
+    assert(!bat->present);
+
+    int pw_fd = open("/sys/class/power_supply", O_RDONLY | O_CLOEXEC);
     if (pw_fd < 0) {
         LOG_ERRNO("/sys/class/power_supply");
         return false;
     }
 
-    int base_dir_fd = openat(pw_fd, m->battery, O_RDONLY);
+    int base_dir_fd = openat(pw_fd, bat->name, O_RDONLY | O_CLOEXEC);
     close(pw_fd);
 
     if (base_dir_fd < 0) {
-        LOG_ERRNO("/sys/class/power_supply/%s", m->battery);
+        LOG_ERRNO("/sys/class/power_supply/%s", bat->name);
         return false;
     }
 
-    {
-        int fd = openat(base_dir_fd, "manufacturer", O_RDONLY);
-        if (fd == -1) {
-            LOG_WARN("/sys/class/power_supply/%s/manufacturer: %s",
-                     m->battery, strerror(errno));
-            m->manufacturer = NULL;
-        } else {
-            m->manufacturer = strdup(readline_from_fd(fd, sizeof(line_buf), line_buf));
-            close(fd);
-        }
-    }
-
-    {
-        int fd = openat(base_dir_fd, "model_name", O_RDONLY);
-        if (fd == -1) {
-            LOG_WARN("/sys/class/power_supply/%s/model_name: %s",
-                     m->battery, strerror(errno));
-            m->model = NULL;
-        } else {
-            m->model = strdup(readline_from_fd(fd, sizeof(line_buf), line_buf));
-            close(fd);
-        }
-    }
+    free(bat->manufacturer);
+    free(bat->model);
+    bat->manufacturer = readstr_at(base_dir_fd, bat->name, "manufacturer");
+    bat->model = readstr_at(base_dir_fd, bat->name, "model_name");
 
     if (faccessat(base_dir_fd, "energy_full_design", O_RDONLY, 0) == 0 &&
         faccessat(base_dir_fd, "energy_full", O_RDONLY, 0) == 0)
     {
+        if (!readint_at(base_dir_fd, bat->name, "energy_full_design",
+                        &bat->energy_full_design) ||
+            !readint_at(base_dir_fd, bat->name, "energy_full",
+                        &bat->energy_full))
         {
-            int fd = openat(base_dir_fd, "energy_full_design", O_RDONLY);
-            if (fd == -1) {
-                LOG_ERRNO("/sys/class/power_supply/%s/energy_full_design", m->battery);
-                goto err;
-            }
-
-            m->energy_full_design = readint_from_fd(fd);
-            close(fd);
-        }
-
-        {
-            int fd = openat(base_dir_fd, "energy_full", O_RDONLY);
-            if (fd == -1) {
-                LOG_ERRNO("/sys/class/power_supply/%s/energy_full", m->battery);
-                goto err;
-            }
-
-            m->energy_full = readint_from_fd(fd);
-            close(fd);
+            goto err;
         }
     } else {
-        m->energy_full = m->energy_full_design = -1;
+        bat->energy_full = bat->energy_full_design = -1;
     }
 
     if (faccessat(base_dir_fd, "charge_full_design", O_RDONLY, 0) == 0 &&
         faccessat(base_dir_fd, "charge_full", O_RDONLY, 0) == 0)
     {
+        if (!readint_at(base_dir_fd, bat->name, "charge_full_design",
+                        &bat->charge_full_design) ||
+            !readint_at(base_dir_fd, bat->name, "charge_full",
+                        &bat->charge_full))
         {
-            int fd = openat(base_dir_fd, "charge_full_design", O_RDONLY);
-            if (fd == -1) {
-                LOG_ERRNO("/sys/class/power_supply/%s/charge_full_design", m->battery);
-                goto err;
-            }
-
-            m->charge_full_design = readint_from_fd(fd);
-            close(fd);
+            goto err;
         }
+    } else {
+        bat->charge_full = bat->charge_full_design = -1;
+    }
 
-        {
-            int fd = openat(base_dir_fd, "charge_full", O_RDONLY);
-            if (fd == -1) {
-                LOG_ERRNO("/sys/class/power_supply/%s/charge_full", m->battery);
-                goto err;
-            }
-
-            m->charge_full = readint_from_fd(fd);
-            close(fd);
+    for (size_t i = 0; i < ATTR_COUNT; i++)
+        bat->fds[i] = openat(base_dir_fd, attr_names[i], O_RDONLY | O_CLOEXEC);
+
+    /* The only mandatory attributes */
+    for (size_t i = 0; i <= ATTR_CAPACITY; i++) {
+        if (bat->fds[i] < 0) {
+            LOG_ERRNO("/sys/class/power_supply/%s/%s", bat->name, attr_names[i]);
+            battery_close(bat);
+            goto err;
         }
-    } else {
-        m->charge_full = m->charge_full_design = -1;
     }
 
     close(base_dir_fd);
+    bat->present = true;
+
+    LOG_INFO("%s: %s %s (at %.1f%% of original capacity)",
+             bat->name, bat->manufacturer, bat->model,
+             (bat->energy_full > 0
+              ? 100.0 * bat->energy_full / bat->energy_full_design
+              : bat->charge_full > 0
+              ? 100.0 * bat->charge_full / bat->charge_full_design
+              : 0.0));
     return true;
 
 err:
@@ -317,81 +473,30 @@ err:
     return false;
 }
 
-static bool
-update_status(struct module *mod)
+static long
+readint_attr(const struct battery *bat, enum attr attr)
 {
-    struct private *m = mod->private;
-
-    int pw_fd = open("/sys/class/power_supply", O_RDONLY);
-    if (pw_fd < 0) {
-        LOG_ERRNO("/sys/class/power_supply");
-        return false;
-    }
-
-    int base_dir_fd = openat(pw_fd, m->battery, O_RDONLY);
-    close(pw_fd);
-
-    if (base_dir_fd < 0) {
-        LOG_ERRNO("/sys/class/power_supply/%s", m->battery);
-        return false;
-    }
-
-    int status_fd = openat(base_dir_fd, "status", O_RDONLY);
-    if (status_fd < 0) {
-        LOG_ERRNO("/sys/class/power_supply/%s/status", m->battery);
-        close(base_dir_fd);
-        return false;
-    }
-
-    int capacity_fd = openat(base_dir_fd, "capacity", O_RDONLY);
-    if (capacity_fd < 0) {
-        LOG_ERRNO("/sys/class/power_supply/%s/capacity", m->battery);
-        close(status_fd);
-        close(base_dir_fd);
-        return false;
-    }
+    return bat->fds[attr] >= 0 ? readint_from_fd(bat->fds[attr]) : -1;
+}
 
-    int energy_fd = openat(base_dir_fd, "energy_now", O_RDONLY);
-    int power_fd = openat(base_dir_fd, "power_now", O_RDONLY);
-    int charge_fd = openat(base_dir_fd, "charge_now", O_RDONLY);
-    int current_fd = openat(base_dir_fd, "current_now", O_RDONLY);
-    int time_to_empty_fd = openat(base_dir_fd, "time_to_empty_now", O_RDONLY);
-    int time_to_full_fd = openat(base_dir_fd, "time_to_full_now", O_RDONLY);
-
-    long capacity = readint_from_fd(capacity_fd);
-    long energy = energy_fd >= 0 ? readint_from_fd(energy_fd) : -1;
-    long power = power_fd >= 0 ? readint_from_fd(power_fd) : -1;
-    long charge = charge_fd >= 0 ? readint_from_fd(charge_fd) : -1;
-    long current = current_fd >= 0 ? readint_from_fd(current_fd) : -1;
-    long time_to_empty = time_to_empty_fd >= 0 ? readint_from_fd(time_to_empty_fd) : -1;
-    long time_to_full = time_to_full_fd >= 0 ? readint_from_fd(time_to_full_fd) : -1;
+static void
+update_battery(struct module *mod, struct battery *bat)
+{
+    long capacity = readint_attr(bat, ATTR_CAPACITY);
+    long energy = readint_attr(bat, ATTR_ENERGY_NOW);
+    long power = readint_attr(bat, ATTR_POWER_NOW);
+    long charge = readint_attr(bat, ATTR_CHARGE_NOW);
+    long current = readint_attr(bat, ATTR_CURRENT_NOW);
+    long time_to_empty = readint_attr(bat, ATTR_TIME_TO_EMPTY_NOW);
+    long time_to_full = readint_attr(bat, ATTR_TIME_TO_FULL_NOW);
 
     char buf[512];
-    const char *status = readline_from_fd(status_fd, sizeof(buf), buf);
-
-    if (status_fd >= 0)
-        close(status_fd);
-    if (capacity_fd >= 0)
-        close(capacity_fd);
-    if (energy_fd >= 0)
-        close(energy_fd);
-    if (power_fd >= 0)
-        close(power_fd);
-    if (charge_fd >= 0)
-        close(charge_fd);
-    if (current_fd >= 0)
-        close(current_fd);
-    if (time_to_empty_fd >= 0)
-        close(time_to_empty_fd);
-    if (time_to_full_fd >= 0)
-        close(time_to_full_fd);
-    if (base_dir_fd >= 0)
-        close(base_dir_fd);
+    const char *status = readline_from_fd(bat->fds[ATTR_STATUS], sizeof(buf), buf);
 
     enum state state;
 
     if (status == NULL) {
-        LOG_WARN("failed to read battery state");
+        LOG_WARN("%s: failed to read battery state", bat->name);
         state = STATE_UNKNOWN;
     } else if (strcmp(status, "Full") == 0)
         state = STATE_FULL;
@@ -404,161 +509,187 @@ update_status(struct module *mod)
     else if (strcmp(status, "Unknown") == 0)
         state = STATE_UNKNOWN;
     else {
-        LOG_ERR("unrecognized battery state: %s", status);
+        LOG_ERR("%s: unrecognized battery state: %s", bat->name, status);
         state = STATE_UNKNOWN;
     }
 
-    LOG_DBG("capacity: %ld, energy: %ld, power: %ld, charge=%ld, current=%ld, "
-            "time-to-empty: %ld, time-to-full: %ld", capacity, energy, power,
-            charge, current, time_to_empty, time_to_full);
+    LOG_DBG("%s: capacity: %ld, energy: %ld, power: %ld, charge=%ld, "
+            "current=%ld, time-to-empty: %ld, time-to-full: %ld", bat->name,
+            capacity, energy, power, charge, current, time_to_empty,
+            time_to_full);
 
     mtx_lock(&mod->lock);
-    m->state = state;
-    m->capacity = capacity;
-    m->energy = energy;
-    m->power = power;
-    m->charge = charge;
-    m->current = current;
-    m->time_to_empty = time_to_empty;
-    m->time_to_full = time_to_full;
+    bat->state = state;
+    bat->capacity = capacity;
+    bat->energy = energy;
+    bat->power = power;
+    bat->charge = charge;
+    bat->current = current;
+    bat->time_to_empty = time_to_empty;
+    bat->time_to_full = time_to_full;
     mtx_unlock(&mod->lock);
-    return true;
 }
 
-static int
-run(struct module *mod)
+static bool
+update_status(struct module *mod)
 {
-    const struct bar *bar = mod->bar;
     struct private *m = mod->private;
+    bool updated = false;
 
-    if (!initialize(m))
-        return -1;
+    for (size_t i = 0; i < m->count; i++) {
+        if (!m->batteries[i].present)
+            continue;
 
-    LOG_INFO("%s: %s %s (at %.1f%% of original capacity)",
-             m->battery, m->manufacturer, m->model,
-             (m->energy_full > 0
-              ? 100.0 * m->energy_full / m->energy_full_design
-              : m->charge_full > 0
-              ? 100.0 * m->charge_full / m->charge_full_design
-              : 0.0));
+        update_battery(mod, &m->batteries[i]);
+        updated = true;
+    }
 
-    int ret = 1;
+    return updated;
+}
+
+static bool
+on_timer(struct module *mod)
+{
+    if (update_status(mod))
+        module_signal_refresh(mod);
+    return true;
+}
 
-    struct udev *udev = udev_new();
-    struct udev_monitor *mon = udev_monitor_new_from_netlink(udev, "udev");
+static bool
+on_udev(struct module *mod, int fd, int events)
+{
+    struct private *m = mod->private;
 
-    if (udev == NULL || mon == NULL)
-        goto out;
+    if (!(events & EPOLLIN))
+        return false;
 
-    udev_monitor_filter_add_match_subsystem_devtype(mon, "power_supply", NULL);
-    udev_monitor_enable_receiving(mon);
+    struct udev_device *dev = udev_monitor_receive_device(m->mon);
+    if (dev == NULL)
+        return true;
 
-    if (!update_status(mod))
-        goto out;
+    const char *sysname = udev_device_get_sysname(dev);
+    const char *action = udev_device_get_action(dev);
 
-    bar->refresh(bar);
+    struct battery *bat = NULL;
+    for (size_t i = 0; sysname != NULL && i < m->count; i++) {
+        if (strcmp(sysname, m->batteries[i].name) == 0) {
+            bat = &m->batteries[i];
+            break;
+        }
+    }
 
-    int timeout_left_ms = m->poll_interval;
+    if (bat == NULL) {
+        LOG_DBG("udev notification not for us (%s)",
+                sysname != NULL ? sysname : "NULL");
+        udev_device_unref(dev);
+        return true;
+    }
 
-    while (true) {
-        struct pollfd fds[] = {
-            {.fd = mod->abort_fd, .events = POLLIN},
-            {.fd = udev_monitor_get_fd(mon), .events = POLLIN},
-        };
+    LOG_DBG("%s: triggering update due to udev notification (%s)",
+            bat->name, action != NULL ? action : "NULL");
+
+    /* The attribute files are gone, or are new ones; re-open them */
+    if (action != NULL && strcmp(action, "remove") == 0) {
+        mtx_lock(&mod->lock);
+        battery_close(bat);
+        mtx_unlock(&mod->lock);
+        LOG_INFO("%s: removed", bat->name);
+    } else if (action != NULL && strcmp(action, "add") == 0) {
+        mtx_lock(&mod->lock);
+        battery_close(bat);
+        battery_open(bat);
+        mtx_unlock(&mod->lock);
+    }
 
-        int timeout = m->poll_interval > 0 ? timeout_left_ms : -1;
+    udev_device_unref(dev);
 
-        struct timespec time_before_poll;
-        if (clock_gettime(CLOCK_BOOTTIME, &time_before_poll) < 0) {
-            LOG_ERRNO("failed to get current time");
-            break;
-        }
+    update_status(mod);
+    module_signal_refresh(mod);
 
-        const int poll_ret = poll(fds, sizeof(fds) / sizeof(fds[0]), timeout);
+    /* Restart the poll interval */
+    if (m->poll_interval > 0) {
+        LOG_DBG("resetting timeout to %ldms", m->poll_interval);
+        return module_set_timer(
+            mod, m->poll_interval, m->poll_interval, &on_timer);
+    }
 
-        if (poll_ret < 0) {
-            if (errno == EINTR)
-                continue;
+    return true;
+}
 
-            LOG_ERRNO("failed to poll");
-            break;
-        }
+static bool
+setup(struct module *mod)
+{
+    struct private *m = mod->private;
 
-        if (fds[0].revents & POLLIN) {
-            ret = 0;
-            break;
-        }
+    /* Batteries that are missing now may be added later */
+    size_t present = 0;
 
-        bool udev_for_us = false;
+    mtx_lock(&mod->lock);
+    for (size_t i = 0; i < m->count; i++)
+        present += battery_open(&m->batteries[i]);
+    mtx_unlock(&mod->lock);
 
-        if (fds[1].revents & POLLIN) {
-            struct udev_device *dev = udev_monitor_receive_device(mon);
-            if (dev != NULL) {
-                const char *sysname = udev_device_get_sysname(dev);
-                udev_for_us =
-                    sysname != NULL && strcmp(sysname, m->battery) == 0;
+    if (present == 0)
+        return false;
 
-                if (!udev_for_us) {
-                    LOG_DBG("udev notification not for us (%s != %s)",
-                            m->battery, sysname != sysname ? sysname : "NULL");
-                } else
-                    LOG_DBG("triggering update due to udev notification");
+    m->udev = udev_new();
+    m->mon = udev_monitor_new_from_netlink(m->udev, "udev");
 
-                udev_device_unref(dev);
-            }
-        }
+    if (m->udev == NULL || m->mon == NULL)
+        return false;
 
-        if (udev_for_us || poll_ret == 0) {
-            if (update_status(mod))
-                bar->refresh(bar);
-        }
+    udev_monitor_filter_add_match_subsystem_devtype(m->mon, "power_supply", NULL);
+    udev_monitor_enable_receiving(m->mon);
 
-        if (poll_ret == 0 || udev_for_us) {
-            LOG_DBG("resetting timeout-left to %ldms", m->poll_interval);
-            timeout_left_ms = m->poll_interval;
-        } else {
-            struct timespec time_after_poll;
-            if (clock_gettime(CLOCK_BOOTTIME, &time_after_poll) < 0) {
-                LOG_ERRNO("failed to get current time");
-                break;
-            }
-
-            struct timespec timeout_consumed;
-            timespec_sub(&time_after_poll, &time_before_poll, &timeout_consumed);
-
-            const int timeout_consumed_ms =
-                timeout_consumed.tv_sec * 1000 + timeout_consumed.tv_nsec / 1000000;
-
-            LOG_DBG("timeout-left before: %dms, consumed: %dms, updated: %dms",
-                    timeout_left_ms, timeout_consumed_ms,
-                    max(timeout_left_ms - timeout_consumed_ms, 0));
-
-            timeout_left_ms -= timeout_consumed_ms;
-            if (timeout_left_ms < 0)
-                timeout_left_ms = 0;
-        }
+    if (!update_status(mod))
+        return false;
+
+    module_signal_refresh(mod);
+
+    if (!module_add_fd(mod, udev_monitor_get_fd(m->mon), EPOLLIN, &on_udev))
+        return false;
+
+    if (m->poll_interval > 0 &&
+        !module_set_timer(mod, m->poll_interval, m->poll_interval, &on_timer))
+    {
+        return false;
     }
 
-out:
-    if (mon != NULL)
-        udev_monitor_unref(mon);
-    if (udev != NULL)
-        udev_unref(udev);
-    return ret;
+    return true;
 }
 
 static struct module *
-battery_new(const char *battery, struct particle *label, long poll_interval_msecs)
+battery_new(const char *batteries[], size_t count, struct particle *label,
+            long poll_interval_msecs)
 {
     struct private *m = calloc(1, sizeof(*m));
     m->label = label;
     m->poll_interval = poll_interval_msecs;
-    m->battery = strdup(battery);
-    m->state = STATE_UNKNOWN;
+    m->batteries = calloc(count, sizeof(m->batteries[0]));
+    m->count = count;
+
+    size_t names_len = 0;
+    for (size_t i = 0; i < count; i++)
+        names_len += strlen(batteries[i]) + 1;
+
+    m->names = malloc(names_len);
+    m->names[0] = '\0';
+
+    for (size_t i = 0; i < count; i++) {
+        struct battery *bat = &m->batteries[i];
+        bat->name = strdup(batteries[i]);
+        bat->state = STATE_UNKNOWN;
+        for (size_t j = 0; j < ATTR_COUNT; j++)
+            bat->fds[j] = -1;
+
+        if (i > 0)
+            strcat(m->names, "+");
+        strcat(m->names, batteries[i]);
+    }
 
     struct module *mod = module_common_new();
     mod->private = m;
-    mod->run = &run;
+    mod->setup = &setup;
     mod->destroy = &destroy;
     mod->content = &content;
     mod->description = &description;
@@ -572,8 +703,22 @@ from_conf(const struct yml_node *node, struct conf_inherit inherited)
     const struct yml_node *name = yml_get_value(node, "name");
     const struct yml_node *poll_interval = yml_get_value(node, "poll-interval");
 
+    const size_t count = yml_is_list(name) ? yml_list_length(name) : 1;
+    const char *names[count];
+
+    if (yml_is_list(name)) {
+        size_t idx = 0;
+        for (struct yml_list_iter it = yml_list_iter(name);
+             it.node != NULL;
+             yml_list_next(&it), idx++)
+        {
+            names[idx] = yml_value_as_string(it.node);
+        }
+    } else
+        names[0] = yml_value_as_string(name);
+
     return battery_new(
-        yml_value_as_string(name),
+        names, count,
         conf_to_particle(c, inherited),
         (poll_interval != NULL
          ? yml_value_as_int(poll_interval)
@@ -597,11 +742,26 @@ conf_verify_poll_interval(keychain_t *chain, const struct yml_node *node)
     return true;
 }
 
+static bool
+conf_verify_name(keychain_t *chain, const struct yml_node *node)
+{
+    if (!yml_is_list(node))
+        return conf_verify_string(chain, node);
+
+    if (yml_list_length(node) == 0) {
+        LOG_ERR("%s: must contain at least one battery",
+                conf_err_prefix(chain, node));
+        return false;
+    }
+
+    return conf_verify_list(chain, node, &conf_verify_string);
+}
+
 static bool
 verify_conf(keychain_t *chain, const struct yml_node *node)
 {
     static const struct attr_info attrs[] = {
-        {"name", true, &conf_verify_string},
+        {"name", true, &conf_verify_name},
         {"poll-interval", false, &conf_verify_poll_interval},
         MODULE_COMMON_ATTRS,
     };
@@ -4,7 +4,6 @@
 #include <assert.h>
 #include <errno.h>
 
-#include <poll.h>
 #include <sys/time.h>
 
 #define LOG_MODULE "clock"
@@ -47,7 +46,11 @@ static struct exposable *
 content(struct module *mod)
 {
     const struct private *m = mod->private;
-    time_t t = time(NULL);
+
+    struct timespec now;
+    module_clock_gettime(CLOCK_REALTIME, &now);
+
+    time_t t = now.tv_sec;
     struct tm *tm = m->utc ? gmtime(&t) : localtime(&t);
 
     char date_str[1024];
@@ -68,77 +71,69 @@ content(struct module *mod)
     return exposable;
 }
 
-static int
-run(struct module *mod)
+/* Milliseconds until the next second, or minute, boundary */
+static long
+next_timeout(const struct private *m)
 {
-    const struct private *m = mod->private;
-    const struct bar *bar = mod->bar;
-    bar->refresh(bar);
-
-    int ret = 1;
-
-    while (true) {
-        struct timespec _now;
-        clock_gettime(CLOCK_REALTIME, &_now);
-
-        const struct timeval now = {
-            .tv_sec = _now.tv_sec,
-            .tv_usec = _now.tv_nsec / 1000,
-        };
+    struct timespec _now;
+    clock_gettime(CLOCK_REALTIME, &_now);
 
-        int timeout_ms = 1000;
-
-        switch (m->update_granularity) {
-        case UPDATE_GRANULARITY_SECONDS: {
-            const struct timeval next_second = {
-                .tv_sec = now.tv_sec + 1,
-                .tv_usec = 0};
+    const struct timeval now = {
+        .tv_sec = _now.tv_sec,
+        .tv_usec = _now.tv_nsec / 1000,
+    };
 
-            struct timeval _timeout;
-            timersub(&next_second, &now, &_timeout);
+    long timeout_ms = 1000;
 
-            assert(_timeout.tv_sec == 0 ||
-                   (_timeout.tv_sec == 1 && _timeout.tv_usec == 0));
-            timeout_ms = _timeout.tv_usec / 1000;
-            break;
-        }
+    switch (m->update_granularity) {
+    case UPDATE_GRANULARITY_SECONDS: {
+        const struct timeval next_second = {
+            .tv_sec = now.tv_sec + 1,
+            .tv_usec = 0};
 
-        case UPDATE_GRANULARITY_MINUTES: {
-            const struct timeval next_minute = {
-                .tv_sec = now.tv_sec / 60 * 60 + 60,
-                .tv_usec = 0,
-            };
+        struct timeval _timeout;
+        timersub(&next_second, &now, &_timeout);
 
-            struct timeval _timeout;
-            timersub(&next_minute, &now, &_timeout);
-            timeout_ms = _timeout.tv_sec * 1000 + _timeout.tv_usec / 1000;
-        }
-        }
+        assert(_timeout.tv_sec == 0 ||
+               (_timeout.tv_sec == 1 && _timeout.tv_usec == 0));
+        timeout_ms = _timeout.tv_usec / 1000;
+        break;
+    }
 
-        /* Add 1ms to account for rounding errors */
-        timeout_ms++;
+    case UPDATE_GRANULARITY_MINUTES: {
+        const struct timeval next_minute = {
+            .tv_sec = now.tv_sec / 60 * 60 + 60,
+            .tv_usec = 0,
+        };
 
-        LOG_DBG("now: %lds %ldµs -> timeout: %dms",
-                now.tv_sec, now.tv_usec, timeout_ms);
+        struct timeval _timeout;
+        timersub(&next_minute, &now, &_timeout);
+        timeout_ms = _timeout.tv_sec * 1000 + _timeout.tv_usec / 1000;
+    }
+    }
 
-        struct pollfd fds[] = {{.fd = mod->abort_fd, .events = POLLIN}};
-        if (poll(fds, 1, timeout_ms) < 0) {
-            if (errno == EINTR)
-                continue;
+    /* Add 1ms to account for rounding errors */
+    timeout_ms++;
 
-            LOG_ERRNO("failed to poll");
-            break;
-        }
+    LOG_DBG("now: %lds %ldµs -> timeout: %ldms",
+            now.tv_sec, now.tv_usec, timeout_ms);
+    return timeout_ms;
+}
 
-        if (fds[0].revents & POLLIN) {
-            ret = 0;
-            break;
-        }
+static bool
+on_timer(struct module *mod)
+{
+    module_signal_refresh(mod);
 
-        bar->refresh(bar);
-    }
+    /* Re-calculated every time, to stay aligned with the wall clock */
+    return module_set_timer(mod, next_timeout(mod->private), 0, &on_timer);
+}
 
-    return ret;
+static bool
+setup(struct module *mod)
+{
+    module_signal_refresh(mod);
+    return module_set_timer(mod, next_timeout(mod->private), 0, &on_timer);
 }
 
 static struct module *
@@ -178,7 +173,7 @@ clock_new(struct particle *label, const char *date_format,
 
     struct module *mod = module_common_new();
     mod->private = m;
-    mod->run = &run;
+    mod->setup = &setup;
     mod->destroy = &destroy;
     mod->content = &content;
     mod->description = &description;
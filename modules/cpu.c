@@ -2,7 +2,6 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <math.h>
-#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,20 +14,23 @@
 #define LOG_ENABLE_DBG 0
 #include "../log.h"
 
+#include "../arena.h"
 #include "../bar/bar.h"
 #include "../config-verify.h"
 #include "../config.h"
 #include "../particles/dynlist.h"
 #include "../plugin.h"
+#include "../proc-sampler.h"
 
 static const long min_poll_interval = 250;
 
+/* Index 0 is the total, index 1..n the cores */
 struct cpu_stats {
-    uint32_t *prev_cores_idle;
-    uint32_t *prev_cores_nidle;
+    uint64_t *prev_cores_idle;
+    uint64_t *prev_cores_nidle;
 
-    uint32_t *cur_cores_idle;
-    uint32_t *cur_cores_nidle;
+    uint64_t *cur_cores_idle;
+    uint64_t *cur_cores_nidle;
 };
 
 struct private {
@@ -36,6 +38,27 @@ struct private {
     uint16_t interval;
     size_t core_count;
     struct cpu_stats cpu_stats;
+
+    /* Cores to instantiate the template for (in addition to the total) */
+    bool *selected;
+    size_t selected_count;
+
+    /* Instantiate the template for each selected core, or only the total */
+    bool per_core;
+
+    /* Usage of the selected cores, packed, for the "cores" tag */
+    uint8_t *usage;
+
+    /*
+     * Exponentially weighted moving averages of the usage, indexed
+     * like cpu_stats. 'smoothing' is the time constant, in ms; 0
+     * disables averaging.
+     */
+    uint32_t smoothing;
+    double *avg;
+
+    /* CLOCK_MONOTONIC time of the last sample, in ns; 0 before the first */
+    uint64_t sample_time;
 };
 
 static void
@@ -44,6 +67,9 @@ destroy(struct module *mod)
     struct private *m = mod->private;
 
     m->template->destroy(m->template);
+    free(m->selected);
+    free(m->usage);
+    free(m->avg);
     free(m->cpu_stats.prev_cores_idle);
     free(m->cpu_stats.prev_cores_nidle);
     free(m->cpu_stats.cur_cores_idle);
@@ -62,47 +88,64 @@ description(const struct module *mod)
 static uint32_t
 get_cpu_nb_cores()
 {
-    int nb_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    /* Configured, not online: offline cores keep their numbers */
+    int nb_cores = sysconf(_SC_NPROCESSORS_CONF);
     LOG_DBG("CPU count: %d", nb_cores);
 
     return nb_cores;
 }
 
+static const char *
+parse_u64(const char *p, const char *end, uint64_t *value)
+{
+    while (p < end && *p == ' ')
+        p++;
+
+    const char *start = p;
+    uint64_t v = 0;
+
+    while (p < end && *p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+
+    *value = v;
+    return p > start ? p : NULL;
+}
+
+/*
+ * Parses a "cpu" or "cpuN" line, up to (but not including) 'end'.
+ * guest and guest_nice are included in user and nice, and are not
+ * needed.
+ */
 static bool
-parse_proc_stat_line(const char *line, uint32_t *user, uint32_t *nice,
-                     uint32_t *system, uint32_t *idle, uint32_t *iowait,
-                     uint32_t *irq, uint32_t *softirq, uint32_t *steal,
-                     uint32_t *guest, uint32_t *guestnice)
+parse_proc_stat_line(const char *p, const char *end,
+                     uint64_t *idle_time, uint64_t *non_idle_time)
 {
-    int32_t core_id;
-    if (line[sizeof("cpu") - 1] == ' ') {
-        int read = sscanf(
-            line,
-            "cpu %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32
-            " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32,
-            user, nice, system, idle, iowait, irq, softirq, steal, guest,
-            guestnice);
-        return read == 10;
-    } else {
-        int read = sscanf(
-            line,
-            "cpu%" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32
-            " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32
-            " %" SCNu32,
-            &core_id, user, nice, system, idle, iowait, irq, softirq, steal,
-            guest, guestnice);
-        return read == 11;
+    p += sizeof("cpu") - 1;
+    while (p < end && *p >= '0' && *p <= '9')
+        p++;
+
+    uint64_t user, nice, system, idle, iowait, irq, softirq, steal;
+    uint64_t *fields[] = {
+        &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal};
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if ((p = parse_u64(p, end, fields[i])) == NULL)
+            return false;
     }
+
+    *idle_time = idle + iowait;
+    *non_idle_time = user + nice + system + irq + softirq + steal;
+    return true;
 }
 
 static uint8_t
-get_cpu_usage_percent(const struct cpu_stats *cpu_stats, int8_t core_idx)
+get_cpu_usage_percent(const struct cpu_stats *cpu_stats, int core_idx)
 {
-    uint32_t prev_total =
+    uint64_t prev_total =
         cpu_stats->prev_cores_idle[core_idx + 1] +
         cpu_stats->prev_cores_nidle[core_idx + 1];
 
-    uint32_t cur_total =
+    uint64_t cur_total =
         cpu_stats->cur_cores_idle[core_idx + 1] +
         cpu_stats->cur_cores_nidle[core_idx + 1];
 
@@ -115,55 +158,107 @@ get_cpu_usage_percent(const struct cpu_stats *cpu_stats, int8_t core_idx)
     return round(percent);
 }
 
+/* 'idx' is 0 for the total, and 1..n for the cores */
 static void
-refresh_cpu_stats(struct cpu_stats *cpu_stats, size_t core_count)
+update_stats(struct private *m, size_t idx, uint64_t idle, uint64_t non_idle,
+             uint64_t elapsed)
 {
-    int32_t core = 0;
-    uint32_t user = 0;
-    uint32_t nice = 0;
-    uint32_t system = 0;
-    uint32_t idle = 0;
-    uint32_t iowait = 0;
-    uint32_t irq = 0;
-    uint32_t softirq = 0;
-    uint32_t steal = 0;
-    uint32_t guest = 0;
-    uint32_t guestnice = 0;
-
-    FILE *fp = NULL;
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-
-    fp = fopen("/proc/stat", "r");
-    if (NULL == fp) {
-        LOG_ERRNO("unable to open /proc/stat");
+    struct cpu_stats *cpu_stats = &m->cpu_stats;
+
+    cpu_stats->prev_cores_idle[idx] = cpu_stats->cur_cores_idle[idx];
+    cpu_stats->prev_cores_nidle[idx] = cpu_stats->cur_cores_nidle[idx];
+
+    cpu_stats->cur_cores_idle[idx] = idle;
+    cpu_stats->cur_cores_nidle[idx] = non_idle;
+
+    const uint8_t usage = get_cpu_usage_percent(cpu_stats, (int)idx - 1);
+    m->avg[idx] = elapsed > 0
+        ? proc_ewma(m->avg[idx], usage, elapsed, m->smoothing)
+        : usage;
+}
+
+/* Offline cores are idle; their counters don't advance */
+static void
+update_offline_core(struct private *m, size_t core, uint64_t elapsed)
+{
+    if (!m->selected[core])
         return;
-    }
 
-    while ((read = getline(&line, &len, fp)) != -1 && core <= core_count) {
-        if (strncmp(line, "cpu", sizeof("cpu") - 1) == 0) {
-            if (!parse_proc_stat_line(
-                    line, &user, &nice, &system, &idle, &iowait, &irq, &softirq,
-                    &steal, &guest, &guestnice))
-            {
-                LOG_ERR("unable to parse /proc/stat line");
-                goto exit;
+    update_stats(m, core + 1,
+                 m->cpu_stats.cur_cores_idle[core + 1],
+                 m->cpu_stats.cur_cores_nidle[core + 1],
+                 elapsed);
+}
+
+static bool
+refresh_cpu_stats(struct private *m)
+{
+    const struct proc_snapshot *stat = proc_sample(
+        PROC_SOURCE_STAT, m->interval / 10);
+    if (stat == NULL)
+        return false;
+
+    /* Usage is a ratio of counter deltas; only the averages need this */
+    const uint64_t elapsed =
+        m->sample_time != 0 ? stat->time - m->sample_time : 0;
+
+    m->sample_time = stat->time;
+
+    const char *p = stat->data;
+    const char *const end = stat->data + stat->len;
+
+    /*
+     * Offline cores have no line; lines are indexed by the N in
+     * "cpuN", not by their position. The lines are sorted, so the
+     * cores skipped between two lines (or after the last one) are the
+     * offline ones.
+     */
+    size_t next_core = 0;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+
+        /* The "cpu" lines come first; stop at the first other line */
+        if (eol == NULL || eol - p < 3 || strncmp(p, "cpu", 3) != 0)
+            break;
+
+        /* 0: total, 1..n: cores */
+        size_t idx = 0;
+
+        if (p[3] >= '0' && p[3] <= '9') {
+            uint64_t core;
+            parse_u64(p + 3, eol, &core);
+
+            if (core >= m->core_count || core < next_core) {
+                LOG_WARN("/proc/stat: unexpected core: cpu%"PRIu64, core);
+                p = eol + 1;
+                continue;
             }
 
-            cpu_stats->prev_cores_idle[core] = cpu_stats->cur_cores_idle[core];
-            cpu_stats->prev_cores_nidle[core] = cpu_stats->cur_cores_nidle[core];
+            for (; next_core < core; next_core++)
+                update_offline_core(m, next_core, elapsed);
 
-            cpu_stats->cur_cores_idle[core] = idle + iowait;
-            cpu_stats->cur_cores_nidle[core] = user + nice + system + irq + softirq + steal;
+            next_core = core + 1;
+            idx = core + 1;
+        }
 
-            core++;
+        if (idx == 0 || m->selected[idx - 1]) {
+            uint64_t idle, non_idle;
+            if (!parse_proc_stat_line(p, eol, &idle, &non_idle)) {
+                LOG_ERR("unable to parse /proc/stat line");
+                return false;
+            }
+
+            update_stats(m, idx, idle, non_idle, elapsed);
         }
+
+        p = eol + 1;
     }
 
-exit:
-    fclose(fp);
-    free(line);
+    for (; next_core < m->core_count; next_core++)
+        update_offline_core(m, next_core, elapsed);
+
+    return true;
 }
 
 static struct exposable *
@@ -173,8 +268,12 @@ content(struct module *mod)
 
     mtx_lock(&mod->lock);
 
-    const size_t list_count = m->core_count + 1;
-    struct exposable *parts[list_count];
+    for (size_t i = 0, idx = 0; i < m->core_count; i++) {
+        if (m->selected[i])
+            m->usage[idx++] = get_cpu_usage_percent(&m->cpu_stats, i);
+    }
+
+    struct exposable *total;
 
     {
         uint8_t total_usage = get_cpu_usage_percent(&m->cpu_stats, -1);
@@ -183,66 +282,85 @@ content(struct module *mod)
             .tags = (struct tag *[]){
                 tag_new_int(mod, "id", -1),
                 tag_new_int_range(mod, "cpu", total_usage, 0, 100),
+                tag_new_int_range(mod, "cpu_avg", lround(m->avg[0]), 0, 100),
+                tag_new_int_array(
+                    mod, "cores", m->usage, m->selected_count, 0, 100),
             },
-            .count = 2,
+            .count = 4,
         };
 
-        parts[0] = m->template->instantiate(m->template, &tags);
+        total = m->template->instantiate(m->template, &tags);
         tag_set_destroy(&tags);
     }
 
-    for (size_t i = 0; i < m->core_count; i++) {
-        uint8_t core_usage = get_cpu_usage_percent(&m->cpu_stats, i);
+    if (!m->per_core) {
+        mtx_unlock(&mod->lock);
+        return total;
+    }
+
+    /* Heap allocated; there may be hundreds of cores */
+    const size_t list_count = 1 + m->selected_count;
+    struct exposable **parts = frame_alloc(list_count * sizeof(parts[0]));
+    parts[0] = total;
+
+    for (size_t i = 0, idx = 1; i < m->core_count; i++) {
+        if (!m->selected[i])
+            continue;
 
         struct tag_set tags = {
             .tags = (struct tag *[]){
                 tag_new_int(mod, "id", i),
-                tag_new_int_range(mod, "cpu", core_usage, 0, 100),
+                tag_new_int_range(mod, "cpu", m->usage[idx - 1], 0, 100),
+                tag_new_int_range(mod, "cpu_avg", lround(m->avg[i + 1]), 0, 100),
             },
-            .count = 2,
+            .count = 3,
         };
 
-        parts[i + 1] = m->template->instantiate(m->template, &tags);
+        parts[idx++] = m->template->instantiate(m->template, &tags);
         tag_set_destroy(&tags);
     }
 
     mtx_unlock(&mod->lock);
-    return dynlist_exposable_new(parts, list_count, 0, 0);
+
+    struct exposable *list = dynlist_exposable_new(parts, list_count, 0, 0);
+    frame_free(parts);
+    return list;
 }
 
-static int
-run(struct module *mod)
+static bool
+on_timer(struct module *mod)
 {
-    const struct bar *bar = mod->bar;
-    bar->refresh(bar);
-
     struct private *p = mod->private;
-    while (true) {
-        struct pollfd fds[] = {{.fd = mod->abort_fd, .events = POLLIN}};
 
-        int res = poll(fds, sizeof(fds) / sizeof(*fds), p->interval);
+    mtx_lock(&mod->lock);
+    bool updated = refresh_cpu_stats(p);
+    mtx_unlock(&mod->lock);
 
-        if (res < 0) {
-            if (EINTR == errno)
-                continue;
-            LOG_ERRNO("unable to poll abort fd");
-            return -1;
-        }
+    if (updated)
+        module_signal_refresh(mod);
+    return true;
+}
 
-        if (fds[0].revents & POLLIN)
-            break;
+static bool
+setup(struct module *mod)
+{
+    struct private *p = mod->private;
 
-        mtx_lock(&mod->lock);
-        refresh_cpu_stats(&p->cpu_stats, p->core_count);
-        mtx_unlock(&mod->lock);
-        bar->refresh(bar);
-    }
+    mtx_lock(&mod->lock);
+    bool ok = refresh_cpu_stats(p);
+    mtx_unlock(&mod->lock);
+
+    if (!ok)
+        return false;
 
-    return 0;
+    module_signal_refresh(mod);
+    return module_set_timer(mod, p->interval, p->interval, &on_timer);
 }
 
 static struct module *
-cpu_new(uint16_t interval, struct particle *template)
+cpu_new(uint16_t interval, struct particle *template,
+        const long *cores, size_t cores_count, bool per_core,
+        uint32_t smoothing)
 {
     uint32_t nb_cores = get_cpu_nb_cores();
 
@@ -250,6 +368,27 @@ cpu_new(uint16_t interval, struct particle *template)
     p->template = template;
     p->interval = interval;
     p->core_count = nb_cores;
+    p->per_core = per_core;
+    p->smoothing = smoothing;
+
+    p->selected = calloc(nb_cores, sizeof(p->selected[0]));
+    for (size_t i = 0; i < nb_cores; i++)
+        p->selected[i] = cores == NULL;
+
+    for (size_t i = 0; cores != NULL && i < cores_count; i++) {
+        if (cores[i] >= nb_cores) {
+            LOG_WARN("core %ld: no such core (have %"PRIu32" cores)",
+                     cores[i], nb_cores);
+            continue;
+        }
+        p->selected[cores[i]] = true;
+    }
+
+    for (size_t i = 0; i < nb_cores; i++)
+        p->selected_count += p->selected[i];
+
+    p->usage = calloc(nb_cores > 0 ? nb_cores : 1, sizeof(p->usage[0]));
+    p->avg = calloc(nb_cores + 1, sizeof(p->avg[0]));
 
     p->cpu_stats.prev_cores_nidle = calloc(
         nb_cores + 1, sizeof(*p->cpu_stats.prev_cores_nidle));
@@ -263,7 +402,7 @@ cpu_new(uint16_t interval, struct particle *template)
 
     struct module *mod = module_common_new();
     mod->private = p;
-    mod->run = &run;
+    mod->setup = &setup;
     mod->destroy = &destroy;
     mod->content = &content;
     mod->description = &description;
@@ -274,11 +413,30 @@ static struct module *
 from_conf(const struct yml_node *node, struct conf_inherit inherited)
 {
     const struct yml_node *interval = yml_get_value(node, "poll-interval");
+    const struct yml_node *cores = yml_get_value(node, "cores");
+    const struct yml_node *per_core = yml_get_value(node, "per-core");
+    const struct yml_node *smoothing = yml_get_value(node, "smoothing");
     const struct yml_node *c = yml_get_value(node, "content");
 
+    const size_t cores_count = cores != NULL ? yml_list_length(cores) : 0;
+    long core_list[cores_count > 0 ? cores_count : 1];
+
+    if (cores != NULL) {
+        size_t idx = 0;
+        for (struct yml_list_iter it = yml_list_iter(cores);
+             it.node != NULL;
+             yml_list_next(&it), idx++)
+        {
+            core_list[idx] = yml_value_as_int(it.node);
+        }
+    }
+
     return cpu_new(
         interval == NULL ? min_poll_interval : yml_value_as_int(interval),
-        conf_to_particle(c, inherited));
+        conf_to_particle(c, inherited),
+        cores != NULL ? core_list : NULL, cores_count,
+        per_core != NULL ? yml_value_as_bool(per_core) : true,
+        smoothing != NULL ? yml_value_as_int(smoothing) : 0);
 }
 
 static bool
@@ -296,11 +454,20 @@ conf_verify_poll_interval(keychain_t *chain, const struct yml_node *node)
     return true;
 }
 
+static bool
+verify_cores(keychain_t *chain, const struct yml_node *node)
+{
+    return conf_verify_list(chain, node, &conf_verify_unsigned);
+}
+
 static bool
 verify_conf(keychain_t *chain, const struct yml_node *node)
 {
     static const struct attr_info attrs[] = {
         {"poll-interval", false, &conf_verify_poll_interval},
+        {"cores", false, &verify_cores},
+        {"per-core", false, &conf_verify_bool},
+        {"smoothing", false, &conf_verify_unsigned},
         MODULE_COMMON_ATTRS,
     };
 
@@ -1,6 +1,6 @@
 #include <errno.h>
 #include <inttypes.h>
-#include <poll.h>
+#include <math.h>
 #include <stdbool.h>
 #include <string.h>
 #include <dirent.h>
@@ -16,6 +16,7 @@
 #include "../config.h"
 #include "../particles/dynlist.h"
 #include "../plugin.h"
+#include "../proc-sampler.h"
 
 static const long min_poll_interval = 250;
 
@@ -31,13 +32,25 @@ struct device_stats {
 
     uint32_t ios_in_progress;
 
+    /* In bytes/s, over the last poll interval */
+    uint64_t read_speed;
+    uint64_t write_speed;
+
+    /* Exponentially weighted moving averages of the above */
+    double read_speed_avg;
+    double write_speed_avg;
+
     bool exists;
 };
 
 struct private {
     struct particle *label;
     uint16_t interval;
+    uint32_t smoothing;  /* EWMA time constant, in ms; 0 disables averaging */
     tll(struct device_stats *) devices;
+
+    /* CLOCK_MONOTONIC time of the last sample, in ns; 0 before the first */
+    uint64_t sample_time;
 };
 
 static bool
@@ -98,19 +111,34 @@ description(const struct module *mod)
     return "disk-io";
 }
 
+static void
+update_device_speeds(const struct private *m, struct device_stats *dev,
+                     uint64_t elapsed)
+{
+    const uint64_t bytes_read = (dev->cur_sectors_read - dev->prev_sectors_read) * 512;
+    const uint64_t bytes_written = (dev->cur_sectors_written - dev->prev_sectors_written) * 512;
+
+    dev->read_speed = (double)bytes_read * 1000000000. / elapsed;
+    dev->write_speed = (double)bytes_written * 1000000000. / elapsed;
+
+    dev->read_speed_avg = proc_ewma(
+        dev->read_speed_avg, dev->read_speed, elapsed, m->smoothing);
+    dev->write_speed_avg = proc_ewma(
+        dev->write_speed_avg, dev->write_speed, elapsed, m->smoothing);
+}
+
 static void
 refresh_device_stats(struct private *m)
 {
-    FILE *fp = NULL;
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-
-    fp = fopen("/proc/diskstats", "r");
-    if (NULL == fp) {
-        LOG_ERRNO("unable to open /proc/diskstats");
+    const struct proc_snapshot *diskstats = proc_sample(
+        PROC_SOURCE_DISKSTATS, m->interval / 10);
+    if (diskstats == NULL)
         return;
-    }
+
+    /* Neither CLOCK_MONOTONIC nor the disk counters advance in suspend */
+    const uint64_t elapsed =
+        m->sample_time != 0 ? diskstats->time - m->sample_time : 0;
+    m->sample_time = diskstats->time;
 
     /*
      * Devices may be added or removed during the bar's lifetime, as external
@@ -130,7 +158,14 @@ refresh_device_stats(struct private *m)
         it->item->exists = false;
     }
 
-    while ((read = getline(&line, &len, fp)) != -1) {
+    for (const char *p = diskstats->data, *eol; *p != '\0'; p = eol + 1) {
+        eol = strchrnul(p, '\n');
+
+        /* sscanf() would skip past the newline, into the next line */
+        char line[eol - p + 1];
+        memcpy(line, p, eol - p);
+        line[eol - p] = '\0';
+
         /*
          * For an explanation of the fields bellow, see
          * https://www.kernel.org/doc/Documentation/ABI/testing/procfs-diskstats
@@ -168,7 +203,7 @@ refresh_device_stats(struct private *m)
         {
             LOG_ERR("unable to parse /proc/diskstats line");
             free(device_name);
-            goto exit;
+            return;
         }
 
         bool found = false;
@@ -181,6 +216,8 @@ refresh_device_stats(struct private *m)
                 dev->cur_sectors_read = sectors_read;
                 dev->cur_sectors_written = sectors_written;
                 dev->exists = true;
+                if (elapsed > 0)
+                    update_device_speeds(m, dev, elapsed);
                 found = true;
                 break;
             }
@@ -193,11 +230,16 @@ refresh_device_stats(struct private *m)
             new_dev->cur_sectors_read = sectors_read;
             new_dev->prev_sectors_written = sectors_written;
             new_dev->cur_sectors_written = sectors_written;
+            new_dev->read_speed = new_dev->write_speed = 0;
+            new_dev->read_speed_avg = new_dev->write_speed_avg = 0;
             new_dev->exists = true;
             tll_push_back(m->devices, new_dev);
         }
 
         free(device_name);
+
+        if (*eol == '\0')
+            break;
     }
 
     tll_foreach(m->devices, it) {
@@ -206,29 +248,28 @@ refresh_device_stats(struct private *m)
             tll_remove(m->devices, it);
         }
     }
-exit:
-    fclose(fp);
-    free(line);
 }
 
 static struct exposable *
 content(struct module *mod)
 {
     const struct private *p = mod->private;
-    uint64_t total_bytes_read = 0;
-    uint64_t total_bytes_written = 0;
+    uint64_t total_read_speed = 0;
+    uint64_t total_write_speed = 0;
+    double total_read_speed_avg = 0;
+    double total_write_speed_avg = 0;
     uint32_t total_ios_in_progress = 0;
     mtx_lock(&mod->lock);
     struct exposable *tag_parts[p->devices.length + 1];
     int i = 0;
     tll_foreach(p->devices, it) {
         struct device_stats *dev = it->item;
-        uint64_t bytes_read = (dev->cur_sectors_read - dev->prev_sectors_read) * 512;
-        uint64_t bytes_written = (dev->cur_sectors_written - dev->prev_sectors_written) * 512;
 
         if (dev->is_disk){
-            total_bytes_read += bytes_read;
-            total_bytes_written += bytes_written;
+            total_read_speed += dev->read_speed;
+            total_write_speed += dev->write_speed;
+            total_read_speed_avg += dev->read_speed_avg;
+            total_write_speed_avg += dev->write_speed_avg;
             total_ios_in_progress += dev->ios_in_progress;
         }
 
@@ -236,11 +277,13 @@ content(struct module *mod)
             .tags = (struct tag *[]) {
                 tag_new_string(mod, "device", dev->name),
                 tag_new_bool(mod, "is_disk", dev->is_disk),
-                tag_new_int(mod, "read_speed", (bytes_read * 1000) / p->interval),
-                tag_new_int(mod, "write_speed", (bytes_written * 1000) / p->interval),
+                tag_new_int(mod, "read_speed", dev->read_speed),
+                tag_new_int(mod, "write_speed", dev->write_speed),
+                tag_new_int(mod, "read_speed_avg", llround(dev->read_speed_avg)),
+                tag_new_int(mod, "write_speed_avg", llround(dev->write_speed_avg)),
                 tag_new_int(mod, "ios_in_progress", dev->ios_in_progress),
             },
-            .count = 5,
+            .count = 7,
         };
         tag_parts[i++] = p->label->instantiate(p->label, &tags);
         tag_set_destroy(&tags);
@@ -249,11 +292,13 @@ content(struct module *mod)
         .tags = (struct tag *[]) {
             tag_new_string(mod, "device", "Total"),
             tag_new_bool(mod, "is_disk", true),
-            tag_new_int(mod, "read_speed", (total_bytes_read * 1000) / p->interval),
-            tag_new_int(mod, "write_speed", (total_bytes_written * 1000) / p->interval),
+            tag_new_int(mod, "read_speed", total_read_speed),
+            tag_new_int(mod, "write_speed", total_write_speed),
+            tag_new_int(mod, "read_speed_avg", llround(total_read_speed_avg)),
+            tag_new_int(mod, "write_speed_avg", llround(total_write_speed_avg)),
             tag_new_int(mod, "ios_in_progress", total_ios_in_progress),
         },
-        .count = 5,
+        .count = 7,
     };
     tag_parts[i] = p->label->instantiate(p->label, &tags);
     tag_set_destroy(&tags);
@@ -262,46 +307,42 @@ content(struct module *mod)
     return dynlist_exposable_new(tag_parts, p->devices.length + 1, 0, 0);
 }
 
-static int
-run(struct module *mod)
+static bool
+on_timer(struct module *mod)
 {
-    const struct bar *bar = mod->bar;
-    bar->refresh(bar);
     struct private *p = mod->private;
-    while (true) {
-        struct pollfd fds[] = {{.fd = mod->abort_fd, .events = POLLIN}};
-
-        int res = poll(fds, sizeof(fds) / sizeof(*fds), p->interval);
 
-        if (res < 0) {
-            if (EINTR == errno)
-                continue;
-            LOG_ERRNO("unable to poll abort fd");
-            return -1;
-        }
+    mtx_lock(&mod->lock);
+    refresh_device_stats(p);
+    mtx_unlock(&mod->lock);
+    module_signal_refresh(mod);
+    return true;
+}
 
-        if (fds[0].revents & POLLIN)
-            break;
+static bool
+setup(struct module *mod)
+{
+    struct private *p = mod->private;
 
-        mtx_lock(&mod->lock);
-        refresh_device_stats(p);
-        mtx_unlock(&mod->lock);
-        bar->refresh(bar);
-    }
+    mtx_lock(&mod->lock);
+    refresh_device_stats(p);
+    mtx_unlock(&mod->lock);
 
-    return 0;
+    module_signal_refresh(mod);
+    return module_set_timer(mod, p->interval, p->interval, &on_timer);
 }
 
 static struct module *
-disk_io_new(uint16_t interval, struct particle *label)
+disk_io_new(uint16_t interval, uint32_t smoothing, struct particle *label)
 {
     struct private *p = calloc(1, sizeof(*p));
     p->label = label;
     p->interval = interval;
+    p->smoothing = smoothing;
 
     struct module *mod = module_common_new();
     mod->private = p;
-    mod->run = &run;
+    mod->setup = &setup;
     mod->destroy = &destroy;
     mod->content = &content;
     mod->description = &description;
@@ -312,10 +353,12 @@ static struct module *
 from_conf(const struct yml_node *node, struct conf_inherit inherited)
 {
     const struct yml_node *interval = yml_get_value(node, "poll-interval");
+    const struct yml_node *smoothing = yml_get_value(node, "smoothing");
     const struct yml_node *c = yml_get_value(node, "content");
 
     return disk_io_new(
             interval == NULL ? min_poll_interval : yml_value_as_int(interval),
+            smoothing != NULL ? yml_value_as_int(smoothing) : 0,
             conf_to_particle(c, inherited));
 }
 
@@ -340,6 +383,7 @@ verify_conf(keychain_t *chain, const struct yml_node *node)
 {
     static const struct attr_info attrs[] = {
         {"poll-interval", false, &conf_verify_poll_interval},
+        {"smoothing", false, &conf_verify_unsigned},
         MODULE_COMMON_ATTRS,
     };
 
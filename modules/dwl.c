@@ -384,7 +384,7 @@ run(struct module *module)
     }
     mtx_unlock(&module->lock);
 
-    module->bar->refresh(module->bar);
+    module_signal_refresh(module);
 
     while (true) {
         struct pollfd fds[] = {
@@ -431,7 +431,7 @@ run(struct module *module)
         }
         mtx_unlock(&module->lock);
 
-        module->bar->refresh(module->bar);
+        module_signal_refresh(module);
     }
 
     return run_clean(inotify_fd, inotify_wd, file);
@@ -352,8 +352,7 @@ static void
 done(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle)
 {
     struct toplevel *top = data;
-    const struct bar *bar = top->mod->bar;
-    bar->refresh(bar);
+    module_signal_refresh(top->mod);
 }
 
 static void
@@ -373,8 +372,7 @@ closed(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle)
     }
     mtx_unlock(&mod->lock);
 
-    const struct bar *bar = mod->bar;
-    bar->refresh(bar);
+    module_signal_refresh(mod);
 }
 
 static void
@@ -722,7 +722,7 @@ burst_done(void *_mod)
 
     if (m->dirty) {
         m->dirty = false;
-        mod->bar->refresh(mod->bar);
+        module_signal_refresh(mod);
     }
 }
 
@@ -2,7 +2,6 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <math.h>
-#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +16,7 @@
 #include "../config.h"
 #include "../log.h"
 #include "../plugin.h"
+#include "../proc-sampler.h"
 
 static const long min_poll_interval = 250;
 
@@ -24,6 +24,10 @@ struct private
 {
     struct particle *label;
     uint16_t interval;
+
+    /* From the last sample, in KiB */
+    uint64_t mem_free;
+    uint64_t mem_total;
 };
 
 static void
@@ -41,53 +45,56 @@ description(const struct module *mod)
     return "mem";
 }
 
+/* Parses the value of the "<key> <value> kB" line starting with 'key' */
 static bool
-get_mem_stats(uint64_t *mem_free, uint64_t *mem_total)
+find_meminfo_value(const char *data, const char *key, uint64_t *value)
 {
-    bool mem_total_found = false;
-    bool mem_free_found = false;
+    const size_t key_len = strlen(key);
 
-    FILE *fp = NULL;
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read = 0;
+    for (const char *line = data; line != NULL && *line != '\0'; ) {
+        if (strncmp(line, key, key_len) == 0)
+            return sscanf(line + key_len, "%" SCNu64, value) == 1;
 
-    fp = fopen("/proc/meminfo", "r");
-    if (NULL == fp) {
-        LOG_ERRNO("unable to open /proc/meminfo");
-        return false;
+        line = strchr(line, '\n');
+        if (line != NULL)
+            line++;
     }
 
-    while ((read = getline(&line, &len, fp)) != -1) {
-        if (strncmp(line, "MemTotal:", sizeof("MemTotal:") - 1) == 0) {
-            read = sscanf(line + sizeof("MemTotal:") - 1, "%" SCNu64, mem_total);
-            mem_total_found = (read == 1);
-        }
-        if (strncmp(line, "MemAvailable:", sizeof("MemAvailable:") - 1) == 0) {
-            read = sscanf(line + sizeof("MemAvailable:"), "%" SCNu64, mem_free);
-            mem_free_found = (read == 1);
-        }
-    }
-    free(line);
+    return false;
+}
 
-    fclose(fp);
+static bool
+refresh_mem_stats(struct private *p)
+{
+    const struct proc_snapshot *meminfo = proc_sample(
+        PROC_SOURCE_MEMINFO, p->interval / 10);
+    if (meminfo == NULL)
+        return false;
+
+    uint64_t mem_free, mem_total;
+    if (!find_meminfo_value(meminfo->data, "MemTotal:", &mem_total) ||
+        !find_meminfo_value(meminfo->data, "MemAvailable:", &mem_free))
+    {
+        LOG_ERR("unable to retrieve the memory stats");
+        return false;
+    }
 
-    return mem_free_found && mem_total_found;
+    p->mem_free = mem_free;
+    p->mem_total = mem_total;
+    return true;
 }
 
 static struct exposable *
 content(struct module *mod)
 {
     const struct private *p = mod->private;
-    uint64_t mem_free = 0;
-    uint64_t mem_used = 0;
-    uint64_t mem_total = 0;
 
-    if (!get_mem_stats(&mem_free, &mem_total)) {
-        LOG_ERR("unable to retrieve the memory stats");
-    }
+    mtx_lock(&mod->lock);
+    uint64_t mem_free = p->mem_free;
+    uint64_t mem_total = p->mem_total;
+    mtx_unlock(&mod->lock);
 
-    mem_used = mem_total - mem_free;
+    uint64_t mem_used = mem_total - mem_free;
 
     double percent_used = ((double)mem_used * 100) / (mem_total + 1);
     double percent_free = ((double)mem_free * 100) / (mem_total + 1);
@@ -105,32 +112,31 @@ content(struct module *mod)
     return exposable;
 }
 
-static int
-run(struct module *mod)
+static bool
+on_timer(struct module *mod)
 {
-    const struct bar *bar = mod->bar;
-    bar->refresh(bar);
     struct private *p = mod->private;
-    while (true) {
-        struct pollfd fds[] = {{.fd = mod->abort_fd, .events = POLLIN}};
 
-        int res = poll(fds, 1, p->interval);
-        if (res < 0) {
-            if (EINTR == errno) {
-                continue;
-            }
+    mtx_lock(&mod->lock);
+    bool updated = refresh_mem_stats(p);
+    mtx_unlock(&mod->lock);
 
-            LOG_ERRNO("unable to poll abort fd");
-            return -1;
-        }
+    if (updated)
+        module_signal_refresh(mod);
+    return true;
+}
 
-        if (fds[0].revents & POLLIN)
-            break;
+static bool
+setup(struct module *mod)
+{
+    struct private *p = mod->private;
 
-        bar->refresh(bar);
-    }
+    mtx_lock(&mod->lock);
+    refresh_mem_stats(p);
+    mtx_unlock(&mod->lock);
 
-    return 0;
+    module_signal_refresh(mod);
+    return module_set_timer(mod, p->interval, p->interval, &on_timer);
 }
 
 static struct module *
@@ -142,7 +148,7 @@ mem_new(uint16_t interval, struct particle *label)
 
     struct module *mod = module_common_new();
     mod->private = p;
-    mod->run = &run;
+    mod->setup = &setup;
     mod->destroy = &destroy;
     mod->content = &content;
     mod->description = &description;
@@ -122,7 +122,7 @@ content(struct module *mod)
     const struct private *m = mod->private;
 
     struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
+    module_clock_gettime(CLOCK_MONOTONIC, &now);
 
     mtx_lock(&mod->lock);
 
@@ -330,7 +330,7 @@ update_status(struct module *mod)
     }
 
     struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
+    module_clock_gettime(CLOCK_MONOTONIC, &now);
 
     mtx_lock(&mod->lock);
     m->state = mpd_status_get_state(status);
@@ -386,7 +386,6 @@ update_status(struct module *mod)
 static int
 run(struct module *mod)
 {
-    const struct bar *bar = mod->bar;
     struct private *m = mod->private;
 
     bool aborted = false;
@@ -457,7 +456,7 @@ run(struct module *mod)
         if (!update_status(mod))
             continue;
 
-        bar->refresh(bar);
+        module_signal_refresh(mod);
 
         /* Monitor for events from MPD */
         while (true) {
@@ -500,7 +499,7 @@ run(struct module *mod)
                 if (!update_status(mod))
                     break;
 
-                bar->refresh(bar);
+                module_signal_refresh(mod);
             }
         }
     }
@@ -549,7 +548,7 @@ refresh_in_thread(void *arg)
     }
 
     LOG_DBG("timed refresh");
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 
     return 0;
 }
@@ -8,8 +8,7 @@
 #include <errno.h>
 
 #include <threads.h>
-#include <poll.h>
-#include <sys/timerfd.h>
+#include <sys/epoll.h>
 
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -86,6 +85,9 @@ struct private {
 
     double dl_speed;
     uint64_t dl_bits;
+
+    /* When ul_bits/dl_bits were sampled; CLOCK_MONOTONIC, nanoseconds */
+    uint64_t stats_time;
 };
 
 static void
@@ -93,7 +95,10 @@ destroy(struct module *mod)
 {
     struct private *m = mod->private;
 
-    assert(m->rt_sock == -1);
+    if (m->rt_sock >= 0)
+        close(m->rt_sock);
+    if (m->genl_sock >= 0)
+        close(m->genl_sock);
 
     m->label->destroy(m->label);
 
@@ -598,7 +603,7 @@ handle_link(struct module *mod, uint16_t type,
     }
 
     if (update_bar)
-        mod->bar->refresh(mod->bar);
+        module_signal_refresh(mod);
 }
 
 static void
@@ -664,7 +669,7 @@ handle_address(struct module *mod, uint16_t type,
     }
 
     if (update_bar)
-        mod->bar->refresh(mod->bar);
+        module_signal_refresh(mod);
 }
 
 static bool
@@ -849,7 +854,7 @@ handle_nl80211_new_interface(struct module *mod, uint16_t type, bool nested,
         m->ssid = strndup(ssid, len);
         mtx_unlock(&mod->lock);
 
-        mod->bar->refresh(mod->bar);
+        module_signal_refresh(mod);
         break;
     }
 
@@ -971,7 +976,7 @@ handle_nl80211_new_station(struct module *mod, uint16_t type, bool nested,
             mod, payload, len, &handle_nl80211_station_info, &ctx);
 
         if (ctx.update_bar)
-            mod->bar->refresh(mod->bar);
+            module_signal_refresh(mod);
         break;
     }
 
@@ -1004,7 +1009,7 @@ handle_ies(struct module *mod, const void *_ies, size_t len)
             m->ssid = strndup(ssid, ssid_len);
             mtx_unlock(&mod->lock);
 
-            mod->bar->refresh(mod->bar);
+            module_signal_refresh(mod);
             break;
         }
         }
@@ -1126,15 +1131,40 @@ handle_stats(struct module *mod, struct rt_stats_msg *msg)
     uint64_t ul_bits = msg->stats.tx_bytes * 8;
     uint64_t dl_bits = msg->stats.rx_bytes * 8;
 
-    const double poll_interval_secs = (double)m->poll_interval / 1000.;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    const uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+    /*
+     * Divide by the time actually elapsed since the last sample; the
+     * poll timer is batched with other timers, and may fire late.
+     */
+    bool changed = false;
 
-    if (m->ul_bits != 0)
-        m->ul_speed = (double)(ul_bits - m->ul_bits) / poll_interval_secs;
-    if (m->dl_bits != 0)
-        m->dl_speed = (double)(dl_bits - m->dl_bits) / poll_interval_secs;
+    if (m->stats_time != 0 && now > m->stats_time) {
+        const double elapsed_secs = (double)(now - m->stats_time) / 1e9;
+
+        /* content() reads the speeds on the bar's thread */
+        mtx_lock(&mod->lock);
+        if (m->ul_bits != 0) {
+            const double ul_speed = (double)(ul_bits - m->ul_bits) / elapsed_secs;
+            changed |= ul_speed != m->ul_speed;
+            m->ul_speed = ul_speed;
+        }
+        if (m->dl_bits != 0) {
+            const double dl_speed = (double)(dl_bits - m->dl_bits) / elapsed_secs;
+            changed |= dl_speed != m->dl_speed;
+            m->dl_speed = dl_speed;
+        }
+        mtx_unlock(&mod->lock);
+    }
 
     m->ul_bits = ul_bits;
     m->dl_bits = dl_bits;
+    m->stats_time = now;
+
+    if (changed)
+        module_signal_refresh(mod);
 }
 
 static bool
@@ -1326,127 +1356,89 @@ parse_genl_reply(struct module *mod, const struct nlmsghdr *hdr, size_t len)
     return true;
 }
 
-static int
-run(struct module *mod)
+static bool
+on_rt(struct module *mod, int fd, int events)
 {
-    int ret = 1;
     struct private *m = mod->private;
 
-    int timer_fd = -1;
-    if (m->poll_interval > 0) {
-        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-        if (timer_fd < 0) {
-            LOG_ERRNO("%s: failed to create poll timer FD", m->iface);
-            goto out;
-        }
+    if (events & EPOLLHUP) {
+        LOG_ERR("%s: disconnected from netlink socket", m->iface);
+        return false;
+    }
 
-        const long secs = m->poll_interval / 1000;
-        const long msecs = m->poll_interval % 1000;
+    /* Read one (or more) messages */
+    void *reply;
+    size_t len;
+    if (!netlink_receive_messages(fd, &reply, &len))
+        return false;
 
-        struct itimerspec poll_time = {
-            .it_value = {.tv_sec = secs, .tv_nsec = msecs * 1000000},
-            .it_interval = {.tv_sec = secs, .tv_nsec = msecs * 1000000},
-        };
+    /* Parse (and act upon) the received message(s) */
+    bool ret = parse_rt_reply(mod, (const struct nlmsghdr *)reply, len);
+    free(reply);
+    return ret;
+}
 
-        if (timerfd_settime(timer_fd, 0, &poll_time, NULL) < 0) {
-            LOG_ERRNO("%s: failed to arm poll timer", m->iface);
-            goto out;
-        }
+static bool
+on_genl(struct module *mod, int fd, int events)
+{
+    struct private *m = mod->private;
+
+    if (events & EPOLLHUP) {
+        LOG_ERR("%s: disconnected from netlink socket", m->iface);
+        return false;
     }
 
+    /* Read one (or more) messages */
+    void *reply;
+    size_t len;
+    if (!netlink_receive_messages(fd, &reply, &len))
+        return false;
+
+    bool ret = parse_genl_reply(mod, (const struct nlmsghdr *)reply, len);
+    free(reply);
+    return ret;
+}
+
+static bool
+on_timer(struct module *mod)
+{
+    struct private *m = mod->private;
+
+    send_nl80211_get_station(m);
+    send_rt_getstats_request(m);
+    return true;
+}
+
+static bool
+setup(struct module *mod)
+{
+    struct private *m = mod->private;
+
     m->rt_sock = netlink_connect_rt();
     m->genl_sock = netlink_connect_genl();
 
     if (m->rt_sock < 0 || m->genl_sock < 0)
-        goto out;
+        return false;
 
     if (!send_rt_request(m, RTM_GETLINK) ||
         !send_ctrl_get_family_request(m))
     {
-        goto out;
+        return false;
     }
 
-    /* Main loop */
-    while (true) {
-        struct pollfd fds[] = {
-            {.fd = mod->abort_fd, .events = POLLIN},
-            {.fd = m->rt_sock, .events = POLLIN},
-            {.fd = m->genl_sock, .events = POLLIN},
-            {.fd = timer_fd, .events = POLLIN},
-        };
-
-        poll(fds, 3 + (timer_fd >= 0 ? 1 : 0), -1);
-
-        if (fds[0].revents & (POLLIN | POLLHUP))
-            break;
-
-        if ((fds[1].revents & POLLHUP) ||
-            (fds[2].revents & POLLHUP))
-        {
-            LOG_ERR("%s: disconnected from netlink socket", m->iface);
-            break;
-        }
-
-        if (fds[3].revents & POLLHUP) {
-            LOG_ERR("%s: disconnected from timer FD", m->iface);
-            break;
-        }
-
-        if (fds[1].revents & POLLIN) {
-            /* Read one (or more) messages */
-            void *reply;
-            size_t len;
-            if (!netlink_receive_messages(m->rt_sock, &reply, &len))
-                break;
-
-            /* Parse (and act upon) the received message(s) */
-            if (!parse_rt_reply(mod, (const struct nlmsghdr *)reply, len)) {
-                free(reply);
-                break;
-            }
-
-            free(reply);
-        }
-
-        if (fds[2].revents & POLLIN) {
-            /* Read one (or more) messages */
-            void *reply;
-            size_t len;
-            if (!netlink_receive_messages(m->genl_sock, &reply, &len))
-                break;
-
-            if (!parse_genl_reply(mod, (const struct nlmsghdr *)reply, len)) {
-                free(reply);
-                break;
-            }
-
-            free(reply);
-        }
-
-        if (fds[3].revents & POLLIN) {
-            uint64_t count;
-            ssize_t amount = read(timer_fd, &count, sizeof(count));
-            if (amount < 0) {
-                LOG_ERRNO("failed to read from timer FD");
-                break;
-            }
-
-            send_nl80211_get_station(m);
-            send_rt_getstats_request(m);
-        }
+    if (!module_add_fd(mod, m->rt_sock, EPOLLIN, &on_rt) ||
+        !module_add_fd(mod, m->genl_sock, EPOLLIN, &on_genl))
+    {
+        return false;
     }
 
-    ret = 0;
+    if (m->poll_interval > 0 &&
+        !module_set_timer(mod, m->poll_interval, m->poll_interval, &on_timer))
+    {
+        return false;
+    }
 
-    out:
-    if (m->rt_sock >= 0)
-        close(m->rt_sock);
-    if (m->genl_sock >= 0)
-        close(m->genl_sock);
-    if (timer_fd >= 0)
-        close(timer_fd);
-    m->rt_sock = m->genl_sock = -1;
-    return ret;
+    return true;
 }
 
 static struct module *
@@ -1473,7 +1465,7 @@ network_new(const char *iface, struct particle *label, int poll_interval)
 
     struct module *mod = module_common_new();
     mod->private = priv;
-    mod->run = &run;
+    mod->setup = &setup;
     mod->destroy = &destroy;
     mod->content = &content;
     mod->description = &description;
@@ -362,7 +362,7 @@ device_events_param(void *userdata, int seq, uint32_t id, uint32_t index, uint32
     X_FREE_SET(output_informations->form_factor, X_STRDUP(route->form_factor));
     X_FREE_SET(output_informations->icon, X_STRDUP(route->icon_name));
 
-    device->data->module->bar->refresh(device->data->module->bar);
+    module_signal_refresh(device->data->module);
 }
 
 static struct pw_device_events const device_events = {
@@ -442,7 +442,7 @@ node_events_info(void *userdata, struct pw_node_info const *info)
         if (item != NULL)
             X_FREE_SET(output_informations->bus, X_STRDUP(item->value));
 
-        data->module->bar->refresh(data->module->bar);
+        module_signal_refresh(data->module);
     }
 }
 
@@ -483,7 +483,7 @@ node_events_param(void *userdata, __attribute__((unused)) int seq, __attribute__
         }
     }
 
-    data->module->bar->refresh(data->module->bar);
+    module_signal_refresh(data->module);
 }
 
 static struct pw_node_events const node_events = {
@@ -516,7 +516,7 @@ metadata_property(void *userdata, __attribute__((unused)) uint32_t id, char cons
         node_unhook_binded_node(data, is_sink);
         free(*target_name);
         *target_name = NULL;
-        data->module->bar->refresh(data->module->bar);
+        module_signal_refresh(data->module);
         return 0;
     }
 
@@ -541,7 +541,7 @@ metadata_property(void *userdata, __attribute__((unused)) uint32_t id, char cons
             node_unhook_binded_node(data, is_sink);
             free(*target_name);
             *target_name = NULL;
-            data->module->bar->refresh(data->module->bar);
+            module_signal_refresh(data->module);
             break;
         }
 
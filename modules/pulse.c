@@ -137,7 +137,7 @@ refresh_timer_cb(pa_mainloop_api *api,
     priv->refresh_scheduled = false;
 
     // Refresh the bar.
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 
 // Refresh the bar after a small delay. Without the delay, the bar
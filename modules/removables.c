@@ -643,7 +643,7 @@ run(struct module *mod)
     }
 
     udev_enumerate_unref(dev_enum);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 
     /* To be able to poll() mountinfo for changes, to detect
      * mount/unmount operations */
@@ -692,7 +692,7 @@ run(struct module *mod)
         }
 
         if (update)
-            mod->bar->refresh(mod->bar);
+            module_signal_refresh(mod);
     }
 
     close(mount_info_fd);
@@ -237,7 +237,7 @@ focused_tags(void *data, struct zriver_output_status_v1 *zriver_output_status_v1
     mtx_lock(&mod->lock);
     output->focused = tags;
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 
 static void
@@ -261,7 +261,7 @@ view_tags(void *data, struct zriver_output_status_v1 *zriver_output_status_v1,
         LOG_DBG("output: %s: occupied tags: 0x%0x", output->name, output->occupied);
     }
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 
 static void
@@ -276,7 +276,7 @@ urgent_tags(void *data, struct zriver_output_status_v1 *zriver_output_status_v1,
         output->urgent = tags;
     }
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 
 #if defined(ZRIVER_OUTPUT_STATUS_V1_LAYOUT_NAME_SINCE_VERSION)
@@ -294,7 +294,7 @@ layout_name(void *data,
         output->layout = name != NULL ? strdup(name) : NULL;
     }
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 #endif
 
@@ -312,7 +312,7 @@ layout_name_clear(void *data,
         output->layout = NULL;
     }
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 #endif
 
@@ -359,7 +359,7 @@ xdg_output_handle_name(void *data, struct zxdg_output_v1 *xdg_output,
         output->name = name != NULL ? strdup(name) : NULL;
     }
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 
 static void
@@ -436,7 +436,7 @@ focused_output(void *data, struct zriver_seat_status_v1 *zriver_seat_status_v1,
         mtx_lock(&mod->lock);
         seat->output = output;
         mtx_unlock(&mod->lock);
-        mod->bar->refresh(mod->bar);
+        module_signal_refresh(mod);
     }
 }
 
@@ -465,7 +465,7 @@ unfocused_output(void *data, struct zriver_seat_status_v1 *zriver_seat_status_v1
         seat->output = NULL;
     }
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 
 static void
@@ -496,7 +496,7 @@ focused_view(void *data, struct zriver_seat_status_v1 *zriver_seat_status_v1,
             seat->title = title != NULL ? strdup(title) : NULL;
         }
         mtx_unlock(&mod->lock);
-        mod->bar->refresh(mod->bar);
+        module_signal_refresh(mod);
     }
 }
 
@@ -514,7 +514,7 @@ mode(void *data, struct zriver_seat_status_v1 *zriver_seat_status_v1,
         seat->mode = strdup(name);
         mtx_unlock(&mod->lock);
     }
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 
     LOG_DBG("seat: %s, current mode: %s", seat->name, seat->mode);
 }
@@ -548,7 +548,7 @@ seat_handle_name(void *data, struct wl_seat *wl_seat, const char *name)
         seat->name = name != NULL ? strdup(name) : NULL;
     }
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 
 static const struct wl_seat_listener seat_listener = {
@@ -7,10 +7,11 @@
 #include <libgen.h>
 #include <signal.h>
 
-#include <poll.h>
 #include <fcntl.h>
 
+#include <sys/epoll.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 
@@ -29,7 +30,16 @@ struct private {
     size_t argc;
     char **argv;
     int poll_interval;
-    bool aborted;
+
+    pid_t pid;    /* 0 when the script isn't running */
+    int comm_fd;  /* Script's stdout */
+
+    /* State while terminating a script that closed its stdout */
+    struct {
+        int pid_fd;    /* -1 if pidfd_open() isn't available */
+        size_t stage;  /* Index into sig_info[] */
+        long polls;    /* Without a pidfd: polls left in this stage */
+    } reap;
 
     struct particle *content;
 
@@ -42,10 +52,85 @@ struct private {
     } recv_buf;
 };
 
+static const struct {
+    int signo;
+    int timeout;
+    const char *name;
+} sig_info[] = {
+    {SIGINT, 2, "SIGINT"},
+    {SIGTERM, 5, "SIGTERM"},
+    {SIGKILL, 0, "SIGKILL"},
+};
+
+/*
+ * Terminates the script, escalating from SIGINT to SIGKILL, unless it
+ * has already exited. Reaps the child.
+ *
+ * Blocks for up to the sum of the timeouts; only used at exit, once
+ * the module loop has terminated. See reap_script() for the
+ * asynchronous version.
+ */
+static void
+terminate_script(pid_t pid)
+{
+    if (waitpid(pid, NULL, WNOHANG) == 0) {
+        for (size_t i = 0; i < sizeof(sig_info) / sizeof(sig_info[0]); i++) {
+            struct timeval start;
+            gettimeofday(&start, NULL);
+
+            const int signo = sig_info[i].signo;
+            const int timeout = sig_info[i].timeout;
+            const char *const name __attribute__((unused)) = sig_info[i].name;
+
+            LOG_DBG("sending %s to PID=%u (timeout=%ds)", name, pid, timeout);
+            killpg(pid, signo);
+
+            /*
+             * Child is unlikely to terminate *immediately*. Wait a
+             * *short* period of time before checking waitpid() the
+             * first time
+             */
+            usleep(10000);
+
+            pid_t waited_pid;
+            while ((waited_pid = waitpid(
+                        pid, NULL, timeout > 0 ? WNOHANG : 0)) == 0)
+            {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+
+                struct timeval elapsed;
+                timersub(&now, &start, &elapsed);
+
+                if (elapsed.tv_sec >= timeout)
+                    break;
+
+                /* Don't spinning */
+                thrd_yield();
+                usleep(100000);  /* 100ms */
+            }
+
+            if (waited_pid == pid) {
+                /* Child finally dead */
+                break;
+            }
+        }
+    } else
+        LOG_DBG("PID=%u already terminated", pid);
+}
+
 static void
 destroy(struct module *mod)
 {
     struct private *m = mod->private;
+
+    if (m->comm_fd >= 0)
+        close(m->comm_fd);
+    if (m->reap.pid_fd >= 0)
+        close(m->reap.pid_fd);
+    if (m->pid > 0)
+        terminate_script(m->pid);
+
     m->content->destroy(m->content);
 
     struct tag **tag_array = m->tags.tags;
@@ -290,7 +375,7 @@ process_transaction(struct module *mod, size_t size)
     m->tags.count = idx;
 
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 }
 
 static bool
@@ -335,56 +420,7 @@ data_received(struct module *mod, const char *data, size_t len)
     return true;
 }
 
-static int
-run_loop(struct module *mod, pid_t pid, int comm_fd)
-{
-    int ret = 1;
-
-    while (true) {
-        struct pollfd fds[] = {
-            {.fd = mod->abort_fd, .events = POLLIN},
-            {.fd = comm_fd, .events = POLLIN},
-        };
-
-        int r = poll(fds, sizeof(fds) / sizeof(fds[0]), -1);
-        if (r < 0) {
-            if (errno == EINTR)
-                continue;
-            LOG_ERRNO("failed to poll");
-            break;
-        }
-
-        if (fds[1].revents & POLLIN) {
-            char data[4096];
-            ssize_t amount = read(comm_fd, data, sizeof(data));
-            if (amount < 0) {
-                LOG_ERRNO("failed to read from script");
-                break;
-            }
-
-            LOG_DBG("recv: \"%.*s\"", (int)amount, data);
-
-            data_received(mod, data, amount);
-        }
-
-        if (fds[0].revents & (POLLHUP | POLLIN)) {
-            /* Aborted */
-            struct private *m = mod->private;
-            m->aborted = true;
-            ret = 0;
-            break;
-        }
-
-        if (fds[1].revents & POLLHUP) {
-            /* Child's stdout closed */
-            LOG_DBG("script pipe closed (script terminated?)");
-            ret = 0;
-            break;
-        }
-    }
-
-    return ret;
-}
+static bool on_comm(struct module *mod, int fd, int events);
 
 static int
 execute_script(struct module *mod)
@@ -500,134 +536,184 @@ execute_script(struct module *mod)
     assert(r == 0);
     LOG_DBG("script running under PID=%u", pid);
 
-    int ret = run_loop(mod, pid, comm_pipe[0]);
-    close(comm_pipe[0]);
+    if (!module_add_fd(mod, comm_pipe[0], EPOLLIN, &on_comm)) {
+        close(comm_pipe[0]);
 
-    if (waitpid(pid, NULL, WNOHANG) == 0) {
-        static const struct {
-            int signo;
-            int timeout;
-            const char *name;
-        } sig_info[] = {
-            {SIGINT, 2, "SIGINT"},
-            {SIGTERM, 5, "SIGTERM"},
-            {SIGKILL, 0, "SIGKILL"},
-        };
+        /* Don't wait for a graceful exit on the loop thread */
+        killpg(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
 
-        for (size_t i = 0; i < sizeof(sig_info) / sizeof(sig_info[0]); i++) {
-            struct timeval start;
-            gettimeofday(&start, NULL);
+    m->pid = pid;
+    m->comm_fd = comm_pipe[0];
+    return 0;
+}
 
-            const int signo = sig_info[i].signo;
-            const int timeout = sig_info[i].timeout;
-            const char *const name __attribute__((unused)) = sig_info[i].name;
+static bool
+on_timer(struct module *mod)
+{
+    return execute_script(mod) == 0;
+}
 
-            LOG_DBG("sending %s to PID=%u (timeout=%ds)", name, pid, timeout);
-            killpg(pid, signo);
+/* Called once the script has been reaped; re-schedules it, if polling */
+static bool
+script_reaped(struct module *mod)
+{
+    struct private *m = mod->private;
 
-            /*
-             * Child is unlikely to terminate *immediately*. Wait a
-             * *short* period of time before checking waitpid() the
-             * first time
-             */
-            usleep(10000);
+    if (m->reap.pid_fd >= 0) {
+        module_del_fd(mod, m->reap.pid_fd);
+        close(m->reap.pid_fd);
+        m->reap.pid_fd = -1;
+    }
 
-            pid_t waited_pid;
-            while ((waited_pid = waitpid(
-                        pid, NULL, timeout > 0 ? WNOHANG : 0)) == 0)
-            {
-                struct timeval now;
-                gettimeofday(&now, NULL);
+    m->pid = 0;
+    module_cancel_timer(mod);
 
-                struct timeval elapsed;
-                timersub(&now, &start, &elapsed);
+    if (m->poll_interval <= 0)
+        return true;
 
-                if (elapsed.tv_sec >= timeout)
-                    break;
+    /*
+     * Execute the script again once the interval has passed. It's not
+     * critical exactly when, so let it be batched with other timers.
+     */
+    module_set_timer_slack(mod, m->poll_interval / 10);
+    return module_set_timer(mod, m->poll_interval, 0, &on_timer);
+}
 
-                /* Don't spinning */
-                thrd_yield();
-                usleep(100000);  /* 100ms */
-            }
+static bool signal_script(struct module *mod);
 
-            if (waited_pid == pid) {
-                /* Child finally dead */
-                break;
-            }
-        }
-    } else
-        LOG_DBG("PID=%u already terminated", pid);
+static bool
+on_script_exited(struct module *mod, int fd, int events)
+{
+    struct private *m = mod->private;
 
-    return ret;
+    /* The pidfd is readable; the child has exited, and won't block */
+    if (waitpid(m->pid, NULL, WNOHANG) != m->pid) {
+        LOG_ERRNO("PID=%u: failed to reap", m->pid);
+        return false;
+    }
+
+    LOG_DBG("PID=%u terminated", m->pid);
+    return script_reaped(mod);
 }
 
-static int
-run(struct module *mod)
+static bool
+on_terminate_timeout(struct module *mod)
 {
     struct private *m = mod->private;
 
-    int ret = 1;
-    bool keep_going = true;
+    if (waitpid(m->pid, NULL, WNOHANG) == m->pid)
+        return script_reaped(mod);
 
-    while (keep_going && !m->aborted) {
-        ret = execute_script(mod);
+    /* Without a pidfd, we poll; escalate only once the stage is over */
+    if (m->reap.pid_fd < 0 && --m->reap.polls > 0)
+        return true;
 
-        if (ret != 0)
-            break;
-        if (m->aborted)
-            break;
-        if (m->poll_interval <= 0)
-            break;
+    if (m->reap.stage + 1 < sizeof(sig_info) / sizeof(sig_info[0]))
+        m->reap.stage++;
 
-        struct timeval now;
-        if (gettimeofday(&now, NULL)  < 0) {
-            LOG_ERRNO("failed to get current time");
-            break;
+    return signal_script(mod);
+}
+
+/* Sends the current stage's signal, and arms its timeout */
+static bool
+signal_script(struct module *mod)
+{
+    struct private *m = mod->private;
+
+    const int signo = sig_info[m->reap.stage].signo;
+    const int timeout = sig_info[m->reap.stage].timeout;
+    const char *const name __attribute__((unused)) = sig_info[m->reap.stage].name;
+
+    LOG_DBG("sending %s to PID=%u (timeout=%ds)", name, m->pid, timeout);
+    killpg(m->pid, signo);
+
+    module_set_timer_slack(mod, 0);
+
+    if (m->reap.pid_fd >= 0) {
+        /* SIGKILL can't be ignored; the pidfd will signal the exit */
+        if (timeout == 0) {
+            module_cancel_timer(mod);
+            return true;
         }
 
-        struct timeval poll_interval = {
-            .tv_sec = m->poll_interval / 1000,
-            .tv_usec = (m->poll_interval % 1000) * 1000,
-        };
+        return module_set_timer(mod, timeout * 1000, 0, &on_terminate_timeout);
+    }
 
-        struct timeval timeout;
-        timeradd(&now, &poll_interval, &timeout);
+    m->reap.polls = timeout * 10;
+    return module_set_timer(mod, 100, 100, &on_terminate_timeout);
+}
 
-        while (true) {
-            struct pollfd fds[] = {{.fd = mod->abort_fd, .events = POLLIN}};
+/*
+ * Terminates the script, escalating from SIGINT to SIGKILL, without
+ * blocking the module loop: the child's exit is watched through a
+ * pidfd (or, on kernels without pidfd_open(), polled for), and each
+ * escalation is a timeout on the module's timer.
+ */
+static bool
+reap_script(struct module *mod)
+{
+    struct private *m = mod->private;
 
-            struct timeval now;
-            if (gettimeofday(&now, NULL) < 0) {
-                LOG_ERRNO("failed to get current time");
-                keep_going = false;
-                break;
-            }
+    if (waitpid(m->pid, NULL, WNOHANG) == m->pid) {
+        LOG_DBG("PID=%u already terminated", m->pid);
+        return script_reaped(mod);
+    }
 
-            if (!timercmp(&now, &timeout, <)) {
-                /* We’ve reached the timeout, it’s time to execute the script again */
-                break;
-            }
+    m->reap.pid_fd = -1;
+    m->reap.stage = 0;
 
-            struct timeval time_left;
-            timersub(&timeout, &now, &time_left);
+#if defined(SYS_pidfd_open)
+    int pid_fd = syscall(SYS_pidfd_open, m->pid, 0);
+    if (pid_fd >= 0) {
+        if (module_add_fd(mod, pid_fd, EPOLLIN, &on_script_exited))
+            m->reap.pid_fd = pid_fd;
+        else
+            close(pid_fd);
+    }
+#endif
 
-            int r = poll(fds, 1, time_left.tv_sec * 1000 + time_left.tv_usec / 1000);
-            if (r < 0) {
-                if (errno == EINTR)
-                    continue;
-                LOG_ERRNO("failed to poll");
-                keep_going = false;
-                break;
-            }
+    return signal_script(mod);
+}
 
-            if (r > 0) {
-                m->aborted = true;
-                break;
-            }
+static bool
+on_comm(struct module *mod, int fd, int events)
+{
+    struct private *m = mod->private;
+
+    if (events & EPOLLIN) {
+        char data[4096];
+        ssize_t amount = read(fd, data, sizeof(data));
+        if (amount < 0) {
+            LOG_ERRNO("failed to read from script");
+            return false;
         }
-    }
 
-    return ret;
+        LOG_DBG("recv: \"%.*s\"", (int)amount, data);
+
+        if (amount > 0) {
+            data_received(mod, data, amount);
+            return true;
+        }
+    } else if (!(events & EPOLLHUP))
+        return true;
+
+    /* Child's stdout closed */
+    LOG_DBG("script pipe closed (script terminated?)");
+
+    module_del_fd(mod, fd);
+    close(m->comm_fd);
+    m->comm_fd = -1;
+
+    return reap_script(mod);
+}
+
+static bool
+setup(struct module *mod)
+{
+    return execute_script(mod) == 0;
 }
 
 static struct module *
@@ -642,10 +728,12 @@ script_new(char *path, size_t argc, const char *const argv[static argc],
     for (size_t i = 0; i < argc; i++)
         m->argv[i] = strdup(argv[i]);
     m->poll_interval = poll_interval;
+    m->comm_fd = -1;
+    m->reap.pid_fd = -1;
 
     struct module *mod = module_common_new();
     mod->private = m;
-    mod->run = &run;
+    mod->setup = &setup;
     mod->destroy = &destroy;
     mod->content = &content;
     mod->description = &description;
@@ -383,7 +383,6 @@ register_for_events(xcb_connection_t *conn)
 static bool
 event_loop(struct module *mod, xcb_connection_t *conn, int xkb_event_base)
 {
-    const struct bar *bar = mod->bar;
     struct private *m = mod->private;
 
     bool ret = false;
@@ -461,7 +460,7 @@ event_loop(struct module *mod, xcb_connection_t *conn, int xkb_event_base)
                     m->layouts = layouts;
                     m->indicators = indicators;
                     mtx_unlock(&mod->lock);
-                    bar->refresh(bar);
+                    module_signal_refresh(mod);
                 } else {
                      /* Can happen while transitioning to a new map */
                     free_layouts(layouts);
@@ -479,7 +478,7 @@ event_loop(struct module *mod, xcb_connection_t *conn, int xkb_event_base)
                     mtx_lock(&mod->lock);
                     m->current = evt->group;
                     mtx_unlock(&mod->lock);
-                    bar->refresh(bar);
+                    module_signal_refresh(mod);
                 }
 
                 break;
@@ -532,7 +531,7 @@ event_loop(struct module *mod, xcb_connection_t *conn, int xkb_event_base)
                 }
 
                 if (need_refresh)
-                    bar->refresh(bar);
+                    module_signal_refresh(mod);
                 break;
             }
             }
@@ -631,7 +630,7 @@ talk_to_xkb(struct module *mod, xcb_connection_t *conn)
     m->num_lock = num_lock;
     m->scroll_lock = scroll_lock;
     mtx_unlock(&mod->lock);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 
     return event_loop(mod, conn, xkb_event_base);
 }
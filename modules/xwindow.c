@@ -246,7 +246,7 @@ run(struct module *mod)
     update_active_window(m);
     update_application(mod);
     update_title(mod);
-    mod->bar->refresh(mod->bar);
+    module_signal_refresh(mod);
 
     int ret = 1;
 
@@ -285,14 +285,14 @@ run(struct module *mod)
                     update_active_window(m);
                     update_application(mod);
                     update_title(mod);
-                    mod->bar->refresh(mod->bar);
+                    module_signal_refresh(mod);
                 } else if (e->atom == _NET_WM_VISIBLE_NAME ||
                            e->atom == _NET_WM_NAME ||
                            e->atom == XCB_ATOM_WM_NAME)
                 {
                     assert(e->window == m->active_win);
                     update_title(mod);
-                    mod->bar->refresh(mod->bar);
+                    module_signal_refresh(mod);
                 }
                 break;
             }
@@ -15,6 +15,7 @@
 #define LOG_MODULE "particle"
 #define LOG_ENABLE_DBG 0
 #include "log.h"
+#include "arena.h"
 #include "bar/bar.h"
 
 void
@@ -23,8 +24,10 @@ particle_default_destroy(struct particle *particle)
     if (particle->deco != NULL)
         particle->deco->destroy(particle->deco);
     fcft_destroy(particle->font);
-    for (size_t i = 0; i < MOUSE_BTN_COUNT; i++)
+    for (size_t i = 0; i < MOUSE_BTN_COUNT; i++) {
+        tag_template_destroy(particle->on_click_compiled[i]);
         free(particle->on_click_templates[i]);
+    }
     free(particle);
 }
 
@@ -47,6 +50,7 @@ particle_common_new(int left_margin, int right_margin,
             if (on_click_templates[i] != NULL) {
                 p->have_on_click_template = true;
                 p->on_click_templates[i] = on_click_templates[i];
+                p->on_click_compiled[i] = tag_template_compile(on_click_templates[i]);
             }
         }
     }
@@ -58,8 +62,8 @@ void
 exposable_default_destroy(struct exposable *exposable)
 {
     for (size_t i = 0; i < MOUSE_BTN_COUNT; i++)
-        free(exposable->on_click[i]);
-    free(exposable);
+        frame_free(exposable->on_click[i]);
+    frame_free(exposable);
 }
 
 void
@@ -312,14 +316,15 @@ exposable_default_on_mouse(struct exposable *exposable, struct bar *bar,
 struct exposable *
 exposable_common_new(const struct particle *particle, const struct tag_set *tags)
 {
-    struct exposable *exposable = calloc(1, sizeof(*exposable));
+    struct exposable *exposable = frame_calloc(1, sizeof(*exposable));
     exposable->particle = particle;
 
     if (particle != NULL && particle->have_on_click_template) {
-        tags_expand_templates(
-            exposable->on_click,
-            (const char **)particle->on_click_templates,
-            MOUSE_BTN_COUNT, tags);
+        for (size_t i = 0; i < MOUSE_BTN_COUNT; i++) {
+            struct tag_template *template = particle->on_click_compiled[i];
+            if (template != NULL)
+                exposable->on_click[i] = frame_strdup(tag_template_expand(template, tags));
+        }
     }
     exposable->destroy = &exposable_default_destroy;
     exposable->on_mouse = &exposable_default_on_mouse;
@@ -35,6 +35,7 @@ struct particle {
 
     bool have_on_click_template;
     char *on_click_templates[MOUSE_BTN_COUNT];
+    struct tag_template *on_click_compiled[MOUSE_BTN_COUNT];
 
     pixman_color_t foreground;
     struct fcft_font *font;
@@ -5,6 +5,7 @@
 
 #define LOG_MODULE "dynlist"
 #include "../log.h"
+#include "../arena.h"
 #include "../particle.h"
 
 struct private {
@@ -25,10 +26,10 @@ dynlist_destroy(struct exposable *exposable)
         ee->destroy(ee);
     }
 
-    free(e->exposables);
-    free(e->widths);
-    free(e);
-    free(exposable);
+    frame_free(e->exposables);
+    frame_free(e->widths);
+    frame_free(e);
+    frame_free(exposable);
 }
 
 static int
@@ -107,10 +108,10 @@ struct exposable *
 dynlist_exposable_new(struct exposable **exposables, size_t count,
                       int left_spacing, int right_spacing)
 {
-    struct private *e = calloc(1, sizeof(*e));
+    struct private *e = frame_calloc(1, sizeof(*e));
     e->count = count;
-    e->exposables = malloc(count * sizeof(e->exposables[0]));
-    e->widths = calloc(count, sizeof(e->widths[0]));
+    e->exposables = frame_alloc(count * sizeof(e->exposables[0]));
+    e->widths = frame_calloc(count, sizeof(e->widths[0]));
     e->left_spacing = left_spacing;
     e->right_spacing = right_spacing;
 
@@ -0,0 +1,344 @@
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_MODULE "heatmap"
+#define LOG_ENABLE_DBG 0
+#include "../log.h"
+#include "../arena.h"
+#include "../config.h"
+#include "../config-verify.h"
+#include "../particle.h"
+#include "../plugin.h"
+
+/*
+ * Renders an array tag (see tag_new_int_array()) as a strip of
+ * cells, one per value. Values are quantized to a fixed number of
+ * levels, each with a pre-computed color. Cells are grouped by level
+ * when instantiated; rendering is then a single pass over the cells,
+ * with one fill per level in use, regardless of the number of cells.
+ */
+#define LEVEL_COUNT 16
+
+enum style { STYLE_HEATMAP, STYLE_SPARKLINE };
+
+struct private {
+    struct tag_ref tag;
+    enum style style;
+    int cell_width;
+    int spacing;
+    pixman_color_t levels[LEVEL_COUNT];
+};
+
+struct eprivate {
+    uint8_t *values;  /* Clamped to [min, max] */
+    size_t count;
+    long min;
+    long max;
+
+    /*
+     * Cell indices, grouped by level; level N's cells are
+     * order[first[N]] to order[first[N + 1] - 1]. Computed once, at
+     * instantiation; expose() only fills in the rectangles.
+     */
+    uint16_t *order;
+    size_t first[LEVEL_COUNT + 1];
+    pixman_rectangle16_t *rects;
+};
+
+static void
+exposable_destroy(struct exposable *exposable)
+{
+    struct eprivate *e = exposable->private;
+    frame_free(e->values);
+    frame_free(e->order);
+    frame_free(e->rects);
+    frame_free(e);
+    exposable_default_destroy(exposable);
+}
+
+static int
+begin_expose(struct exposable *exposable)
+{
+    const struct particle *particle = exposable->particle;
+    const struct private *p = particle->private;
+    const struct eprivate *e = exposable->private;
+
+    int width = 0;
+    if (e->count > 0) {
+        width = e->count * p->cell_width + (e->count - 1) * p->spacing +
+            particle->left_margin + particle->right_margin;
+    }
+
+    exposable->width = width;
+    return exposable->width;
+}
+
+static void
+expose(const struct exposable *exposable, pixman_image_t *pix, int x, int y, int height)
+{
+    const struct particle *particle = exposable->particle;
+    const struct private *p = particle->private;
+    const struct eprivate *e = exposable->private;
+
+    exposable_render_deco(exposable, pix, x, y, height);
+
+    const long range = e->max - e->min;
+    const int left = x + particle->left_margin;
+
+    for (size_t level = 0; level < LEVEL_COUNT; level++) {
+        const size_t first = e->first[level];
+        const size_t last = e->first[level + 1];
+
+        if (first == last)
+            continue;
+
+        for (size_t i = first; i < last; i++) {
+            const size_t cell = e->order[i];
+
+            int cell_height = height;
+            if (p->style == STYLE_SPARKLINE && range > 0)
+                cell_height = height * (e->values[cell] - e->min) / range;
+
+            e->rects[i] = (pixman_rectangle16_t){
+                left + cell * (p->cell_width + p->spacing),
+                y + height - cell_height,
+                p->cell_width, cell_height};
+        }
+
+        pixman_image_fill_rectangles(
+            PIXMAN_OP_OVER, pix, &p->levels[level], last - first, &e->rects[first]);
+    }
+}
+
+static struct exposable *
+instantiate(const struct particle *particle, const struct tag_set *tags)
+{
+    struct private *p = particle->private;
+    const struct tag *tag = tag_for_ref(tags, &p->tag);
+
+    struct eprivate *e = frame_calloc(1, sizeof(*e));
+
+    const uint8_t *values = NULL;
+    if (tag != NULL) {
+        e->count = tag->as_array(tag, &values);
+        e->min = tag->min(tag);
+        e->max = tag->max(tag);
+
+        if (e->min > e->max) {
+            LOG_WARN(
+                "tag's minimum value is greater than its maximum: "
+                "tag=\"%s\", min=%ld, max=%ld",
+                tag_atom_name(p->tag.atom), e->min, e->max);
+            e->min = e->max;
+        }
+    }
+
+    if (e->count > UINT16_MAX)
+        e->count = UINT16_MAX;
+
+    if (e->count > 0) {
+        const long range = e->max - e->min;
+
+        e->values = frame_alloc(e->count);
+        e->order = frame_alloc(e->count * sizeof(e->order[0]));
+        e->rects = frame_alloc(e->count * sizeof(e->rects[0]));
+
+        uint8_t *levels = frame_alloc(e->count);
+        size_t per_level[LEVEL_COUNT] = {0};
+
+        for (size_t i = 0; i < e->count; i++) {
+            long v = values[i];
+            v = v < e->min ? e->min : v > e->max ? e->max : v;
+
+            e->values[i] = v;
+            levels[i] = range > 0 ? (v - e->min) * (LEVEL_COUNT - 1) / range : 0;
+            per_level[levels[i]]++;
+        }
+
+        for (size_t level = 0; level < LEVEL_COUNT; level++)
+            e->first[level + 1] = e->first[level] + per_level[level];
+
+        size_t next[LEVEL_COUNT];
+        memcpy(next, e->first, sizeof(next));
+
+        for (size_t i = 0; i < e->count; i++)
+            e->order[next[levels[i]]++] = i;
+
+        frame_free(levels);
+    }
+
+    struct exposable *exposable = exposable_common_new(particle, tags);
+    exposable->private = e;
+    exposable->destroy = &exposable_destroy;
+    exposable->begin_expose = &begin_expose;
+    exposable->expose = &expose;
+    return exposable;
+}
+
+static void
+particle_destroy(struct particle *particle)
+{
+    free(particle->private);
+    particle_default_destroy(particle);
+}
+
+static uint16_t
+lerp(uint16_t from, uint16_t to, size_t step, size_t steps)
+{
+    return from + ((long)to - from) * (long)step / (long)steps;
+}
+
+/*
+ * Spreads the configured colors evenly over the levels, and
+ * interpolates between them.
+ */
+static void
+compute_levels(pixman_color_t levels[static LEVEL_COUNT],
+               const pixman_color_t *colors, size_t count)
+{
+    if (count == 1) {
+        for (size_t i = 0; i < LEVEL_COUNT; i++)
+            levels[i] = colors[0];
+        return;
+    }
+
+    const size_t steps = LEVEL_COUNT - 1;
+
+    for (size_t i = 0; i < LEVEL_COUNT; i++) {
+        /* Position in the gradient, in 1/steps:th of a segment */
+        const size_t pos = i * (count - 1);
+
+        size_t seg = pos / steps;
+        if (seg >= count - 1)
+            seg = count - 2;
+
+        const size_t step = pos - seg * steps;
+        const pixman_color_t *a = &colors[seg];
+        const pixman_color_t *b = &colors[seg + 1];
+
+        levels[i] = (pixman_color_t){
+            .red = lerp(a->red, b->red, step, steps),
+            .green = lerp(a->green, b->green, step, steps),
+            .blue = lerp(a->blue, b->blue, step, steps),
+            .alpha = lerp(a->alpha, b->alpha, step, steps),
+        };
+    }
+}
+
+static struct particle *
+heatmap_new(struct particle *common, const char *tag, enum style style,
+            int cell_width, int spacing,
+            const pixman_color_t *colors, size_t color_count)
+{
+    struct private *priv = calloc(1, sizeof(*priv));
+    tag_ref_init(&priv->tag, tag);
+    priv->style = style;
+    priv->cell_width = cell_width;
+    priv->spacing = spacing;
+    compute_levels(priv->levels, colors, color_count);
+
+    common->private = priv;
+    common->destroy = &particle_destroy;
+    common->instantiate = &instantiate;
+    return common;
+}
+
+static struct particle *
+from_conf(const struct yml_node *node, struct particle *common)
+{
+    const struct yml_node *tag = yml_get_value(node, "tag");
+    const struct yml_node *style = yml_get_value(node, "style");
+    const struct yml_node *cell_width = yml_get_value(node, "cell-width");
+    const struct yml_node *spacing = yml_get_value(node, "spacing");
+    const struct yml_node *colors = yml_get_value(node, "colors");
+
+    const size_t color_count = colors != NULL ? yml_list_length(colors) : 0;
+    pixman_color_t color_list[color_count > 0 ? color_count : 2];
+
+    if (colors != NULL) {
+        size_t idx = 0;
+        for (struct yml_list_iter it = yml_list_iter(colors);
+             it.node != NULL;
+             yml_list_next(&it), idx++)
+        {
+            color_list[idx] = conf_to_color(it.node);
+        }
+    } else {
+        /* Fade in the foreground color (colors are pre-multiplied) */
+        pixman_color_t faint = common->foreground;
+        faint.alpha /= 4;
+        faint.red /= 4;
+        faint.green /= 4;
+        faint.blue /= 4;
+
+        color_list[0] = faint;
+        color_list[1] = common->foreground;
+    }
+
+    return heatmap_new(
+        common, yml_value_as_string(tag),
+        (style != NULL && strcmp(yml_value_as_string(style), "sparkline") == 0
+         ? STYLE_SPARKLINE : STYLE_HEATMAP),
+        cell_width != NULL ? yml_value_as_int(cell_width) : 4,
+        spacing != NULL ? yml_value_as_int(spacing) : 1,
+        color_list, colors != NULL ? color_count : 2);
+}
+
+static bool
+verify_style(keychain_t *chain, const struct yml_node *node)
+{
+    static const char *styles[] = {"heatmap", "sparkline"};
+    return conf_verify_enum(chain, node, styles, sizeof(styles) / sizeof(styles[0]));
+}
+
+static bool
+verify_cell_width(keychain_t *chain, const struct yml_node *node)
+{
+    if (!conf_verify_unsigned(chain, node))
+        return false;
+
+    if (yml_value_as_int(node) < 1) {
+        LOG_ERR("%s: cell width must be at least 1", conf_err_prefix(chain, node));
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+verify_colors(keychain_t *chain, const struct yml_node *node)
+{
+    if (!conf_verify_list(chain, node, &conf_verify_color))
+        return false;
+
+    if (yml_list_length(node) < 1) {
+        LOG_ERR("%s: must contain at least one color", conf_err_prefix(chain, node));
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+verify_conf(keychain_t *chain, const struct yml_node *node)
+{
+    static const struct attr_info attrs[] = {
+        {"tag", true, &conf_verify_string},
+        {"style", false, &verify_style},
+        {"cell-width", false, &verify_cell_width},
+        {"spacing", false, &conf_verify_unsigned},
+        {"colors", false, &verify_colors},
+        PARTICLE_COMMON_ATTRS,
+    };
+
+    return conf_verify_dict(chain, node, attrs);
+}
+
+const struct particle_iface particle_heatmap_iface = {
+    .verify_conf = &verify_conf,
+    .from_conf = &from_conf,
+};
+
+#if defined(CORE_PLUGINS_AS_SHARED_LIBRARIES)
+extern const struct particle_iface iface __attribute__((weak, alias("particle_heatmap_iface")));
+#endif
@@ -3,6 +3,7 @@
 #define LOG_MODULE "list"
 #define LOG_ENABLE_DBG 0
 #include "../log.h"
+#include "../arena.h"
 #include "../config.h"
 #include "../config-verify.h"
 #include "../particle.h"
@@ -29,9 +30,9 @@ exposable_destroy(struct exposable *exposable)
     for (size_t i = 0; i < e->count; i++)
         e->exposables[i]->destroy(e->exposables[i]);
 
-    free(e->exposables);
-    free(e->widths);
-    free(e);
+    frame_free(e->exposables);
+    frame_free(e->widths);
+    frame_free(e);
     exposable_default_destroy(exposable);
 }
 
@@ -122,9 +123,9 @@ instantiate(const struct particle *particle, const struct tag_set *tags)
 {
     const struct private *p = particle->private;
 
-    struct eprivate *e = calloc(1, sizeof(*e));
-    e->exposables = malloc(p->count * sizeof(*e->exposables));
-    e->widths = calloc(p->count, sizeof(*e->widths));
+    struct eprivate *e = frame_calloc(1, sizeof(*e));
+    e->exposables = frame_alloc(p->count * sizeof(*e->exposables));
+    e->widths = frame_calloc(p->count, sizeof(*e->widths));
     e->count = p->count;
     e->left_spacing = p->left_spacing;
     e->right_spacing = p->right_spacing;
@@ -1,10 +1,14 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
 
 #define LOG_MODULE "map"
+#define LOG_ENABLE_DBG 0
 #include "../log.h"
+#include "../arena.h"
 #include "../config.h"
 #include "../config-verify.h"
 #include "../particle.h"
@@ -13,6 +17,14 @@
 
 #include "map.h"
 
+#define WARN_ONCE(cond, fmt, ...)           \
+    do {                                    \
+        if (!(cond)->warned) {              \
+            (cond)->warned = true;          \
+            LOG_WARN(fmt, ## __VA_ARGS__);  \
+        }                                   \
+    } while (0)
+
 static bool
 int_condition(const long tag_value, const long cond_value, enum map_op op)
 {
@@ -23,7 +35,6 @@ int_condition(const long tag_value, const long cond_value, enum map_op op)
     case MAP_OP_LT: return tag_value < cond_value;
     case MAP_OP_GE: return tag_value >= cond_value;
     case MAP_OP_GT: return tag_value > cond_value;
-    case MAP_OP_SELF: LOG_WARN("using int tag as bool");
     default: return false;
     }
 }
@@ -38,7 +49,6 @@ float_condition(const double tag_value, const double cond_value, enum map_op op)
     case MAP_OP_LT: return tag_value < cond_value;
     case MAP_OP_GE: return tag_value >= cond_value;
     case MAP_OP_GT: return tag_value > cond_value;
-    case MAP_OP_SELF: LOG_WARN("using float tag as bool");
     default: return false;
     }
 }
@@ -53,70 +63,77 @@ str_condition(const char* tag_value, const char* cond_value, enum map_op op)
     case MAP_OP_LT: return strcmp(tag_value, cond_value) < 0;
     case MAP_OP_GE: return strcmp(tag_value, cond_value) >= 0;
     case MAP_OP_GT: return strcmp(tag_value, cond_value) > 0;
-    case MAP_OP_SELF: LOG_WARN("using String tag as bool");
     default: return false;
     }
 }
 
 static bool
-eval_comparison(const struct map_condition* map_cond, const struct tag_set *tags)
+literal_usable(struct map_condition *map_cond, enum map_literal_status status,
+               const char *type)
+{
+    switch (status) {
+    case MAP_LITERAL_OK:
+        return true;
+
+    case MAP_LITERAL_RANGE:
+        WARN_ONCE(map_cond, "value %s is too large", map_cond->value);
+        return false;
+
+    case MAP_LITERAL_INVALID:
+        WARN_ONCE(map_cond, "failed to parse %s into %s", map_cond->value, type);
+        return false;
+    }
+
+    return false;
+}
+
+static bool
+eval_comparison(struct map_condition* map_cond, const struct tag_set *tags)
 {
-    const struct tag *tag = tag_for_name(tags, map_cond->tag);
+    const struct tag *tag = tag_for_ref(tags, &map_cond->ref);
     if (tag == NULL) {
-        LOG_WARN("tag %s not found", map_cond->tag);
+        WARN_ONCE(map_cond, "tag %s not found", map_cond->tag);
         return false;
     }
 
-    switch (tag->type(tag)) {
-    case TAG_TYPE_INT: {
-        errno = 0;
-        char *end;
-        const long cond_value = strtol(map_cond->value, &end, 0);
+    const enum tag_type type = tag->type(tag);
 
-        if (errno == ERANGE) {
-            LOG_WARN("value %s is too large", map_cond->value);
-            return false;
-        } else if (*end != '\0') {
-            LOG_WARN("failed to parse %s into int", map_cond->value);
-            return false;
+    if (map_cond->op == MAP_OP_SELF) {
+        switch (type) {
+        case TAG_TYPE_BOOL:   return tag->as_bool(tag);
+        case TAG_TYPE_INT:    WARN_ONCE(map_cond, "using int tag as bool"); break;
+        case TAG_TYPE_FLOAT:  WARN_ONCE(map_cond, "using float tag as bool"); break;
+        case TAG_TYPE_STRING: WARN_ONCE(map_cond, "using String tag as bool"); break;
         }
-
-        const long tag_value = tag->as_int(tag);
-        return int_condition(tag_value, cond_value, map_cond->op);
+        return false;
     }
-    case TAG_TYPE_FLOAT: {
-        errno = 0;
-        char *end;
-        const double cond_value = strtod(map_cond->value, &end);
 
-        if (errno == ERANGE) {
-            LOG_WARN("value %s is too large", map_cond->value);
+    switch (type) {
+    case TAG_TYPE_INT:
+        if (!literal_usable(map_cond, map_cond->literal.int_status, "int"))
             return false;
-        } else if (*end != '\0') {
-            LOG_WARN("failed to parse %s into float", map_cond->value);
+        return int_condition(
+            tag->as_int(tag), map_cond->literal.int_value, map_cond->op);
+
+    case TAG_TYPE_FLOAT:
+        if (!literal_usable(map_cond, map_cond->literal.float_status, "float"))
             return false;
-        }
+        return float_condition(
+            tag->as_float(tag), map_cond->literal.float_value, map_cond->op);
 
-        const double tag_value = tag->as_float(tag);
-        return float_condition(tag_value, cond_value, map_cond->op);
-    }
     case TAG_TYPE_BOOL:
-        if (map_cond->op == MAP_OP_SELF)
-            return tag->as_bool(tag);
-        else {
-            LOG_WARN("boolean tag '%s' should be used directly", map_cond->tag);
-            return false;
-        }
-    case TAG_TYPE_STRING: {
-        const char* tag_value = tag->as_string(tag);
-        return str_condition(tag_value, map_cond->value, map_cond->op);
-    }
+        WARN_ONCE(map_cond, "boolean tag '%s' should be used directly", map_cond->tag);
+        return false;
+
+    case TAG_TYPE_STRING:
+        return str_condition(tag->as_string(tag), map_cond->value, map_cond->op);
     }
+
     return false;
 }
 
 static bool
-eval_map_condition(const struct map_condition* map_cond, const struct tag_set *tags)
+eval_map_condition(struct map_condition* map_cond, const struct tag_set *tags)
 {
     switch(map_cond->op) {
     case MAP_OP_NOT:
@@ -135,6 +152,55 @@ eval_map_condition(const struct map_condition* map_cond, const struct tag_set *t
     }
 }
 
+/*
+ * Resolves the tag, and parses the literal as both an int, and a
+ * float; which one is used depends on the type of the tag at the
+ * time the condition is evaluated.
+ */
+static void
+compile_map_condition(struct map_condition *c)
+{
+    switch (c->op) {
+    case MAP_OP_AND:
+    case MAP_OP_OR:
+        compile_map_condition(c->cond2);
+        /* FALLTHROUGH */
+    case MAP_OP_NOT:
+        compile_map_condition(c->cond1);
+        return;
+
+    case MAP_OP_SELF:
+        tag_ref_init(&c->ref, c->tag);
+        c->warned = false;
+        return;
+
+    case MAP_OP_EQ:
+    case MAP_OP_NE:
+    case MAP_OP_LE:
+    case MAP_OP_LT:
+    case MAP_OP_GE:
+    case MAP_OP_GT:
+        break;
+    }
+
+    tag_ref_init(&c->ref, c->tag);
+    c->warned = false;
+
+    char *end;
+
+    errno = 0;
+    c->literal.int_value = strtol(c->value, &end, 0);
+    c->literal.int_status = errno == ERANGE
+        ? MAP_LITERAL_RANGE
+        : *end != '\0' ? MAP_LITERAL_INVALID : MAP_LITERAL_OK;
+
+    errno = 0;
+    c->literal.float_value = strtod(c->value, &end);
+    c->literal.float_status = errno == ERANGE
+        ? MAP_LITERAL_RANGE
+        : *end != '\0' ? MAP_LITERAL_INVALID : MAP_LITERAL_OK;
+}
+
 void
 free_map_condition(struct map_condition* c)
 {
@@ -167,10 +233,41 @@ struct particle_map {
     struct particle *particle;
 };
 
+/*
+ * Memoized selection. The conditions only depend on the values of the
+ * tags they reference ('deps'), so the index of the selected particle
+ * is cached, keyed by those values. Lists (e.g. i3 workspaces)
+ * instantiate the same map once per item, hence more than one entry.
+ */
+#define SELECTION_CACHE_SIZE 16
+
+struct selection {
+    uint64_t hash;
+    char *key;
+    size_t key_len;
+    size_t selected;  /* 'count' selects the default particle */
+    uint64_t last_used;
+};
+
 struct private {
     struct particle *default_particle;
     struct particle_map *map;
     size_t count;
+
+    struct tag_ref *deps;
+    size_t dep_count;
+
+    struct selection selections[SELECTION_CACHE_SIZE];
+    uint64_t clock;
+
+    /* Key of the current instantiation */
+    char *key;
+    size_t key_size;
+
+    struct {
+        uint64_t hits;
+        uint64_t misses;
+    } stats;
 };
 
 struct eprivate {
@@ -183,7 +280,7 @@ exposable_destroy(struct exposable *exposable)
     struct eprivate *e = exposable->private;
     e->exposable->destroy(e->exposable);
 
-    free(e);
+    frame_free(e);
     exposable_default_destroy(exposable);
 }
 
@@ -239,23 +336,123 @@ on_mouse(struct exposable *exposable, struct bar *bar, enum mouse_event event,
     exposable_default_on_mouse(exposable, bar, event, btn, x, y);
 }
 
-static struct exposable *
-instantiate(const struct particle *particle, const struct tag_set *tags)
+static void
+key_append(struct private *p, size_t *len, const void *data, size_t size)
 {
-    const struct private *p = particle->private;
-    struct particle *pp = NULL;
+    if (*len + size > p->key_size) {
+        p->key_size = (*len + size) * 2;
+        p->key = realloc(p->key, p->key_size);
+    }
 
-    for (size_t i = 0; i < p->count; i++) {
-        const struct particle_map *e = &p->map[i];
+    memcpy(&p->key[*len], data, size);
+    *len += size;
+}
+
+/* Serializes the type and value of each tag the conditions depend on */
+static size_t
+build_key(struct private *p, const struct tag_set *tags)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < p->dep_count; i++) {
+        const struct tag *tag = tag_for_ref(tags, &p->deps[i]);
 
-        if (!eval_map_condition(e->condition, tags))
+        if (tag == NULL) {
+            key_append(p, &len, &(uint8_t){0xff}, 1);
             continue;
+        }
 
-        pp = e->particle;
-        break;
+        const enum tag_type type = tag->type(tag);
+        key_append(p, &len, &(uint8_t){type}, 1);
+
+        switch (type) {
+        case TAG_TYPE_BOOL:
+            key_append(p, &len, &(uint8_t){tag->as_bool(tag)}, 1);
+            break;
+
+        case TAG_TYPE_INT:
+            key_append(p, &len, &(long){tag->as_int(tag)}, sizeof(long));
+            break;
+
+        case TAG_TYPE_FLOAT:
+            key_append(p, &len, &(double){tag->as_float(tag)}, sizeof(double));
+            break;
+
+        case TAG_TYPE_STRING: {
+            const char *value = tag->as_string(tag);
+            key_append(p, &len, value, strlen(value) + 1);
+            break;
+        }
+        }
     }
 
-    struct eprivate *e = calloc(1, sizeof(*e));
+    return len;
+}
+
+static uint64_t
+key_hash(const char *key, size_t len)
+{
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)key[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+static size_t
+select_particle(struct private *p, const struct tag_set *tags)
+{
+    const size_t key_len = build_key(p, tags);
+    const uint64_t hash = key_hash(p->key, key_len);
+
+    struct selection *lru = &p->selections[0];
+
+    for (size_t i = 0; i < SELECTION_CACHE_SIZE; i++) {
+        struct selection *sel = &p->selections[i];
+
+        if (sel->key != NULL &&
+            sel->hash == hash &&
+            sel->key_len == key_len &&
+            memcmp(sel->key, p->key, key_len) == 0)
+        {
+            sel->last_used = ++p->clock;
+            p->stats.hits++;
+            return sel->selected;
+        }
+
+        if (sel->last_used < lru->last_used)
+            lru = sel;
+    }
+
+    p->stats.misses++;
+
+    size_t selected = p->count;
+    for (size_t i = 0; i < p->count; i++) {
+        if (eval_map_condition(p->map[i].condition, tags)) {
+            selected = i;
+            break;
+        }
+    }
+
+    free(lru->key);
+    lru->key = malloc(key_len > 0 ? key_len : 1);
+    memcpy(lru->key, p->key, key_len);
+    lru->key_len = key_len;
+    lru->hash = hash;
+    lru->selected = selected;
+    lru->last_used = ++p->clock;
+    return selected;
+}
+
+static struct exposable *
+instantiate(const struct particle *particle, const struct tag_set *tags)
+{
+    struct private *p = particle->private;
+
+    const size_t selected = select_particle(p, tags);
+    struct particle *pp = selected < p->count ? p->map[selected].particle : NULL;
+
+    struct eprivate *e = frame_calloc(1, sizeof(*e));
 
     if (pp != NULL)
         e->exposable = pp->instantiate(pp, tags);
@@ -280,6 +477,9 @@ particle_destroy(struct particle *particle)
 {
     struct private *p = particle->private;
 
+    LOG_DBG("selection cache: hits=%"PRIu64", misses=%"PRIu64,
+            p->stats.hits, p->stats.misses);
+
     if (p->default_particle != NULL)
         p->default_particle->destroy(p->default_particle);
 
@@ -289,11 +489,41 @@ particle_destroy(struct particle *particle)
         free_map_condition(p->map[i].condition);
     }
 
+    for (size_t i = 0; i < SELECTION_CACHE_SIZE; i++)
+        free(p->selections[i].key);
+
+    free(p->key);
+    free(p->deps);
     free(p->map);
     free(p);
     particle_default_destroy(particle);
 }
 
+static void
+add_deps(struct private *p, const struct map_condition *c)
+{
+    switch (c->op) {
+    case MAP_OP_AND:
+    case MAP_OP_OR:
+        add_deps(p, c->cond2);
+        /* FALLTHROUGH */
+    case MAP_OP_NOT:
+        add_deps(p, c->cond1);
+        return;
+
+    default:
+        break;
+    }
+
+    for (size_t i = 0; i < p->dep_count; i++) {
+        if (p->deps[i].atom == c->ref.atom)
+            return;
+    }
+
+    p->deps = realloc(p->deps, (p->dep_count + 1) * sizeof(p->deps[0]));
+    p->deps[p->dep_count++] = c->ref;
+}
+
 static struct particle *
 map_new(struct particle *common, const struct particle_map particle_map[],
         size_t count, struct particle *default_particle)
@@ -306,6 +536,7 @@ map_new(struct particle *common, const struct particle_map particle_map[],
     for (size_t i = 0; i < count; i++) {
         priv->map[i].condition = particle_map[i].condition;
         priv->map[i].particle = particle_map[i].particle;
+        add_deps(priv, priv->map[i].condition);
     }
 
     common->private = priv;
@@ -379,6 +610,7 @@ from_conf(const struct yml_node *node, struct particle *common)
         YY_BUFFER_STATE buffer = yy_scan_string(key_clone);
         yyparse();
         particle_map[idx].condition = MAP_CONDITION_PARSE_RESULT;
+        compile_map_condition(particle_map[idx].condition);
         yy_delete_buffer(buffer);
         free(key_clone);
         particle_map[idx].particle = conf_to_particle(it.value, inherited);
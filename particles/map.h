@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdbool.h>
+
+#include "../tag.h"
+
 enum map_op {
     MAP_OP_EQ,
     MAP_OP_NE,
@@ -14,6 +18,12 @@ enum map_op {
     MAP_OP_OR,
 };
 
+enum map_literal_status {
+    MAP_LITERAL_OK,
+    MAP_LITERAL_INVALID,
+    MAP_LITERAL_RANGE,
+};
+
 struct map_condition {
     union {
         char *tag;
@@ -24,6 +34,22 @@ struct map_condition {
         char *value;
         struct map_condition *cond2;
     };
+
+    /*
+     * Compiled when the configuration is loaded: 'tag' resolved, and
+     * 'value' pre-parsed, since the tag's type is only known when
+     * evaluating.
+     */
+    struct tag_ref ref;
+    struct {
+        enum map_literal_status int_status;
+        long int_value;
+        enum map_literal_status float_status;
+        double float_value;
+    } literal;
+
+    /* Problems are only logged the first time they are seen */
+    bool warned;
 };
 
 void free_map_condition(struct map_condition *c);
@@ -5,13 +5,33 @@
 #define LOG_MODULE "progress_bar"
 #define LOG_ENABLE_DBG 0
 #include "../log.h"
+#include "../arena.h"
 #include "../config.h"
 #include "../config-verify.h"
 #include "../particle.h"
 #include "../plugin.h"
 
+enum cell {
+    CELL_START,
+    CELL_FILL,
+    CELL_INDICATOR,
+    CELL_EMPTY,
+    CELL_END,
+    CELL_COUNT,
+};
+
+/*
+ * A cell rendered on its own, on a transparent background, and tiled
+ * over a run of identical cells
+ */
+struct cell_image {
+    pixman_image_t *pix;
+    int width;
+    int height;
+};
+
 struct private {
-    char *tag;
+    struct tag_ref tag;
     int width;
 
     struct particle *start_marker;
@@ -19,11 +39,26 @@ struct private {
     struct particle *fill;
     struct particle *empty;
     struct particle *indicator;
+
+    /*
+     * Only the fill and empty cells are ever repeated. The images
+     * are kept across frames, and re-allocated only when the cell's
+     * size changes. Their contents are re-rendered once per expose,
+     * since the cells may depend on any of the tags.
+     */
+    struct cell_image images[CELL_COUNT];
 };
 
+/*
+ * All fill cells are instantiated from the same particle, with the
+ * same tags, and are thus identical (and likewise for the empty
+ * cells). Each kind of cell is instantiated once, and exposed once;
+ * runs of more than one cell are tiled from the cell's image. Cells
+ * with a repeat count of 0 are not instantiated.
+ */
 struct eprivate {
-    size_t count;
-    struct exposable **exposables;
+    struct exposable *cells[CELL_COUNT];
+    long repeat[CELL_COUNT];
 };
 
 static void
@@ -37,7 +72,11 @@ particle_destroy(struct particle *particle)
     p->empty->destroy(p->empty);
     p->indicator->destroy(p->indicator);
 
-    free(p->tag);
+    for (size_t i = 0; i < CELL_COUNT; i++) {
+        if (p->images[i].pix != NULL)
+            pixman_image_unref(p->images[i].pix);
+    }
+
     free(p);
     particle_default_destroy(particle);
 }
@@ -46,10 +85,11 @@ static void
 exposable_destroy(struct exposable *exposable)
 {
     struct eprivate *e = exposable->private;
-    for (size_t i = 0; i < e->count; i++)
-        e->exposables[i]->destroy(e->exposables[i]);
-    free(e->exposables);
-    free(e);
+    for (size_t i = 0; i < CELL_COUNT; i++) {
+        if (e->cells[i] != NULL)
+            e->cells[i]->destroy(e->cells[i]);
+    }
+    frame_free(e);
     exposable_default_destroy(exposable);
 }
 
@@ -62,12 +102,16 @@ begin_expose(struct exposable *exposable)
     exposable->width = 0;
 
     /* Sub-exposables */
-    for (size_t i = 0; i < e->count; i++) {
-        int width = e->exposables[i]->begin_expose(e->exposables[i]);
+    for (size_t i = 0; i < CELL_COUNT; i++) {
+        struct exposable *cell = e->cells[i];
+        if (cell == NULL)
+            continue;
+
+        int width = cell->begin_expose(cell);
 
         assert(width >= 0);
         if (width >= 0) {
-            exposable->width += width;
+            exposable->width += width * e->repeat[i];
             have_at_least_one = true;
         }
     }
@@ -82,17 +126,66 @@ begin_expose(struct exposable *exposable)
     return exposable->width;
 }
 
+/*
+ * Renders the cell once, into its (re-used) image, and composites
+ * 'count' copies of it with a single, repeating, composite
+ * operation. Anything the cell draws outside its own width is
+ * clipped.
+ */
+static void
+expose_run(struct cell_image *image, const struct exposable *cell,
+           pixman_image_t *pix, int x, int y, int height, long count)
+{
+    if (image->pix == NULL ||
+        image->width != cell->width || image->height != height)
+    {
+        if (image->pix != NULL)
+            pixman_image_unref(image->pix);
+
+        image->pix = pixman_image_create_bits(
+            PIXMAN_a8r8g8b8, cell->width, height, NULL, 0);
+        image->width = cell->width;
+        image->height = height;
+
+        if (image->pix == NULL) {
+            LOG_ERR("failed to allocate a %dx%d cell image", cell->width, height);
+            return;
+        }
+
+        pixman_image_set_repeat(image->pix, PIXMAN_REPEAT_NORMAL);
+    } else {
+        pixman_image_fill_rectangles(
+            PIXMAN_OP_CLEAR, image->pix, &(pixman_color_t){0}, 1,
+            &(pixman_rectangle16_t){0, 0, image->width, image->height});
+    }
+
+    cell->expose(cell, image->pix, 0, 0, height);
+
+    pixman_image_composite32(
+        PIXMAN_OP_OVER, image->pix, NULL, pix, 0, 0, 0, 0,
+        x, y, cell->width * count, height);
+}
+
 static void
 expose(const struct exposable *exposable, pixman_image_t *pix, int x, int y, int height)
 {
+    struct private *p = exposable->particle->private;
     const struct eprivate *e = exposable->private;
 
     exposable_render_deco(exposable, pix, x, y, height);
 
     x += exposable->particle->left_margin;
-    for (size_t i = 0; i < e->count; i++) {
-        e->exposables[i]->expose(e->exposables[i], pix, x, y, height);
-        x += e->exposables[i]->width;
+    for (size_t i = 0; i < CELL_COUNT; i++) {
+        const struct exposable *cell = e->cells[i];
+        if (cell == NULL)
+            continue;
+
+        if (e->repeat[i] > 1 && cell->width > 0 && height > 0)
+            expose_run(&p->images[i], cell, pix, x, y, height, e->repeat[i]);
+        else if (e->repeat[i] == 1)
+            cell->expose(cell, pix, x, y, height);
+
+        x += cell->width * e->repeat[i];
     }
 }
 
@@ -103,14 +196,16 @@ on_mouse(struct exposable *exposable, struct bar *bar, enum mouse_event event,
     const struct particle *p = exposable->particle;
     const struct eprivate *e = exposable->private;
 
+    struct exposable *start = e->cells[CELL_START];
+    struct exposable *end = e->cells[CELL_END];
+
     /* Start of empty/fill cells */
-    int x_offset = p->left_margin + e->exposables[0]->width;
+    int x_offset = p->left_margin + start->width;
 
     /* Mouse is *before* progress-bar? */
     if (x < x_offset) {
         if (x >= p->left_margin) {
             /* Mouse is over the start-marker */
-            struct exposable *start = e->exposables[0];
             if (start->on_mouse != NULL)
                 start->on_mouse(start, bar, event, btn, x - p->left_margin, y);
         } else {
@@ -122,14 +217,15 @@ on_mouse(struct exposable *exposable, struct bar *bar, enum mouse_event event,
 
     /* Size of the clickable area (the empty/fill cells) */
     int clickable_width = 0;
-    for (size_t i = 1; i < e->count - 1; i++)
-        clickable_width += e->exposables[i]->width;
+    for (size_t i = CELL_FILL; i <= CELL_EMPTY; i++) {
+        if (e->cells[i] != NULL)
+            clickable_width += e->cells[i]->width * e->repeat[i];
+    }
 
     /* Mouse is *after* progress-bar? */
     if (x - x_offset > clickable_width) {
-        if (x - x_offset - clickable_width < e->exposables[e->count - 1]->width) {
+        if (x - x_offset - clickable_width < end->width) {
             /* Mouse is over the end-marker */
-            struct exposable *end = e->exposables[e->count - 1];
             if (end->on_mouse != NULL)
                 end->on_mouse(end, bar, event, btn, x - x_offset - clickable_width, y);
         } else {
@@ -191,8 +287,8 @@ on_mouse(struct exposable *exposable, struct bar *bar, enum mouse_event event,
 static struct exposable *
 instantiate(const struct particle *particle, const struct tag_set *tags)
 {
-    const struct private *p = particle->private;
-    const struct tag *tag = tag_for_name(tags, p->tag);
+    struct private *p = particle->private;
+    const struct tag *tag = tag_for_ref(tags, &p->tag);
 
     long value = tag != NULL ? tag->as_int(tag) : 0;
     long min = tag != NULL ? tag->min(tag) : 0;
@@ -202,30 +298,35 @@ instantiate(const struct particle *particle, const struct tag_set *tags)
             tag != NULL ? tag->name(tag) : "<no tag>", value, min, max);
 
     long fill_count = max == min ? 0 : p->width * value / (max - min);
+    if (fill_count < 0)
+        fill_count = 0;
+    if (fill_count > p->width)
+        fill_count = p->width;
     long empty_count = p->width - fill_count;
 
-    struct eprivate *epriv = calloc(1, sizeof(*epriv));
-    epriv->count = (
-        1 +             /* Start marker */
-        fill_count +    /* Before current position */
-        1 +             /* Current position indicator */
-        empty_count +   /* After current position */
-        1);             /* End marker */
-
-    epriv->exposables = malloc(epriv->count * sizeof(epriv->exposables[0]));
-
-    size_t idx = 0;
-    epriv->exposables[idx++] = p->start_marker->instantiate(p->start_marker, tags);
-    for (size_t i = 0; i < fill_count; i++)
-        epriv->exposables[idx++] = p->fill->instantiate(p->fill, tags);
-    epriv->exposables[idx++] = p->indicator->instantiate(p->indicator, tags);
-    for (size_t i = 0; i < empty_count; i++)
-        epriv->exposables[idx++] = p->empty->instantiate(p->empty, tags);
-    epriv->exposables[idx++] = p->end_marker->instantiate(p->end_marker, tags);
-
-    assert(idx == epriv->count);
-    for (size_t i = 0; i < epriv->count; i++)
-        assert(epriv->exposables[i] != NULL);
+    struct eprivate *epriv = frame_calloc(1, sizeof(*epriv));
+
+    struct particle *const cells[CELL_COUNT] = {
+        [CELL_START] = p->start_marker,
+        [CELL_FILL] = p->fill,            /* Before current position */
+        [CELL_INDICATOR] = p->indicator,  /* Current position */
+        [CELL_EMPTY] = p->empty,          /* After current position */
+        [CELL_END] = p->end_marker,
+    };
+
+    epriv->repeat[CELL_START] = 1;
+    epriv->repeat[CELL_FILL] = fill_count;
+    epriv->repeat[CELL_INDICATOR] = 1;
+    epriv->repeat[CELL_EMPTY] = empty_count;
+    epriv->repeat[CELL_END] = 1;
+
+    for (size_t i = 0; i < CELL_COUNT; i++) {
+        if (epriv->repeat[i] == 0)
+            continue;
+
+        epriv->cells[i] = cells[i]->instantiate(cells[i], tags);
+        assert(epriv->cells[i] != NULL);
+    }
 
     struct exposable *exposable = exposable_common_new(particle, tags);
 
@@ -277,7 +378,7 @@ progress_bar_new(struct particle *common, const char *tag, int width,
                  struct particle *indicator)
 {
     struct private *priv = calloc(1, sizeof(*priv));
-    priv->tag = strdup(tag);
+    tag_ref_init(&priv->tag, tag);
     priv->width = width;
     priv->start_marker = start_marker;
     priv->end_marker = end_marker;
@@ -7,13 +7,14 @@
 #define LOG_MODULE "ramp"
 #define LOG_ENABLE_DBG 0
 #include "../log.h"
+#include "../arena.h"
 #include "../config.h"
 #include "../config-verify.h"
 #include "../particle.h"
 #include "../plugin.h"
 
 struct private {
-    char *tag;
+    struct tag_ref tag;
     bool use_custom_min;
     long min;
     bool use_custom_max;
@@ -32,7 +33,7 @@ exposable_destroy(struct exposable *exposable)
     struct eprivate *e = exposable->private;
     e->exposable->destroy(e->exposable);
 
-    free(e);
+    frame_free(e);
     exposable_default_destroy(exposable);
 }
 
@@ -96,7 +97,6 @@ particle_destroy(struct particle *particle)
     for (size_t i = 0; i < p->count; i++)
         p->particles[i]->destroy(p->particles[i]);
 
-    free(p->tag);
     free(p->particles);
     free(p);
     particle_default_destroy(particle);
@@ -105,8 +105,8 @@ particle_destroy(struct particle *particle)
 static struct exposable *
 instantiate(const struct particle *particle, const struct tag_set *tags)
 {
-    const struct private *p = particle->private;
-    const struct tag *tag = tag_for_name(tags, p->tag);
+    struct private *p = particle->private;
+    const struct tag *tag = tag_for_ref(tags, &p->tag);
 
     assert(p->count > 0);
 
@@ -120,20 +120,23 @@ instantiate(const struct particle *particle, const struct tag_set *tags)
     if (min > max) {
         LOG_WARN(
             "tag's minimum value is greater than its maximum: "
-            "tag=\"%s\", min=%ld, max=%ld", p->tag, min, max);
+            "tag=\"%s\", min=%ld, max=%ld",
+            tag_atom_name(p->tag.atom), min, max);
         min = max;
     }
 
     if (value < min) {
         LOG_WARN(
             "tag's value is less than its minimum value: "
-            "tag=\"%s\", min=%ld, value=%ld", p->tag, min, value);
+            "tag=\"%s\", min=%ld, value=%ld",
+            tag_atom_name(p->tag.atom), min, value);
         value = min;
     }
     if (value > max) {
         LOG_WARN(
             "tag's value is greater than its maximum value: "
-            "tag=\"%s\", max=%ld, value=%ld", p->tag, max, value);
+            "tag=\"%s\", max=%ld, value=%ld",
+            tag_atom_name(p->tag.atom), max, value);
         value = max;
     }
 
@@ -154,7 +157,7 @@ instantiate(const struct particle *particle, const struct tag_set *tags)
 
     struct particle *pp = p->particles[idx];
 
-    struct eprivate *e = calloc(1, sizeof(*e));
+    struct eprivate *e = frame_calloc(1, sizeof(*e));
     e->exposable = pp->instantiate(pp, tags);
     assert(e->exposable != NULL);
 
@@ -175,7 +178,7 @@ ramp_new(struct particle *common, const char *tag,
 {
 
     struct private *priv = calloc(1, sizeof(*priv));
-    priv->tag = strdup(tag);
+    tag_ref_init(&priv->tag, tag);
     priv->particles = malloc(count * sizeof(priv->particles[0]));
     priv->count = count;
     priv->use_custom_max = use_custom_max;
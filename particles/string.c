@@ -1,47 +1,402 @@
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <assert.h>
 
+#include <tllist.h>
+
 #define LOG_MODULE "string"
 #define LOG_ENABLE_DBG 0
 #include "../log.h"
+#include "../arena.h"
 #include "../char32.h"
 #include "../config.h"
 #include "../config-verify.h"
 #include "../particle.h"
 #include "../plugin.h"
 
-struct text_run_cache {
+/* Bytes of pre-rendered strings to keep, per particle */
+static const size_t default_render_cache = 256 * 1024;
+
+/* Bytes of pre-rendered strings to keep, in total, for all particles */
+static const size_t max_total_render_cache = 4 * 1024 * 1024;
+
+/* Distinct strings each particle adds to its font's text run cache */
+static const size_t default_text_cache = 16;
+
+/*
+ * Rasterized strings, cached per font, and shared by all string
+ * particles using that font. Keyed by the expanded text, the
+ * particle's maximum length (which decides the truncation), and
+ * whether the text is shaped.
+ *
+ * Shaped strings are stored as fcft text runs. Unshaped strings are
+ * stored as arrays of per-character glyphs (owned by the font), and
+ * their kerning.
+ *
+ * Entries referenced by an exposable are never evicted; the cache may
+ * temporarily grow past its capacity when all entries are in use.
+ *
+ * All access happens on the bar's thread.
+ */
+struct text_run {
+    char *text;
+    size_t max_len;
+    bool shaping;
     uint64_t hash;
-    struct fcft_text_run *run;
+
+    struct fcft_text_run *run;  /* NULL when not shaped */
+    const struct fcft_glyph **glyphs;
+    long *kern_x;
+    size_t count;
     int width;
-    bool in_use;
+
+    size_t refcount;  /* Number of exposables using this run */
+
+    struct text_run *bucket_next;
+    struct text_run *lru_prev;  /* More recently used */
+    struct text_run *lru_next;  /* Less recently used */
 };
 
-struct private {
+struct text_cache {
+    const struct fcft_font *font;
+    size_t users;     /* Number of particles using this cache */
+    size_t capacity;  /* Sum of the users' capacities */
+
+    size_t count;
+    size_t bucket_count;  /* Power of two */
+    struct text_run **buckets;
+
+    struct text_run *lru_head;
+    struct text_run *lru_tail;
+
+    /* Alpha mask glyphs, keyed by their fcft glyph */
+    pixman_glyph_cache_t *glyph_cache;
+
+    struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    } stats;
+};
+
+static tll(struct text_cache *) text_caches = tll_init();
+
+/*
+ * Pre-rendered glyphs of an expanded string. Each particle has its
+ * own strips, within its own budget ('render-cache'), and all
+ * particles' strips together are kept within max_total_render_cache;
+ * least recently used strips, of any particle, are evicted first.
+ *
+ * Rendering a strip costs more than drawing the glyphs directly, so
+ * one is only rendered for a text seen (drawn) before; text that
+ * changes on every update (e.g. a clock's seconds) never gets one.
+ *
+ * All access happens on the bar's thread.
+ */
+#define STRIP_SEEN_COUNT 16
+
+struct strip_cache {
     char *text;
+    const struct fcft_font *font;
+    pixman_color_t foreground;
+    int height;
+
+    pixman_image_t *pix;
+    int x_ofs;  /* Ink may start left of the pen position */
+    size_t size;
+    uint64_t last_used;
+};
+
+struct private {
+    struct tag_template *text;
     size_t max_len;
 
-    size_t cache_size;
-    struct text_run_cache *cache;
+    /* Byte budget of the strip cache; 0 disables it */
+    size_t strip_budget;
+    size_t strip_size;
+    tll(struct strip_cache) strips;
+
+    /* Hashes of the texts most recently drawn without a strip */
+    uint64_t strip_seen[STRIP_SEEN_COUNT];
+    size_t strip_seen_next;
+
+    struct {
+        uint64_t hits;
+        uint64_t misses;    /* Strip rendered */
+        uint64_t uncached;  /* First sighting, drawn directly */
+    } strip_stats;
+
+    struct text_cache *cache;
+    size_t cache_capacity;  /* Our contribution to the cache's capacity */
+
+    /* Solid source in the particle's foreground color, for all glyphs */
+    pixman_image_t *fg;
 };
 
+/* Particles with a strip cache, and the size of all their strips */
+static tll(struct private *) strip_owners = tll_init();
+static size_t strip_total_size;
+static uint64_t strip_clock;
+
 struct eprivate {
-    ssize_t cache_idx;
+    const char *text;  /* Owned by the cache entry */
+    struct text_run *run;
     const struct fcft_glyph **glyphs;
-    const struct fcft_glyph **allocated_glyphs;
-    long *kern_x;
+    const long *kern_x;
     int num_glyphs;
 };
 
+static void
+lru_unlink(struct text_cache *cache, struct text_run *entry)
+{
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
+
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void
+lru_push_front(struct text_cache *cache, struct text_run *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+
+    if (cache->lru_head != NULL)
+        cache->lru_head->lru_prev = entry;
+    else
+        cache->lru_tail = entry;
+
+    cache->lru_head = entry;
+}
+
+static void
+text_run_free(struct text_cache *cache, struct text_run *entry)
+{
+    if (entry->run != NULL) {
+        /*
+         * A text run's glyphs are owned by the run; drop them from the
+         * glyph cache before they are freed, since their addresses may
+         * be re-used.
+         */
+        for (size_t i = 0; i < entry->run->count; i++) {
+            pixman_glyph_cache_remove(
+                cache->glyph_cache, (void *)cache->font,
+                (void *)entry->run->glyphs[i]);
+        }
+
+        fcft_text_run_destroy(entry->run);
+    } else
+        free(entry->glyphs);
+
+    free(entry->kern_x);
+    free(entry->text);
+    free(entry);
+}
+
+static void
+text_cache_remove(struct text_cache *cache, struct text_run *entry)
+{
+    struct text_run **slot =
+        &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+
+    while (*slot != entry)
+        slot = &(*slot)->bucket_next;
+    *slot = entry->bucket_next;
+
+    lru_unlink(cache, entry);
+    cache->count--;
+    text_run_free(cache, entry);
+}
+
+/* Evicts least recently used, unreferenced, runs until within capacity */
+static void
+text_cache_trim(struct text_cache *cache)
+{
+    struct text_run *entry = cache->lru_tail;
+
+    while (cache->count > cache->capacity && entry != NULL) {
+        struct text_run *prev = entry->lru_prev;
+
+        if (entry->refcount == 0) {
+            text_cache_remove(cache, entry);
+            cache->stats.evictions++;
+        }
+
+        entry = prev;
+    }
+}
+
+static void
+text_cache_rehash(struct text_cache *cache, size_t bucket_count)
+{
+    struct text_run **buckets = calloc(bucket_count, sizeof(buckets[0]));
+
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        struct text_run *entry = cache->buckets[i];
+        while (entry != NULL) {
+            struct text_run *next = entry->bucket_next;
+            struct text_run **slot = &buckets[entry->hash & (bucket_count - 1)];
+
+            entry->bucket_next = *slot;
+            *slot = entry;
+            entry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
+
+static struct text_cache *
+text_cache_ref(const struct fcft_font *font, size_t capacity)
+{
+    struct text_cache *cache = NULL;
+
+    tll_foreach(text_caches, it) {
+        if (it->item->font == font) {
+            cache = it->item;
+            break;
+        }
+    }
+
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(*cache));
+        cache->font = font;
+        cache->glyph_cache = pixman_glyph_cache_create();
+        text_cache_rehash(cache, 16);
+        tll_push_back(text_caches, cache);
+    }
+
+    cache->users++;
+    cache->capacity += capacity;
+    return cache;
+}
+
+static void
+text_cache_unref(struct text_cache *cache, size_t capacity)
+{
+    assert(cache->users > 0);
+    assert(cache->capacity >= capacity);
+
+    cache->capacity -= capacity;
+    text_cache_trim(cache);
+
+    if (--cache->users > 0)
+        return;
+
+    LOG_DBG("text run cache: hits=%"PRIu64", misses=%"PRIu64", "
+            "evictions=%"PRIu64,
+            cache->stats.hits, cache->stats.misses, cache->stats.evictions);
+
+    /* All exposables are gone; nothing is referenced anymore */
+    assert(cache->count == 0);
+
+    tll_foreach(text_caches, it) {
+        if (it->item == cache) {
+            tll_remove(text_caches, it);
+            break;
+        }
+    }
+
+    pixman_glyph_cache_destroy(cache->glyph_cache);
+    free(cache->buckets);
+    free(cache);
+}
+
+static struct text_run *
+text_cache_lookup(struct text_cache *cache, const char *text,
+                  size_t max_len, bool shaping, uint64_t hash)
+{
+    for (struct text_run *entry =
+             cache->buckets[hash & (cache->bucket_count - 1)];
+         entry != NULL;
+         entry = entry->bucket_next)
+    {
+        if (entry->hash == hash &&
+            entry->max_len == max_len &&
+            entry->shaping == shaping &&
+            strcmp(entry->text, text) == 0)
+        {
+            /* Mark as most recently used */
+            lru_unlink(cache, entry);
+            lru_push_front(cache, entry);
+
+            entry->refcount++;
+            cache->stats.hits++;
+            return entry;
+        }
+    }
+
+    cache->stats.misses++;
+    return NULL;
+}
+
+/*
+ * Takes ownership of 'run', or, if NULL, of 'glyphs'. Takes ownership
+ * of 'kern_x' in both cases.
+ */
+static struct text_run *
+text_cache_insert(struct text_cache *cache, const char *text, size_t max_len,
+                  bool shaping, uint64_t hash, struct fcft_text_run *run,
+                  const struct fcft_glyph **glyphs, long *kern_x, size_t count)
+{
+    struct text_run *entry = calloc(1, sizeof(*entry));
+    entry->text = strdup(text);
+    entry->max_len = max_len;
+    entry->shaping = shaping;
+    entry->hash = hash;
+    entry->run = run;
+    entry->glyphs = run != NULL ? run->glyphs : glyphs;
+    entry->kern_x = kern_x;
+    entry->count = run != NULL ? run->count : count;
+    entry->refcount = 1;
+
+    for (size_t i = 0; i < entry->count; i++)
+        entry->width += entry->kern_x[i] + entry->glyphs[i]->advance.x;
+
+    struct text_run **slot = &cache->buckets[hash & (cache->bucket_count - 1)];
+    entry->bucket_next = *slot;
+    *slot = entry;
+    lru_push_front(cache, entry);
+
+    if (++cache->count > cache->bucket_count)
+        text_cache_rehash(cache, cache->bucket_count * 2);
+
+    text_cache_trim(cache);
+    return entry;
+}
+
+static void
+text_cache_release(struct text_cache *cache, struct text_run *entry)
+{
+    assert(entry->refcount > 0);
+    if (--entry->refcount == 0)
+        text_cache_trim(cache);
+}
+
 static void
 exposable_destroy(struct exposable *exposable)
 {
     struct eprivate *e = exposable->private;
 
-    free(e->allocated_glyphs);
-    free(e->kern_x);
-    free(e);
+    /*
+     * The bar may keep an exposable (and thus its cached text run)
+     * across several frames; only release the cache entry once the
+     * exposable is gone.
+     */
+    struct private *priv = exposable->particle->private;
+    text_cache_release(priv->cache, e->run);
+
+    frame_free(e);
     exposable_default_destroy(exposable);
 }
 
@@ -49,61 +404,69 @@ static int
 begin_expose(struct exposable *exposable)
 {
     struct eprivate *e = exposable->private;
-    struct private *p = exposable->particle->private;
 
     exposable->width =
         exposable->particle->left_margin +
+        e->run->width +
         exposable->particle->right_margin;
 
-    if (e->cache_idx >= 0) {
-        exposable->width += p->cache[e->cache_idx].width;
-    } else {
-        /* Calculate the size we need to render the glyphs */
-        for (int i = 0; i < e->num_glyphs; i++)
-            exposable->width += e->kern_x[i] + e->glyphs[i]->advance.x;
-    }
-
     return exposable->width;
 }
 
 static void
-expose(const struct exposable *exposable, pixman_image_t *pix, int x, int y, int height)
+flush_glyphs(const struct private *p, pixman_image_t *pix,
+             const pixman_glyph_t *glyphs, int count)
 {
-    exposable_render_deco(exposable, pix, x, y, height);
+    if (count == 0)
+        return;
 
-    const struct eprivate *e = exposable->private;
-    const struct fcft_font *font = exposable->particle->font;
+    pixman_composite_glyphs_no_mask(
+        PIXMAN_OP_OVER, p->fg, pix, 0, 0, 0, 0, p->cache->glyph_cache,
+        count, glyphs);
+}
 
-    if (e->cache_idx >= 0) {
-        struct private *priv = exposable->particle->private;
-        priv->cache[e->cache_idx].in_use = false;
-    }
+/*
+ * This tries to center the font around the bar center, by using
+ * the font's ascent+descent as total height, and then removing
+ * its descent. This way, the part of the font *above* the
+ * baseline is centered.
+ *
+ * "EEEE" will typically be dead center, with the middle of each character being in the bar's center.
+ * "eee" will be slightly below the center.
+ * "jjj" will be even further below the center.
+ *
+ * Finally, if the font's descent is negative, ignore it (except
+ * for the height calculation). This is unfortunately not based on
+ * any real facts, but works very well with e.g. the "Awesome 6"
+ * font family.
+ */
+static double
+baseline_for(const struct fcft_font *font, int y, int height)
+{
+    return (double)y +
+        (double)(height + font->ascent + font->descent) / 2.0 -
+        (font->descent > 0 ? font->descent : 0);
+}
 
-    if (e->num_glyphs == 0)
-        return;
+static void
+render_glyphs(const struct exposable *exposable, pixman_image_t *pix,
+              int x, double baseline)
+{
+    const struct eprivate *e = exposable->private;
+    const struct fcft_font *font = exposable->particle->font;
+    const struct private *p = exposable->particle->private;
+    pixman_glyph_cache_t *glyph_cache = p->cache->glyph_cache;
 
     /*
-     * This tries to center the font around the bar center, by using
-     * the font's ascent+descent as total height, and then removing
-     * its descent. This way, the part of the font *above* the
-     * baseline is centered.
-     *
-     * "EEEE" will typically be dead center, with the middle of each character being in the bar's center.
-     * "eee" will be slightly below the center.
-     * "jjj" will be even further below the center.
-     *
-     * Finally, if the font's descent is negative, ignore it (except
-     * for the height calculation). This is unfortunately not based on
-     * any real facts, but works very well with e.g. the "Awesome 6"
-     * font family.
+     * Alpha mask glyphs are batched, and composited in one go with
+     * the particle's solid source. Pre-rendered (color) glyphs cannot
+     * be used as masks, and are composited one by one.
      */
-    const double baseline = (double)y +
-        (double)(height + font->ascent + font->descent) / 2.0 -
-        (font->descent > 0 ? font->descent : 0);
+    pixman_glyph_t batch[64];
+    int batch_count = 0;
 
-    x += exposable->particle->left_margin;
+    pixman_glyph_cache_freeze(glyph_cache);
 
-    /* Loop glyphs and render them, one by one */
     for (int i = 0; i < e->num_glyphs; i++) {
         const struct fcft_glyph *glyph = e->glyphs[i];
         assert(glyph != NULL);
@@ -111,6 +474,9 @@ expose(const struct exposable *exposable, pixman_image_t *pix, int x, int y, int
         x += e->kern_x[i];
 
         if (pixman_image_get_format(glyph->pix) == PIXMAN_a8r8g8b8) {
+            flush_glyphs(p, pix, batch, batch_count);
+            batch_count = 0;
+
             /* Glyph surface is a pre-rendered image (typically a color emoji...) */
             pixman_image_composite32(
                 PIXMAN_OP_OVER, glyph->pix, NULL, pix, 0, 0, 0, 0,
@@ -118,16 +484,214 @@ expose(const struct exposable *exposable, pixman_image_t *pix, int x, int y, int
                 glyph->width, glyph->height);
         } else {
             /* Glyph surface is an alpha mask */
-            pixman_image_t *src = pixman_image_create_solid_fill(&exposable->particle->foreground);
-            pixman_image_composite32(
-                PIXMAN_OP_OVER, src, glyph->pix, pix, 0, 0, 0, 0,
-                x + glyph->x, baseline - glyph->y,
-                glyph->width, glyph->height);
-            pixman_image_unref(src);
+            const void *cached = pixman_glyph_cache_lookup(
+                glyph_cache, (void *)font, (void *)glyph);
+
+            if (cached == NULL) {
+                cached = pixman_glyph_cache_insert(
+                    glyph_cache, (void *)font, (void *)glyph,
+                    -glyph->x, glyph->y, glyph->pix);
+            }
+
+            if (cached != NULL) {
+                if (batch_count == sizeof(batch) / sizeof(batch[0])) {
+                    flush_glyphs(p, pix, batch, batch_count);
+                    batch_count = 0;
+                }
+
+                batch[batch_count++] = (pixman_glyph_t){
+                    .x = x, .y = baseline, .glyph = cached};
+            } else {
+                pixman_image_composite32(
+                    PIXMAN_OP_OVER, p->fg, glyph->pix, pix, 0, 0, 0, 0,
+                    x + glyph->x, baseline - glyph->y,
+                    glyph->width, glyph->height);
+            }
         }
 
         x += glyph->advance.x;
     }
+
+    flush_glyphs(p, pix, batch, batch_count);
+    pixman_glyph_cache_thaw(glyph_cache);
+}
+
+/* Horizontal extent of the glyphs' ink, relative to the pen start */
+static void
+ink_extents(const struct eprivate *e, int *x0, int *x1)
+{
+    int x = 0;
+    *x0 = *x1 = 0;
+
+    for (int i = 0; i < e->num_glyphs; i++) {
+        const struct fcft_glyph *glyph = e->glyphs[i];
+
+        x += e->kern_x[i];
+
+        if (x + glyph->x < *x0)
+            *x0 = x + glyph->x;
+        if (x + glyph->x + glyph->width > *x1)
+            *x1 = x + glyph->x + glyph->width;
+
+        x += glyph->advance.x;
+    }
+}
+
+static void
+strip_destroy(struct strip_cache *strip)
+{
+    free(strip->text);
+    pixman_image_unref(strip->pix);
+}
+
+/*
+ * Evicts the least recently used strip of 'owner' or, if NULL, of all
+ * particles
+ */
+static void
+strip_evict_lru(struct private *owner)
+{
+    struct private *lru_owner = NULL;
+    const struct strip_cache *lru = NULL;
+
+    tll_foreach(strip_owners, o) {
+        struct private *p = o->item;
+        if (owner != NULL && p != owner)
+            continue;
+
+        tll_foreach(p->strips, it) {
+            if (lru == NULL || it->item.last_used < lru->last_used) {
+                lru = &it->item;
+                lru_owner = p;
+            }
+        }
+    }
+
+    assert(lru != NULL);
+
+    tll_foreach(lru_owner->strips, it) {
+        if (&it->item == lru) {
+            lru_owner->strip_size -= lru->size;
+            strip_total_size -= lru->size;
+            strip_destroy(&it->item);
+            tll_remove(lru_owner->strips, it);
+            break;
+        }
+    }
+}
+
+/* Returns true if 'hash' has been seen before, otherwise remembers it */
+static bool
+strip_seen(struct private *p, uint64_t hash)
+{
+    for (size_t i = 0; i < STRIP_SEEN_COUNT; i++) {
+        if (p->strip_seen[i] == hash)
+            return true;
+    }
+
+    p->strip_seen[p->strip_seen_next] = hash;
+    p->strip_seen_next = (p->strip_seen_next + 1) % STRIP_SEEN_COUNT;
+    return false;
+}
+
+static const struct strip_cache *
+strip_lookup(const struct exposable *exposable, int height)
+{
+    const struct eprivate *e = exposable->private;
+    const struct particle *particle = exposable->particle;
+    struct private *p = particle->private;
+
+    tll_foreach(p->strips, it) {
+        struct strip_cache *strip = &it->item;
+
+        if (strip->height == height &&
+            strip->font == particle->font &&
+            memcmp(&strip->foreground, &particle->foreground,
+                   sizeof(strip->foreground)) == 0 &&
+            strcmp(strip->text, e->text) == 0)
+        {
+            strip->last_used = ++strip_clock;
+            p->strip_stats.hits++;
+            return strip;
+        }
+    }
+
+    if (!strip_seen(p, e->run->hash)) {
+        p->strip_stats.uncached++;
+        return NULL;
+    }
+
+    p->strip_stats.misses++;
+
+    int x0, x1;
+    ink_extents(e, &x0, &x1);
+
+    const int width = x1 - x0;
+    const size_t size = (size_t)width * height * 4;
+
+    if (width <= 0 || size > p->strip_budget || size > max_total_render_cache)
+        return NULL;
+
+    /* Evict least recently used strips, until the new one fits */
+    while (p->strip_size + size > p->strip_budget)
+        strip_evict_lru(p);
+    while (strip_total_size + size > max_total_render_cache)
+        strip_evict_lru(NULL);
+
+    pixman_image_t *pix = pixman_image_create_bits(
+        PIXMAN_a8r8g8b8, width, height, NULL, 0);
+    if (pix == NULL)
+        return NULL;
+
+    render_glyphs(exposable, pix, -x0,
+                  baseline_for(particle->font, 0, height));
+
+    tll_push_back(p->strips, ((struct strip_cache){
+        .text = strdup(e->text),
+        .font = particle->font,
+        .foreground = particle->foreground,
+        .height = height,
+        .pix = pix,
+        .x_ofs = x0,
+        .size = size,
+        .last_used = ++strip_clock,
+    }));
+
+    p->strip_size += size;
+    strip_total_size += size;
+    return &tll_back(p->strips);
+}
+
+static void
+expose(const struct exposable *exposable, pixman_image_t *pix, int x, int y, int height)
+{
+    exposable_render_deco(exposable, pix, x, y, height);
+
+    const struct eprivate *e = exposable->private;
+    const struct private *p = exposable->particle->private;
+
+    if (e->num_glyphs == 0)
+        return;
+
+    x += exposable->particle->left_margin;
+
+    /*
+     * Unchanged strings are blitted from a pre-rendered strip, with a
+     * single composite operation, instead of glyph by glyph.
+     */
+    const struct strip_cache *strip = p->strip_budget > 0
+        ? strip_lookup(exposable, height) : NULL;
+
+    if (strip != NULL) {
+        pixman_image_composite32(
+            PIXMAN_OP_OVER, strip->pix, NULL, pix, 0, 0, 0, 0,
+            x + strip->x_ofs, y,
+            pixman_image_get_width(strip->pix), strip->height);
+        return;
+    }
+
+    render_glyphs(
+        exposable, pix, x, baseline_for(exposable->particle->font, y, height));
 }
 
 static uint64_t
@@ -147,32 +711,22 @@ static struct exposable *
 instantiate(const struct particle *particle, const struct tag_set *tags)
 {
     struct private *p = (struct private *)particle->private;
-    struct eprivate *e = calloc(1, sizeof(*e));
+    struct eprivate *e = frame_calloc(1, sizeof(*e));
     struct fcft_font *font = particle->font;
 
     char32_t *wtext = NULL;
-    char *text = tags_expand_template(p->text, tags);
+    const char *text = tag_template_expand(p->text, tags);
 
-    e->glyphs = e->allocated_glyphs = NULL;
-    e->num_glyphs = 0;
-    e->kern_x = NULL;
-    e->cache_idx = -1;
+    const bool shaping =
+        particle->font_shaping == FONT_SHAPE_FULL &&
+        fcft_capabilities() & FCFT_CAPABILITY_TEXT_RUN_SHAPING;
 
-    uint64_t hash = sdbm_hash(text);
+    const uint64_t hash = sdbm_hash(text);
 
     /* First, check if we have this string cached */
-    for (size_t i = 0; i < p->cache_size; i++) {
-        if (p->cache[i].hash == hash) {
-            assert(p->cache[i].run != NULL);
-
-            p->cache[i].in_use = true;
-            e->cache_idx = i;
-            e->glyphs = p->cache[i].run->glyphs;
-            e->num_glyphs = p->cache[i].run->count;
-            e->kern_x = calloc(p->cache[i].run->count, sizeof(e->kern_x[0]));
-            goto done;
-        }
-    }
+    e->run = text_cache_lookup(p->cache, text, p->max_len, shaping, hash);
+    if (e->run != NULL)
+        goto done;
 
     /* Not in cache - we need to rasterize it. First, convert to char32_t */
     wtext = ambstoc32(text);
@@ -196,52 +750,22 @@ instantiate(const struct particle *particle, const struct tag_set *tags)
         }
     }
 
-    e->kern_x = calloc(chars, sizeof(e->kern_x[0]));
-
-    if (particle->font_shaping == FONT_SHAPE_FULL &&
-        fcft_capabilities() & FCFT_CAPABILITY_TEXT_RUN_SHAPING)
-    {
+    if (shaping) {
         struct fcft_text_run *run = fcft_rasterize_text_run_utf32(
             font, chars, wtext, FCFT_SUBPIXEL_NONE);
 
         if (run != NULL) {
-            int w = 0;
-            for (size_t i = 0; i < run->count; i++)
-                w += run->glyphs[i]->advance.x;
-
-            ssize_t cache_idx = -1;
-            for (size_t i = 0; i < p->cache_size; i++) {
-                if (p->cache[i].run == NULL || !p->cache[i].in_use) {
-                    fcft_text_run_destroy(p->cache[i].run);
-                    cache_idx = i;
-                    break;
-                }
-            }
-
-            if (cache_idx < 0) {
-                size_t new_size = p->cache_size + 1;
-                struct text_run_cache *new_cache = realloc(
-                    p->cache, new_size * sizeof(new_cache[0]));
-
-                p->cache_size = new_size;
-                p->cache = new_cache;
-                cache_idx = new_size - 1;
-            }
-
-            assert(cache_idx >= 0 && cache_idx < p->cache_size);
-            p->cache[cache_idx].hash = hash;
-            p->cache[cache_idx].run = run;
-            p->cache[cache_idx].width = w;
-            p->cache[cache_idx].in_use = true;
-
-            e->cache_idx = cache_idx;
-            e->num_glyphs = run->count;
-            e->glyphs = run->glyphs;
+            /* Kerning is already applied to the run's advances */
+            e->run = text_cache_insert(
+                p->cache, text, p->max_len, shaping, hash, run,
+                NULL, calloc(run->count, sizeof(long)), 0);
         }
     }
 
-    if (e->glyphs == NULL) {
-        e->allocated_glyphs = malloc(chars * sizeof(e->glyphs[0]));
+    if (e->run == NULL) {
+        long *kern_x = calloc(chars, sizeof(kern_x[0]));
+        const struct fcft_glyph **glyphs = malloc(chars * sizeof(glyphs[0]));
+        size_t count = 0;
 
         /* Convert text to glyph masks/images. */
         for (size_t i = 0; i < chars; i++) {
@@ -251,20 +775,26 @@ instantiate(const struct particle *particle, const struct tag_set *tags)
             if (glyph == NULL)
                 continue;
 
-            e->allocated_glyphs[e->num_glyphs++] = glyph;
-
-            if (i == 0)
-                continue;
+            if (i > 0) {
+                fcft_kerning(
+                    font, wtext[i - 1], wtext[i], &kern_x[count], NULL);
+            }
 
-            fcft_kerning(font, wtext[i - 1], wtext[i], &e->kern_x[i], NULL);
+            glyphs[count++] = glyph;
         }
 
-        e->glyphs = e->allocated_glyphs;
+        e->run = text_cache_insert(
+            p->cache, text, p->max_len, shaping, hash, NULL,
+            glyphs, kern_x, count);
     }
 
 done:
+    e->glyphs = e->run->glyphs;
+    e->kern_x = e->run->kern_x;
+    e->num_glyphs = e->run->count;
+
     free(wtext);
-    free(text);
+    e->text = e->run->text;
 
     struct exposable *exposable = exposable_common_new(particle, tags);
     exposable->private = e;
@@ -278,22 +808,47 @@ static void
 particle_destroy(struct particle *particle)
 {
     struct private *p = particle->private;
-    for (size_t i = 0; i < p->cache_size; i++)
-        fcft_text_run_destroy(p->cache[i].run);
-    free(p->cache);
-    free(p->text);
+
+    if (p->strip_stats.hits + p->strip_stats.misses + p->strip_stats.uncached > 0) {
+        LOG_INFO("render cache: hits=%"PRIu64", misses=%"PRIu64", "
+                 "uncached=%"PRIu64", %zu strips, %zu bytes",
+                 p->strip_stats.hits, p->strip_stats.misses,
+                 p->strip_stats.uncached, tll_length(p->strips), p->strip_size);
+    }
+
+    tll_foreach(p->strips, it)
+        strip_destroy(&it->item);
+    tll_free(p->strips);
+
+    strip_total_size -= p->strip_size;
+    tll_foreach(strip_owners, it) {
+        if (it->item == p) {
+            tll_remove(strip_owners, it);
+            break;
+        }
+    }
+
+    text_cache_unref(p->cache, p->cache_capacity);
+    pixman_image_unref(p->fg);
+    tag_template_destroy(p->text);
     free(p);
     particle_default_destroy(particle);
 }
 
 static struct particle *
-string_new(struct particle *common, const char *text, size_t max_len)
+string_new(struct particle *common, const char *text, size_t max_len,
+           size_t text_cache, size_t render_cache)
 {
     struct private *p = calloc(1, sizeof(*p));
-    p->text = strdup(text);
+    p->text = tag_template_compile(text);
     p->max_len = max_len;
-    p->cache_size = 0;
-    p->cache = NULL;
+    p->strip_budget = render_cache;
+    p->cache = text_cache_ref(common->font, text_cache);
+    p->cache_capacity = text_cache;
+    p->fg = pixman_image_create_solid_fill(&common->foreground);
+
+    if (render_cache > 0)
+        tll_push_back(strip_owners, p);
 
     common->private = p;
     common->destroy = &particle_destroy;
@@ -306,11 +861,15 @@ from_conf(const struct yml_node *node, struct particle *common)
 {
     const struct yml_node *text = yml_get_value(node, "text");
     const struct yml_node *max = yml_get_value(node, "max");
+    const struct yml_node *text_cache = yml_get_value(node, "text-cache");
+    const struct yml_node *render_cache = yml_get_value(node, "render-cache");
 
     return string_new(
         common,
         yml_value_as_string(text),
-        max != NULL ? yml_value_as_int(max) : 0);
+        max != NULL ? yml_value_as_int(max) : 0,
+        text_cache != NULL ? yml_value_as_int(text_cache) : default_text_cache,
+        render_cache != NULL ? yml_value_as_int(render_cache) : default_render_cache);
 }
 
 static bool
@@ -319,6 +878,8 @@ verify_conf(keychain_t *chain, const struct yml_node *node)
     static const struct attr_info attrs[] = {
         {"text", true, &conf_verify_string},
         {"max", false, &conf_verify_unsigned},
+        {"text-cache", false, &conf_verify_unsigned},
+        {"render-cache", false, &conf_verify_unsigned},
         PARTICLE_COMMON_ATTRS,
     };
 
@@ -97,6 +97,7 @@
 #endif
 
 EXTERN_PARTICLE(empty);
+EXTERN_PARTICLE(heatmap);
 EXTERN_PARTICLE(list);
 EXTERN_PARTICLE(map);
 EXTERN_PARTICLE(progress_bar);
@@ -223,6 +224,7 @@ init(void)
 #endif
 
     REGISTER_CORE_PARTICLE(empty, empty);
+    REGISTER_CORE_PARTICLE(heatmap, heatmap);
     REGISTER_CORE_PARTICLE(list, list);
     REGISTER_CORE_PARTICLE(map, map);
     REGISTER_CORE_PARTICLE(progress-bar, progress_bar);
@@ -0,0 +1,136 @@
+#include "proc-sampler.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+
+#define LOG_MODULE "proc-sampler"
+#define LOG_ENABLE_DBG 0
+#include "log.h"
+
+struct source {
+    const char *path;
+    int fd;
+    char *buf;
+    size_t size;  /* Excluding the terminating NUL */
+
+    bool valid;
+    struct proc_snapshot snapshot;
+
+    uint64_t reads;
+    uint64_t hits;
+};
+
+static struct source sources[PROC_SOURCE_COUNT] = {
+    [PROC_SOURCE_STAT] = {.path = "/proc/stat", .fd = -1},
+    [PROC_SOURCE_MEMINFO] = {.path = "/proc/meminfo", .fd = -1},
+    [PROC_SOURCE_DISKSTATS] = {.path = "/proc/diskstats", .fd = -1},
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Reads the whole file, from the start, into the re-used buffer.
+ * procfs fills the whole buffer if it can; a short read means we have
+ * it all. Otherwise, the buffer is grown, and the rest read.
+ */
+static bool
+source_read(struct source *src)
+{
+    if (src->fd < 0) {
+        src->fd = open(src->path, O_RDONLY | O_CLOEXEC);
+        if (src->fd < 0) {
+            LOG_ERRNO("%s: failed to open", src->path);
+            return false;
+        }
+
+        src->size = 4096;
+        src->buf = malloc(src->size + 1);
+    }
+
+    size_t len = 0;
+
+    while (true) {
+        ssize_t count = pread(src->fd, &src->buf[len], src->size - len, len);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERRNO("%s: failed to read", src->path);
+            return false;
+        }
+
+        len += count;
+
+        if (len < src->size)
+            break;
+
+        src->size *= 2;
+        src->buf = realloc(src->buf, src->size + 1);
+    }
+
+    src->buf[len] = '\0';
+    src->snapshot = (struct proc_snapshot){
+        .data = src->buf,
+        .len = len,
+        .time = now_ns(),
+    };
+    src->valid = true;
+    src->reads++;
+    return true;
+}
+
+const struct proc_snapshot *
+proc_sample(enum proc_source source, long max_age_ms)
+{
+    assert(source >= 0 && source < PROC_SOURCE_COUNT);
+    struct source *src = &sources[source];
+
+    if (src->valid &&
+        now_ns() - src->snapshot.time <= (uint64_t)max_age_ms * 1000000)
+    {
+        src->hits++;
+        LOG_DBG("%s: re-using snapshot (%"PRIu64" reads, %"PRIu64" hits)",
+                src->path, src->reads, src->hits);
+        return &src->snapshot;
+    }
+
+    if (!source_read(src)) {
+        src->valid = false;
+        return NULL;
+    }
+
+    return &src->snapshot;
+}
+
+void
+proc_sampler_destroy(void)
+{
+    for (size_t i = 0; i < PROC_SOURCE_COUNT; i++) {
+        struct source *src = &sources[i];
+
+        if (src->reads > 0) {
+            LOG_INFO("%s: %"PRIu64" reads, %"PRIu64" samples shared",
+                     src->path, src->reads, src->hits);
+        }
+
+        if (src->fd >= 0)
+            close(src->fd);
+        free(src->buf);
+
+        src->fd = -1;
+        src->buf = NULL;
+        src->valid = false;
+        src->reads = src->hits = 0;
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Process wide procfs sampler.
+ *
+ * Several modules (and several instances of the same module) poll
+ * the same procfs files. Each file is kept open, and its reads are
+ * shared: a module asking for a source gets the raw text of the last
+ * read if it is recent enough, and the file is only re-read
+ * otherwise. Parsing is left to each module.
+ *
+ * Module timers are phase aligned (see module_set_timer()); modules
+ * polling at the same, or related, intervals fire in the same loop
+ * wakeup, and the first of them to ask reads the file for all of
+ * them. Passing the timer's slack as 'max_age_ms' is thus enough to
+ * read each source once per tick.
+ *
+ * May only be called from the shared module event loop thread. The
+ * snapshot is valid until the next call for the same source.
+ */
+enum proc_source {
+    PROC_SOURCE_STAT,       /* /proc/stat */
+    PROC_SOURCE_MEMINFO,    /* /proc/meminfo */
+    PROC_SOURCE_DISKSTATS,  /* /proc/diskstats */
+    PROC_SOURCE_COUNT,
+};
+
+/*
+ * Rates, and averages, must be derived from the time between two
+ * snapshots, not from the poll interval: timers are batched, and may
+ * fire late (and on a loaded machine, later still).
+ */
+struct proc_snapshot {
+    const char *data;  /* NUL terminated */
+    size_t len;
+    uint64_t time;     /* When read; CLOCK_MONOTONIC, in nanoseconds */
+};
+
+/* Returns NULL, after logging an error, if the source can't be read */
+const struct proc_snapshot *proc_sample(enum proc_source source, long max_age_ms);
+
+/*
+ * Exponentially weighted moving average: folds 'value', measured over
+ * 'elapsed' ns, into 'avg'. The weight depends on the elapsed time,
+ * not the number of samples, so that late, or skipped, polls don't
+ * skew the average. A time constant of 0 disables smoothing.
+ */
+static inline double
+proc_ewma(double avg, double value, uint64_t elapsed, uint32_t time_constant_ms)
+{
+    if (time_constant_ms == 0)
+        return value;
+
+    const double alpha = 1. - exp(-(double)elapsed / (time_constant_ms * 1000000.));
+    return avg + alpha * (value - avg);
+}
+
+/* Closes all sources, logging how many reads were shared; at exit */
+void proc_sampler_destroy(void);
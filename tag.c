@@ -11,10 +11,139 @@
 #define LOG_MODULE "tag"
 #define LOG_ENABLE_DBG 1
 #include "log.h"
+#include "arena.h"
 #include "module.h"
 
+/*
+ * Interned tag names. Atoms index 'names' (atom 0 is never handed
+ * out); 'slots' is an open addressing hash table of atoms, kept at
+ * most half full. Tags are created by the modules' threads, hence
+ * the lock. Interned strings are never moved, or freed, and can be
+ * read without holding the lock.
+ */
+static struct {
+    mtx_t lock;
+    char **names;
+    size_t count;
+    tag_atom_t *slots;
+    size_t slot_count;
+} atoms;
+
+static once_flag atoms_once = ONCE_FLAG_INIT;
+
+static void
+atoms_init(void)
+{
+    mtx_init(&atoms.lock, mtx_plain);
+    atoms.names = calloc(1, sizeof(atoms.names[0]));
+    atoms.count = 1;
+}
+
+static uint32_t
+atom_hash(const char *name)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c != '\0'; c++)
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    return hash;
+}
+
+/*
+ * Returns the atom for 'name', or TAG_ATOM_NONE, in which case
+ * '*free_slot' is the slot to insert it in. Must be called with the
+ * lock held.
+ */
+static tag_atom_t
+atom_find(const char *name, size_t *free_slot)
+{
+    if (atoms.slot_count == 0) {
+        *free_slot = 0;
+        return TAG_ATOM_NONE;
+    }
+
+    const size_t mask = atoms.slot_count - 1;
+
+    for (size_t i = atom_hash(name) & mask; ; i = (i + 1) & mask) {
+        tag_atom_t atom = atoms.slots[i];
+
+        if (atom == TAG_ATOM_NONE) {
+            *free_slot = i;
+            return TAG_ATOM_NONE;
+        }
+
+        if (strcmp(atoms.names[atom], name) == 0)
+            return atom;
+    }
+}
+
+static void
+atoms_grow(void)
+{
+    const size_t slot_count = atoms.slot_count == 0 ? 64 : atoms.slot_count * 2;
+    const size_t mask = slot_count - 1;
+
+    tag_atom_t *slots = calloc(slot_count, sizeof(slots[0]));
+
+    for (tag_atom_t atom = 1; atom < atoms.count; atom++) {
+        size_t i = atom_hash(atoms.names[atom]) & mask;
+        while (slots[i] != TAG_ATOM_NONE)
+            i = (i + 1) & mask;
+        slots[i] = atom;
+    }
+
+    free(atoms.slots);
+    atoms.slots = slots;
+    atoms.slot_count = slot_count;
+}
+
+/* Interns 'name', returning its atom, and the interned string */
+static tag_atom_t
+intern(const char *name, const char **interned)
+{
+    call_once(&atoms_once, &atoms_init);
+    mtx_lock(&atoms.lock);
+
+    size_t slot;
+    tag_atom_t atom = atom_find(name, &slot);
+
+    if (atom == TAG_ATOM_NONE) {
+        if ((atoms.count + 1) * 2 > atoms.slot_count) {
+            atoms_grow();
+            atom_find(name, &slot);
+        }
+
+        atom = atoms.count++;
+        atoms.names = realloc(atoms.names, atoms.count * sizeof(atoms.names[0]));
+        atoms.names[atom] = strdup(name);
+        atoms.slots[slot] = atom;
+    }
+
+    if (interned != NULL)
+        *interned = atoms.names[atom];
+
+    mtx_unlock(&atoms.lock);
+    return atom;
+}
+
+tag_atom_t
+tag_atom(const char *name)
+{
+    return intern(name, NULL);
+}
+
+const char *
+tag_atom_name(tag_atom_t atom)
+{
+    call_once(&atoms_once, &atoms_init);
+    mtx_lock(&atoms.lock);
+    const char *name = atom < atoms.count ? atoms.names[atom] : NULL;
+    mtx_unlock(&atoms.lock);
+    return name;
+}
+
 struct private {
-    char *name;
+    const char *name;
     union {
         struct {
             long value;
@@ -25,6 +154,14 @@ struct private {
         bool value_as_bool;
         double value_as_float;
         char *value_as_string;
+        struct {
+            uint8_t *values;
+            size_t count;
+            long average;
+            long min;
+            long max;
+            char *as_string;  /* Formatted on first use */
+        } value_as_array;
     };
 };
 
@@ -77,20 +214,35 @@ unimpl_refresh_in(const struct tag *tag, long units)
     return false;
 }
 
+static size_t
+no_array(const struct tag *tag, const uint8_t **values)
+{
+    *values = NULL;
+    return 0;
+}
+
 static void
 destroy_int_and_float(struct tag *tag)
 {
     struct private *priv = tag->private;
-    free(priv->name);
-    free(priv);
-    free(tag);
+    frame_free(priv);
+    frame_free(tag);
 }
 
 static void
 destroy_string(struct tag *tag)
 {
     struct private *priv = tag->private;
-    free(priv->value_as_string);
+    frame_free(priv->value_as_string);
+    destroy_int_and_float(tag);
+}
+
+static void
+destroy_array(struct tag *tag)
+{
+    struct private *priv = tag->private;
+    frame_free(priv->value_as_array.values);
+    frame_free(priv->value_as_array.as_string);
     destroy_int_and_float(tag);
 }
 
@@ -262,6 +414,78 @@ string_as_float(const struct tag *tag)
     return matches == 1 ? value : 0;
 }
 
+static enum tag_type
+array_type(const struct tag *tag)
+{
+    return TAG_TYPE_INT;
+}
+
+static long
+array_min(const struct tag *tag)
+{
+    const struct private *priv = tag->private;
+    return priv->value_as_array.min;
+}
+
+static long
+array_max(const struct tag *tag)
+{
+    const struct private *priv = tag->private;
+    return priv->value_as_array.max;
+}
+
+static const char *
+array_as_string(const struct tag *tag)
+{
+    struct private *priv = tag->private;
+
+    if (priv->value_as_array.as_string != NULL)
+        return priv->value_as_array.as_string;
+
+    /* "255," per value */
+    const size_t size = priv->value_as_array.count * 4 + 1;
+    char *s = frame_alloc(size);
+    size_t len = 0;
+
+    s[0] = '\0';
+    for (size_t i = 0; i < priv->value_as_array.count; i++) {
+        len += snprintf(&s[len], size - len, "%s%u",
+                        i > 0 ? "," : "", priv->value_as_array.values[i]);
+    }
+
+    priv->value_as_array.as_string = s;
+    return s;
+}
+
+static long
+array_as_int(const struct tag *tag)
+{
+    const struct private *priv = tag->private;
+    return priv->value_as_array.average;
+}
+
+static bool
+array_as_bool(const struct tag *tag)
+{
+    const struct private *priv = tag->private;
+    return priv->value_as_array.average;
+}
+
+static double
+array_as_float(const struct tag *tag)
+{
+    const struct private *priv = tag->private;
+    return priv->value_as_array.average;
+}
+
+static size_t
+array_as_array(const struct tag *tag, const uint8_t **values)
+{
+    const struct private *priv = tag->private;
+    *values = priv->value_as_array.values;
+    return priv->value_as_array.count;
+}
+
 struct tag *
 tag_new_int(struct module *owner, const char *name, long value)
 {
@@ -279,16 +503,16 @@ struct tag *
 tag_new_int_realtime(struct module *owner, const char *name, long value,
                      long min, long max, enum tag_realtime_unit unit)
 {
-    struct private *priv = malloc(sizeof(*priv));
-    priv->name = strdup(name);
+    struct private *priv = frame_alloc(sizeof(*priv));
     priv->value_as_int.value = value;
     priv->value_as_int.min = min;
     priv->value_as_int.max = max;
     priv->value_as_int.realtime_unit = unit;
 
-    struct tag *tag = malloc(sizeof(*tag));
+    struct tag *tag = frame_alloc(sizeof(*tag));
     tag->private = priv;
     tag->owner = owner;
+    tag->atom = intern(name, &priv->name);
     tag->destroy = &destroy_int_and_float;
     tag->name = &tag_name;
     tag->type = &int_type;
@@ -300,19 +524,20 @@ tag_new_int_realtime(struct module *owner, const char *name, long value,
     tag->as_int = &int_as_int;
     tag->as_bool = &int_as_bool;
     tag->as_float = &int_as_float;
+    tag->as_array = &no_array;
     return tag;
 }
 
 struct tag *
 tag_new_bool(struct module *owner, const char *name, bool value)
 {
-    struct private *priv = malloc(sizeof(*priv));
-    priv->name = strdup(name);
+    struct private *priv = frame_alloc(sizeof(*priv));
     priv->value_as_bool = value;
 
-    struct tag *tag = malloc(sizeof(*tag));
+    struct tag *tag = frame_alloc(sizeof(*tag));
     tag->private = priv;
     tag->owner = owner;
+    tag->atom = intern(name, &priv->name);
     tag->destroy = &destroy_int_and_float;
     tag->name = &tag_name;
     tag->type = &bool_type;
@@ -324,19 +549,20 @@ tag_new_bool(struct module *owner, const char *name, bool value)
     tag->as_int = &bool_as_int;
     tag->as_bool = &bool_as_bool;
     tag->as_float = &bool_as_float;
+    tag->as_array = &no_array;
     return tag;
 }
 
 struct tag *
 tag_new_float(struct module *owner, const char *name, double value)
 {
-    struct private *priv = malloc(sizeof(*priv));
-    priv->name = strdup(name);
+    struct private *priv = frame_alloc(sizeof(*priv));
     priv->value_as_float = value;
 
-    struct tag *tag = malloc(sizeof(*tag));
+    struct tag *tag = frame_alloc(sizeof(*tag));
     tag->private = priv;
     tag->owner = owner;
+    tag->atom = intern(name, &priv->name);
     tag->destroy = &destroy_int_and_float;
     tag->name = &tag_name;
     tag->type = &float_type;
@@ -348,19 +574,20 @@ tag_new_float(struct module *owner, const char *name, double value)
     tag->as_int = &float_as_int;
     tag->as_bool = &float_as_bool;
     tag->as_float = &float_as_float;
+    tag->as_array = &no_array;
     return tag;
 }
 
 struct tag *
 tag_new_string(struct module *owner, const char *name, const char *value)
 {
-    struct private *priv = malloc(sizeof(*priv));
-    priv->name = strdup(name);
-    priv->value_as_string = value != NULL ? strdup(value) : strdup("");
+    struct private *priv = frame_alloc(sizeof(*priv));
+    priv->value_as_string = frame_strdup(value != NULL ? value : "");
 
-    struct tag *tag = malloc(sizeof(*tag));
+    struct tag *tag = frame_alloc(sizeof(*tag));
     tag->private = priv;
     tag->owner = owner;
+    tag->atom = intern(name, &priv->name);
     tag->destroy = &destroy_string;
     tag->name = &tag_name;
     tag->type = &string_type;
@@ -372,24 +599,106 @@ tag_new_string(struct module *owner, const char *name, const char *value)
     tag->as_int = &string_as_int;
     tag->as_bool = &string_as_bool;
     tag->as_float = &string_as_float;
+    tag->as_array = &no_array;
+    return tag;
+}
+
+struct tag *
+tag_new_int_array(struct module *owner, const char *name,
+                  const uint8_t *values, size_t count, long min, long max)
+{
+    struct private *priv = frame_alloc(sizeof(*priv));
+    priv->value_as_array.values = frame_alloc(count > 0 ? count : 1);
+    priv->value_as_array.count = count;
+    priv->value_as_array.min = min;
+    priv->value_as_array.max = max;
+    priv->value_as_array.as_string = NULL;
+
+    long sum = 0;
+    for (size_t i = 0; i < count; i++)
+        sum += values[i];
+
+    memcpy(priv->value_as_array.values, values, count);
+    priv->value_as_array.average = count > 0 ? (sum + count / 2) / count : 0;
+
+    struct tag *tag = frame_alloc(sizeof(*tag));
+    tag->private = priv;
+    tag->owner = owner;
+    tag->atom = intern(name, &priv->name);
+    tag->destroy = &destroy_array;
+    tag->name = &tag_name;
+    tag->type = &array_type;
+    tag->min = &array_min;
+    tag->max = &array_max;
+    tag->realtime = &no_realtime;
+    tag->refresh_in = &unimpl_refresh_in;
+    tag->as_string = &array_as_string;
+    tag->as_int = &array_as_int;
+    tag->as_bool = &array_as_bool;
+    tag->as_float = &array_as_float;
+    tag->as_array = &array_as_array;
     return tag;
 }
 
+void
+tag_ref_init(struct tag_ref *ref, const char *name)
+{
+    ref->atom = tag_atom(name);
+    ref->slot = 0;
+}
+
 const struct tag *
-tag_for_name(const struct tag_set *set, const char *name)
+tag_for_ref(const struct tag_set *set, struct tag_ref *ref)
 {
-    if (set == NULL)
+    if (set == NULL || ref->atom == TAG_ATOM_NONE)
+        return NULL;
+
+    if (ref->slot < set->count && set->tags[ref->slot]->atom == ref->atom)
+        return set->tags[ref->slot];
+
+    for (size_t i = 0; i < set->count; i++) {
+        const struct tag *tag = set->tags[i];
+        if (tag->atom == ref->atom) {
+            ref->slot = i;
+            return tag;
+        }
+    }
+
+    return NULL;
+}
+
+const struct tag *
+tag_for_atom(const struct tag_set *set, tag_atom_t atom)
+{
+    if (set == NULL || atom == TAG_ATOM_NONE)
         return NULL;
 
     for (size_t i = 0; i < set->count; i++) {
         const struct tag *tag = set->tags[i];
-        if (strcmp(tag->name(tag), name) == 0)
+        if (tag->atom == atom)
             return tag;
     }
 
     return NULL;
 }
 
+const struct tag *
+tag_for_name(const struct tag_set *set, const char *name)
+{
+    if (set == NULL)
+        return NULL;
+
+    /* A name that has never been interned cannot be in any tag set */
+    call_once(&atoms_once, &atoms_init);
+    mtx_lock(&atoms.lock);
+
+    size_t slot;
+    const tag_atom_t atom = atom_find(name, &slot);
+
+    mtx_unlock(&atoms.lock);
+    return tag_for_atom(set, atom);
+}
+
 void
 tag_set_destroy(struct tag_set *set)
 {
@@ -443,29 +752,183 @@ is_number(const char *str, int *value)
     return true;
 }
 
-char *
-tags_expand_template(const char *template, const struct tag_set *tags)
+enum token_format {
+    FMT_DEFAULT,
+    FMT_HEX,
+    FMT_OCT,
+    FMT_PERCENT,
+    FMT_KBYTE,
+    FMT_MBYTE,
+    FMT_GBYTE,
+    FMT_KIBYTE,
+    FMT_MIBYTE,
+    FMT_GIBYTE,
+};
+
+enum token_kind {
+    VALUE_VALUE,
+    VALUE_MIN,
+    VALUE_MAX,
+    VALUE_UNIT,
+};
+
+struct template_token {
+    /*
+     * Literal: the text to copy. Tag reference: the complete "{...}"
+     * source text, copied as-is when the tag does not exist.
+     */
+    const char *text;
+    size_t len;
+
+    struct tag_ref tag;  /* tag.atom is TAG_ATOM_NONE for literals */
+
+    enum token_format format;
+    enum token_kind kind;
+    int digits;
+    int decimals;
+    bool zero_pad;
+
+    /*
+     * A '{' in the arguments (e.g. "{x:{y}}") makes the "{...}" text
+     * ambiguous: when the tag does not exist, it is a literal '{',
+     * followed by whatever the rest of the text turns out to be. In
+     * that case, 'text' is just the '{', and the next 'alternatives'
+     * tokens are the rest, re-tokenized; they are skipped when the
+     * tag does exist.
+     */
+    size_t alternatives;
+};
+
+struct tag_template {
+    char *source;
+    struct template_token *tokens;
+    size_t count;
+
+    /* Tokens that literals may not be merged into */
+    size_t sealed;
+
+    /* Expansion buffer, re-used by each tag_template_expand() */
+    struct sbuf buf;
+};
+
+static void
+template_add_literal(struct tag_template *template, const char *text, size_t len)
 {
-    if (template == NULL)
-        return NULL;
+    if (len == 0)
+        return;
+
+    /* Merge with a preceding literal */
+    if (template->count > template->sealed) {
+        struct template_token *last = &template->tokens[template->count - 1];
+        if (last->tag.atom == TAG_ATOM_NONE && last->text + last->len == text) {
+            last->len += len;
+            return;
+        }
+    }
+
+    template->tokens = realloc(
+        template->tokens, (template->count + 1) * sizeof(template->tokens[0]));
+    template->tokens[template->count++] = (struct template_token){
+        .text = text, .len = len};
+}
 
-    struct sbuf formatted = {0};
+static void
+parse_tag_args(struct template_token *token, const char *tag_name,
+               const char *tag_args[], size_t count)
+{
+    token->format = FMT_DEFAULT;
+    token->kind = VALUE_VALUE;
+    token->digits = 0;
+    token->decimals = 2;
+    token->zero_pad = false;
+
+    for (size_t i = 0; i < count; i++) {
+        char *point = NULL;
+
+        if (tag_args[i] == NULL)
+            break;
+        else if (strchr(tag_args[i], '{') != NULL) {
+            /*
+             * Really a nested tag (see template_token.alternatives),
+             * unless the tag exists; that is only known at expansion
+             * time, so don't warn about it here
+             */
+        }
+        else if (strcmp(tag_args[i], "hex") == 0)
+            token->format = FMT_HEX;
+        else if (strcmp(tag_args[i], "oct") == 0)
+            token->format = FMT_OCT;
+        else if (strcmp(tag_args[i], "%") == 0)
+            token->format = FMT_PERCENT;
+        else if (strcmp(tag_args[i], "kb") == 0)
+            token->format = FMT_KBYTE;
+        else if (strcmp(tag_args[i], "mb") == 0)
+            token->format = FMT_MBYTE;
+        else if (strcmp(tag_args[i], "gb") == 0)
+            token->format = FMT_GBYTE;
+        else if (strcmp(tag_args[i], "kib") == 0)
+            token->format = FMT_KIBYTE;
+        else if (strcmp(tag_args[i], "mib") == 0)
+            token->format = FMT_MIBYTE;
+        else if (strcmp(tag_args[i], "gib") == 0)
+            token->format = FMT_GIBYTE;
+        else if (strcmp(tag_args[i], "min") == 0)
+            token->kind = VALUE_MIN;
+        else if (strcmp(tag_args[i], "max") == 0)
+            token->kind = VALUE_MAX;
+        else if (strcmp(tag_args[i], "unit") == 0)
+            token->kind = VALUE_UNIT;
+        else if (is_number(tag_args[i], &token->digits)) // i.e.: "{tag:3}"
+            token->zero_pad = tag_args[i][0] == '0';
+        else if ((point = strchr(tag_args[i], '.')) != NULL) {
+            *point = '\0';
+
+            const char *digits_str = tag_args[i];
+            const char *decimals_str = point + 1;
+
+            if (digits_str[0] != '\0') { // guards against i.e. "{tag:.3}"
+                if (!is_number(digits_str, &token->digits)) {
+                    LOG_WARN(
+                        "tag `%s`: invalid field width formatter. Ignoring...",
+                        tag_name);
+                }
+            }
+
+            if (decimals_str[0] != '\0') { // guards against i.e. "{tag:3.}"
+                if (!is_number(decimals_str, &token->decimals)) {
+                    LOG_WARN(
+                        "tag `%s`: invalid decimals formatter. Ignoring...",
+                        tag_name);
+                }
+            }
+            token->zero_pad = digits_str[0] == '0';
+        }
+        else
+            LOG_WARN("invalid tag formatter: %s", tag_args[i]);
+    }
+}
+
+/* Tokenizes 'text', up to (but not including) 'stop' */
+static void
+template_tokenize(struct tag_template *template, const char *text,
+                  const char *stop)
+{
     while (true) {
         /* Find next tag opening '{' */
-        const char *begin = strchr(template, '{');
+        const char *begin = memchr(text, '{', stop - text);
 
         if (begin == NULL) {
             /* No more tags, copy remaining characters */
-            sbuf_append(&formatted, template);
+            template_add_literal(template, text, stop - text);
             break;
         }
 
         /* Find closing '}' */
-        const char *end = strchr(begin, '}');
+        const char *end = memchr(begin, '}', stop - begin);
         if (end == NULL) {
             /* Wasn't actually a tag, copy as-is instead */
-            sbuf_append_at_most(&formatted, template, begin - template + 1);
-            template = begin + 1;
+            template_add_literal(template, text, begin - text + 1);
+            text = begin + 1;
             continue;
         }
 
@@ -491,246 +954,266 @@ tags_expand_template(const char *template, const struct tag_set *tags)
             }
         }
 
-        /* Lookup tag */
-        const struct tag *tag = NULL;
-
-        if (tag_name == NULL || (tag = tag_for_name(tags, tag_name)) == NULL) {
-            /* No such tag, copy as-is instead */
-            sbuf_append_at_most(&formatted, template, begin - template + 1);
-            template = begin + 1;
+        /*
+         * Tag names never contain '{'; such a "tag" is really a
+         * literal '{', followed by another tag
+         */
+        if (tag_name == NULL || strchr(tag_name, '{') != NULL) {
+            /* Not a tag, copy as-is instead */
+            template_add_literal(template, text, begin - text + 1);
+            text = begin + 1;
             continue;
         }
 
         /* Copy characters preceding the tag (name) */
-        sbuf_append_at_most(&formatted, template, begin - template);
-
-        /* Parse arguments */
-        enum {
-            FMT_DEFAULT,
-            FMT_HEX,
-            FMT_OCT,
-            FMT_PERCENT,
-            FMT_KBYTE,
-            FMT_MBYTE,
-            FMT_GBYTE,
-            FMT_KIBYTE,
-            FMT_MIBYTE,
-            FMT_GIBYTE,
-        } format = FMT_DEFAULT;
-
-        enum {
-            VALUE_VALUE,
-            VALUE_MIN,
-            VALUE_MAX,
-            VALUE_UNIT,
-        } kind = VALUE_VALUE;
-
-        int digits = 0;
-        int decimals = 2;
-        bool zero_pad = false;
-        char *point = NULL;
+        template_add_literal(template, text, begin - text);
 
-        for (size_t i = 0; i < MAX_TAG_ARGS; i++) {
-            if (tag_args[i] == NULL)
-                break;
-            else if (strcmp(tag_args[i], "hex") == 0)
-                format = FMT_HEX;
-            else if (strcmp(tag_args[i], "oct") == 0)
-                format = FMT_OCT;
-            else if (strcmp(tag_args[i], "%") == 0)
-                format = FMT_PERCENT;
-            else if (strcmp(tag_args[i], "kb") == 0)
-                format = FMT_KBYTE;
-            else if (strcmp(tag_args[i], "mb") == 0)
-                format = FMT_MBYTE;
-            else if (strcmp(tag_args[i], "gb") == 0)
-                format = FMT_GBYTE;
-            else if (strcmp(tag_args[i], "kib") == 0)
-                format = FMT_KIBYTE;
-            else if (strcmp(tag_args[i], "mib") == 0)
-                format = FMT_MIBYTE;
-            else if (strcmp(tag_args[i], "gib") == 0)
-                format = FMT_GIBYTE;
-            else if (strcmp(tag_args[i], "min") == 0)
-                kind = VALUE_MIN;
-            else if (strcmp(tag_args[i], "max") == 0)
-                kind = VALUE_MAX;
-            else if (strcmp(tag_args[i], "unit") == 0)
-                kind = VALUE_UNIT;
-            else if (is_number(tag_args[i], &digits)) // i.e.: "{tag:3}"
-                zero_pad = tag_args[i][0] == '0';
-            else if ((point = strchr(tag_args[i], '.')) != NULL) {
-                *point = '\0';
-
-                const char *digits_str = tag_args[i];
-                const char *decimals_str = point + 1;
-
-                if (digits_str[0] != '\0') { // guards against i.e. "{tag:.3}"
-                    if (!is_number(digits_str, &digits)) {
-                        LOG_WARN(
-                            "tag `%s`: invalid field width formatter. Ignoring...",
-                            tag_name);
-                    }
-                }
+        const bool nested = memchr(begin + 1, '{', end - begin - 1) != NULL;
 
-                if (decimals_str[0] != '\0') { // guards against i.e. "{tag:3.}"
-                    if (!is_number(decimals_str, &decimals)) {
-                        LOG_WARN(
-                            "tag `%s`: invalid decimals formatter. Ignoring...",
-                            tag_name);
-                    }
-                }
-                zero_pad = digits_str[0] == '0';
-            }
-            else
-                LOG_WARN("invalid tag formatter: %s", tag_args[i]);
+        struct template_token token = {
+            .text = begin,
+            .len = nested ? 1 : end - begin + 1,
+        };
+        tag_ref_init(&token.tag, tag_name);
+        parse_tag_args(&token, tag_name, tag_args, MAX_TAG_ARGS);
+
+        template->tokens = realloc(
+            template->tokens,
+            (template->count + 1) * sizeof(template->tokens[0]));
+        template->tokens[template->count++] = token;
+
+        if (nested) {
+            /* What the text is, if the tag does not exist */
+            const size_t idx = template->count - 1;
+            template_tokenize(template, begin + 1, end + 1);
+
+            template->tokens[idx].alternatives = template->count - idx - 1;
+            template->sealed = template->count;
         }
 
-        /* Copy tag value */
-        switch (kind) {
-        case VALUE_VALUE:
-            switch (format) {
-            case FMT_DEFAULT: {
-                switch (tag->type(tag)) {
-                case TAG_TYPE_FLOAT: {
-                    const char* fmt = zero_pad ? "%0*.*f" : "%*.*f";
-                    char str[24];
-                    snprintf(str, sizeof(str), fmt, digits, decimals, tag->as_float(tag));
-                    sbuf_append(&formatted, str);
-                    break;
-                }
+        /* Skip past tag name + closing '}' */
+        text = end + 1;
+    }
+}
 
-                case TAG_TYPE_INT: {
-                    const char* fmt = zero_pad ? "%0*ld" : "%*ld";
-                    char str[24];
-                    snprintf(str, sizeof(str), fmt, digits, tag->as_int(tag));
-                    sbuf_append(&formatted, str);
-                    break;
-                }
+struct tag_template *
+tag_template_compile(const char *source)
+{
+    if (source == NULL)
+        return NULL;
 
-                default:
-                    sbuf_append(&formatted, tag->as_string(tag));
-                    break;
-                }
+    struct tag_template *template = calloc(1, sizeof(*template));
+    template->source = strdup(source);
 
+    template_tokenize(
+        template, template->source,
+        template->source + strlen(template->source));
+    return template;
+}
+
+void
+tag_template_destroy(struct tag_template *template)
+{
+    if (template == NULL)
+        return;
+
+    free(template->tokens);
+    free(template->source);
+    free(template->buf.s);
+    free(template);
+}
+
+static void
+expand_tag(struct sbuf *formatted, const struct template_token *token,
+           const struct tag *tag)
+{
+    const enum token_format format = token->format;
+    const int digits = token->digits;
+    const int decimals = token->decimals;
+    const bool zero_pad = token->zero_pad;
+
+    /* Copy tag value */
+    switch (token->kind) {
+    case VALUE_VALUE:
+        switch (format) {
+        case FMT_DEFAULT: {
+            switch (tag->type(tag)) {
+            case TAG_TYPE_FLOAT: {
+                const char* fmt = zero_pad ? "%0*.*f" : "%*.*f";
+                char str[24];
+                snprintf(str, sizeof(str), fmt, digits, decimals, tag->as_float(tag));
+                sbuf_append(formatted, str);
                 break;
             }
 
-            case FMT_HEX:
-            case FMT_OCT: {
-                const char* fmt = format == FMT_HEX ?
-                    zero_pad ? "%0*lx" : "%*lx" :
-                    zero_pad ? "%0*lo" : "%*lo";
+            case TAG_TYPE_INT: {
+                const char* fmt = zero_pad ? "%0*ld" : "%*ld";
                 char str[24];
                 snprintf(str, sizeof(str), fmt, digits, tag->as_int(tag));
-                sbuf_append(&formatted, str);
+                sbuf_append(formatted, str);
                 break;
             }
 
-            case FMT_PERCENT: {
-                const long min = tag->min(tag);
-                const long max = tag->max(tag);
-                const long cur = tag->as_int(tag);
-
-                const char* fmt = zero_pad ? "%0*lu" : "%*lu";
-                char str[4];
-                snprintf(str, sizeof(str), fmt, digits, (cur - min) * 100 / (max - min));
-                sbuf_append(&formatted, str);
+            default:
+                sbuf_append(formatted, tag->as_string(tag));
                 break;
             }
 
-            case FMT_KBYTE:
-            case FMT_MBYTE:
-            case FMT_GBYTE:
-            case FMT_KIBYTE:
-            case FMT_MIBYTE:
-            case FMT_GIBYTE: {
-                const long divider =
-                    format == FMT_KBYTE ? 1000 :
-                    format == FMT_MBYTE ? 1000 * 1000 :
-                    format == FMT_GBYTE ? 1000 * 1000 * 1000 :
-                    format == FMT_KIBYTE ? 1024 :
-                    format == FMT_MIBYTE ? 1024 * 1024 :
-                    format == FMT_GIBYTE ? 1024 * 1024 * 1024 :
-                    1;
+            break;
+        }
 
-                char str[24];
-                if (tag->type(tag) == TAG_TYPE_FLOAT) {
-                    const char* fmt = zero_pad ? "%0*.*f" : "%*.*f";
-                    snprintf(str, sizeof(str), fmt, digits, decimals, tag->as_float(tag) / (double)divider);
-                } else {
-                    const char* fmt = zero_pad ? "%0*lu" : "%*lu";
-                    snprintf(str, sizeof(str), fmt, digits, tag->as_int(tag) / divider);
-                }
-                sbuf_append(&formatted, str);
-                break;
-            }
-            }
+        case FMT_HEX:
+        case FMT_OCT: {
+            const char* fmt = format == FMT_HEX ?
+                zero_pad ? "%0*lx" : "%*lx" :
+                zero_pad ? "%0*lo" : "%*lo";
+            char str[24];
+            snprintf(str, sizeof(str), fmt, digits, tag->as_int(tag));
+            sbuf_append(formatted, str);
             break;
+        }
 
-        case VALUE_MIN:
-        case VALUE_MAX: {
+        case FMT_PERCENT: {
             const long min = tag->min(tag);
             const long max = tag->max(tag);
-            long value = kind == VALUE_MIN ? min : max;
-
-            const char *fmt = NULL;
-            switch (format) {
-            case FMT_DEFAULT: fmt = zero_pad ? "%0*ld" : "%*ld"; break;
-            case FMT_HEX:     fmt = zero_pad ? "%0*lx" : "%*lx"; break;
-            case FMT_OCT:     fmt = zero_pad ? "%0*lo" : "%*lo"; break;
-            case FMT_PERCENT:
-                value = (value - min) * 100 / (max - min);
-                fmt = zero_pad ? "%0*lu" : "%*lu";
-                break;
+            const long cur = tag->as_int(tag);
 
-            case FMT_KBYTE:
-            case FMT_MBYTE:
-            case FMT_GBYTE:
-            case FMT_KIBYTE:
-            case FMT_MIBYTE:
-            case FMT_GIBYTE: {
-                const long divider =
-                    format == FMT_KBYTE ? 1024 :
-                    format == FMT_MBYTE ? 1024 * 1024 :
-                    format == FMT_GBYTE ? 1024 * 1024 * 1024 :
-                    format == FMT_KIBYTE ? 1000 :
-                    format == FMT_MIBYTE ? 1000 * 1000 :
-                    format == FMT_GIBYTE ? 1000 * 1000 * 1000 :
-                    1;
-                value /= divider;
-                fmt = zero_pad ? "%0*lu" : "%*lu";
-                break;
-            }
-            }
+            const char* fmt = zero_pad ? "%0*lu" : "%*lu";
+            char str[4];
+            snprintf(str, sizeof(str), fmt, digits, (cur - min) * 100 / (max - min));
+            sbuf_append(formatted, str);
+            break;
+        }
 
-            assert(fmt != NULL);
+        case FMT_KBYTE:
+        case FMT_MBYTE:
+        case FMT_GBYTE:
+        case FMT_KIBYTE:
+        case FMT_MIBYTE:
+        case FMT_GIBYTE: {
+            const long divider =
+                format == FMT_KBYTE ? 1000 :
+                format == FMT_MBYTE ? 1000 * 1000 :
+                format == FMT_GBYTE ? 1000 * 1000 * 1000 :
+                format == FMT_KIBYTE ? 1024 :
+                format == FMT_MIBYTE ? 1024 * 1024 :
+                format == FMT_GIBYTE ? 1024 * 1024 * 1024 :
+                1;
 
             char str[24];
-            snprintf(str, sizeof(str), fmt, digits, value);
-            sbuf_append(&formatted, str);
+            if (tag->type(tag) == TAG_TYPE_FLOAT) {
+                const char* fmt = zero_pad ? "%0*.*f" : "%*.*f";
+                snprintf(str, sizeof(str), fmt, digits, decimals, tag->as_float(tag) / (double)divider);
+            } else {
+                const char* fmt = zero_pad ? "%0*lu" : "%*lu";
+                snprintf(str, sizeof(str), fmt, digits, tag->as_int(tag) / divider);
+            }
+            sbuf_append(formatted, str);
+            break;
+        }
+        }
+        break;
+
+    case VALUE_MIN:
+    case VALUE_MAX: {
+        const long min = tag->min(tag);
+        const long max = tag->max(tag);
+        long value = token->kind == VALUE_MIN ? min : max;
+
+        const char *fmt = NULL;
+        switch (format) {
+        case FMT_DEFAULT: fmt = zero_pad ? "%0*ld" : "%*ld"; break;
+        case FMT_HEX:     fmt = zero_pad ? "%0*lx" : "%*lx"; break;
+        case FMT_OCT:     fmt = zero_pad ? "%0*lo" : "%*lo"; break;
+        case FMT_PERCENT:
+            value = (value - min) * 100 / (max - min);
+            fmt = zero_pad ? "%0*lu" : "%*lu";
             break;
+
+        case FMT_KBYTE:
+        case FMT_MBYTE:
+        case FMT_GBYTE:
+        case FMT_KIBYTE:
+        case FMT_MIBYTE:
+        case FMT_GIBYTE: {
+            const long divider =
+                format == FMT_KBYTE ? 1024 :
+                format == FMT_MBYTE ? 1024 * 1024 :
+                format == FMT_GBYTE ? 1024 * 1024 * 1024 :
+                format == FMT_KIBYTE ? 1000 :
+                format == FMT_MIBYTE ? 1000 * 1000 :
+                format == FMT_GIBYTE ? 1000 * 1000 * 1000 :
+                1;
+            value /= divider;
+            fmt = zero_pad ? "%0*lu" : "%*lu";
+            break;
+        }
         }
 
-        case VALUE_UNIT: {
-            const char *value = NULL;
+        assert(fmt != NULL);
 
-            switch (tag->realtime(tag)) {
-            case TAG_REALTIME_NONE:  value = ""; break;
-            case TAG_REALTIME_SECS:  value = "s"; break;
-            case TAG_REALTIME_MSECS: value = "ms"; break;
-            }
+        char str[24];
+        snprintf(str, sizeof(str), fmt, digits, value);
+        sbuf_append(formatted, str);
+        break;
+    }
 
-            sbuf_append(&formatted, value);
-            break;
+    case VALUE_UNIT: {
+        const char *value = NULL;
+
+        switch (tag->realtime(tag)) {
+        case TAG_REALTIME_NONE:  value = ""; break;
+        case TAG_REALTIME_SECS:  value = "s"; break;
+        case TAG_REALTIME_MSECS: value = "ms"; break;
         }
+
+        sbuf_append(formatted, value);
+        break;
+    }
+    }
+}
+
+const char *
+tag_template_expand(struct tag_template *template, const struct tag_set *tags)
+{
+    if (template == NULL)
+        return NULL;
+
+    struct sbuf *formatted = &template->buf;
+    formatted->len = 0;
+
+    /* Always return a string, even if the template is empty */
+    sbuf_append_at_most(formatted, "", 0);
+
+    for (size_t i = 0; i < template->count; i++) {
+        struct template_token *token = &template->tokens[i];
+        const struct tag *tag = NULL;
+
+        if (token->tag.atom == TAG_ATOM_NONE ||
+            (tag = tag_for_ref(tags, &token->tag)) == NULL)
+        {
+            /* Literal, or no such tag; copy as-is */
+            sbuf_append_at_most(formatted, token->text, token->len);
+            continue;
         }
 
-        /* Skip past tag name + closing '}' */
-        template = end + 1;
+        expand_tag(formatted, token, tag);
+        i += token->alternatives;
     }
 
-    return formatted.s;
+    return formatted->s;
+}
+
+char *
+tags_expand_template(const char *template, const struct tag_set *tags)
+{
+    if (template == NULL)
+        return NULL;
+
+    struct tag_template *compiled = tag_template_compile(template);
+    char *expanded = strdup(tag_template_expand(compiled, tags));
+    tag_template_destroy(compiled);
+    return expanded;
 }
 
 void
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 enum tag_type {
@@ -18,9 +19,22 @@ enum tag_realtime_unit {
 
 struct module;
 
+/*
+ * Tag names are interned; each distinct name maps to a unique,
+ * non-zero, atom. Two tags have the same name if, and only if, they
+ * have the same atom. Atoms (and their names) live until exit.
+ */
+typedef uint32_t tag_atom_t;
+
+#define TAG_ATOM_NONE ((tag_atom_t)0)
+
+tag_atom_t tag_atom(const char *name);
+const char *tag_atom_name(tag_atom_t atom);
+
 struct tag {
     void *private;
     struct module *owner;
+    tag_atom_t atom;
 
     void (*destroy)(struct tag *tag);
     const char *(*name)(const struct tag *tag);
@@ -35,6 +49,12 @@ struct tag {
     enum tag_realtime_unit (*realtime)(const struct tag *tag);
 
     bool (*refresh_in)(const struct tag *tag, long units);
+
+    /*
+     * Array tags (e.g. per-core CPU usage) return their values, and
+     * the number of values; all other tags return 0.
+     */
+    size_t (*as_array)(const struct tag *tag, const uint8_t **values);
 };
 
 struct tag_set {
@@ -53,9 +73,46 @@ struct tag *tag_new_float(struct module *owner, const char *name, double value);
 struct tag *tag_new_string(
     struct module *owner, const char *name, const char *value);
 
+/*
+ * A packed array of small integers in [min, max], e.g. one value per
+ * CPU core. The values are copied. As a scalar, the tag is an int
+ * holding the values' average; as a string, a comma separated list.
+ */
+struct tag *tag_new_int_array(
+    struct module *owner, const char *name, const uint8_t *values,
+    size_t count, long min, long max);
+
+/*
+ * A reference to a tag, resolved at configuration time. Modules
+ * publish their tags in the same order on every update, so the
+ * position a tag was last found at is remembered, and checked first;
+ * a lookup is then a single atom comparison.
+ */
+struct tag_ref {
+    tag_atom_t atom;
+    size_t slot;
+};
+
+void tag_ref_init(struct tag_ref *ref, const char *name);
+const struct tag *tag_for_ref(const struct tag_set *set, struct tag_ref *ref);
+const struct tag *tag_for_atom(const struct tag_set *set, tag_atom_t atom);
 const struct tag *tag_for_name(const struct tag_set *set, const char *name);
 void tag_set_destroy(struct tag_set *set);
 
+/*
+ * Templates are compiled once, to a sequence of literal text spans
+ * and tag references with pre-parsed formatters. The expanded string
+ * is written to a buffer owned by the template, re-used by each
+ * expansion; it is valid until the next expansion, or until the
+ * template is destroyed.
+ */
+struct tag_template;
+
+struct tag_template *tag_template_compile(const char *template);
+void tag_template_destroy(struct tag_template *template);
+const char *tag_template_expand(
+    struct tag_template *template, const struct tag_set *tags);
+
 /* Utility functions */
 char *tags_expand_template(const char *template, const struct tag_set *tags);
 void tags_expand_templates(
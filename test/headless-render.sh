@@ -0,0 +1,23 @@
+#!/bin/sh
+
+# Renders a single frame with the headless backend, and compares it
+# with a reference frame.
+#
+# Usage: headless-render.sh <yambar> <config> <reference.ppm>
+
+set -e
+
+yambar=${1}
+config=${2}
+reference=${3}
+
+dump_dir=$(mktemp -d)
+trap 'rm -rf "${dump_dir}"' EXIT
+
+YAMBAR_HEADLESS_DUMP="${dump_dir}" \
+    "${yambar}" --backend=headless --config="${config}"
+
+if ! cmp "${dump_dir}/frame-000000.ppm" "${reference}"; then
+    echo "rendered frame differs from ${reference}" >&2
+    exit 1
+fi
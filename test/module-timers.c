@@ -0,0 +1,110 @@
+/*
+ * Shared module event loop: timers with overlapping windows must be
+ * handled by a single wakeup, and timers with disjoint windows by one
+ * wakeup each.
+ *
+ * Includes module.c, to drive the loop's timers with a simulated
+ * clock, and to get at its statistics.
+ */
+#include "../module.c"
+
+#include <stdio.h>
+#include <sys/eventfd.h>
+
+static const char *
+description(const struct module *mod)
+{
+    return "test";
+}
+
+static bool
+setup(struct module *mod)
+{
+    return true;
+}
+
+static bool
+on_timer(struct module *mod)
+{
+    return true;
+}
+
+static void
+arm(struct module *mod, uint64_t deadline, long slack_ms)
+{
+    struct loop_timer *timer = get_timer(mod);
+    timer->deadline = deadline;
+    timer->interval_ms = 0;
+    timer->slack_ms = slack_ms;
+    timer->handler = &on_timer;
+    timer->armed = true;
+}
+
+/*
+ * Arms two one-shot timers, and runs the loop's timer logic until
+ * both have fired, jumping straight to each wakeup
+ */
+static bool
+check(uint64_t deadline_a, uint64_t deadline_b, long slack_ms,
+      uint64_t expected_wakeups)
+{
+    int abort_fd = eventfd(0, EFD_CLOEXEC);
+    struct module_loop *loop = module_loop_new(abort_fd);
+    struct module *a = module_common_new();
+    struct module *b = module_common_new();
+    a->setup = b->setup = &setup;
+    a->description = b->description = &description;
+
+    module_loop_add_module(loop, a);
+    module_loop_add_module(loop, b);
+
+    arm(a, deadline_a, slack_ms);
+    arm(b, deadline_b, slack_ms);
+
+    uint64_t now;
+    while (next_wakeup(loop, &now)) {
+        const struct loop_timer *ta = get_timer(a);
+        const struct loop_timer *tb = get_timer(b);
+
+        if ((ta->armed && now > ta->deadline + slack_ms) ||
+            (tb->armed && now > tb->deadline + slack_ms))
+        {
+            printf("FAIL: woke up at %"PRIu64", after a window closed\n", now);
+            break;
+        }
+
+        run_expired_timers(loop, now);
+    }
+
+    const bool ok = !get_timer(a)->armed && !get_timer(b)->armed &&
+                    loop->stats.timers_fired == 2 &&
+                    loop->stats.wakeups == expected_wakeups;
+
+    printf("%s: A=[%"PRIu64", %"PRIu64"], B=[%"PRIu64", %"PRIu64"]: "
+           "wakeups: %"PRIu64" (expected %"PRIu64"), timers fired: %"PRIu64"\n",
+           ok ? "OK" : "FAIL",
+           deadline_a, deadline_a + slack_ms, deadline_b, deadline_b + slack_ms,
+           loop->stats.wakeups, expected_wakeups, loop->stats.timers_fired);
+
+    module_loop_destroy(loop);
+    a->destroy(a);
+    b->destroy(b);
+    close(abort_fd);
+    return ok;
+}
+
+int
+main(int argc, const char *const *argv)
+{
+    bool ok = true;
+
+    /* Overlapping: one wakeup, in [1050, 1100] */
+    ok = check(1000, 1050, 100, 1) && ok;
+    ok = check(1050, 1000, 100, 1) && ok;
+    ok = check(2990, 3010, 50, 1) && ok;
+
+    /* Disjoint: one wakeup each */
+    ok = check(1000, 1200, 100, 2) && ok;
+
+    return ok ? 0 : 1;
+}